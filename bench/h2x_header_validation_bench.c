@@ -0,0 +1,110 @@
+/*
+ * Compares the vectorized header field checks against the byte-at-a-time reference on the kind of
+ * fields that dominate real header blocks: long cookie and authorization values, and short names.
+ *
+ * Usage: h2x_header_validation_bench [iterations]
+ */
+
+#include <h2x_header_validation.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLE_COUNT 64
+#define MAX_SAMPLE_LENGTH 4096
+
+struct sample
+{
+    char* name;
+    uint32_t name_length;
+    char* value;
+    uint32_t value_length;
+};
+
+static uint32_t next_random(uint32_t* seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+
+    return x;
+}
+
+static void fill_sample(struct sample* sample, uint32_t sample_index, uint32_t* seed)
+{
+    static const char base64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    static const char* names[] = { "cookie", "authorization", "user-agent", "x-request-id", ":path", "accept-language" };
+
+    sample->name = strdup(names[sample_index % (sizeof(names) / sizeof(names[0]))]);
+    sample->name_length = (uint32_t) strlen(sample->name);
+
+    sample->value = malloc(MAX_SAMPLE_LENGTH);
+    sample->value_length = 32 + next_random(seed) % (MAX_SAMPLE_LENGTH - 32);
+    for(uint32_t i = 0; i < sample->value_length; ++i)
+    {
+        sample->value[i] = base64_alphabet[next_random(seed) % 64];
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static double run_checks(bool (*name_is_valid)(const char*, uint32_t), bool (*value_is_valid)(const char*, uint32_t),
+                         struct sample* samples, uint32_t iterations)
+{
+    uint64_t start = now_ns();
+    for(uint32_t iteration = 0; iteration < iterations; ++iteration)
+    {
+        for(uint32_t i = 0; i < SAMPLE_COUNT; ++i)
+        {
+            if(!name_is_valid(samples[i].name, samples[i].name_length) || !value_is_valid(samples[i].value, samples[i].value_length))
+            {
+                fprintf(stderr, "Sample %u unexpectedly failed validation\n", i);
+                exit(1);
+            }
+        }
+    }
+
+    return (double) (now_ns() - start);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t iterations = argc > 1 ? (uint32_t) atoi(argv[1]) : 20000;
+    uint32_t seed = 0x9E3779B9;
+
+    struct sample samples[SAMPLE_COUNT];
+    uint64_t total_bytes = 0;
+    for(uint32_t i = 0; i < SAMPLE_COUNT; ++i)
+    {
+        fill_sample(&samples[i], i, &seed);
+        total_bytes += samples[i].name_length + samples[i].value_length;
+    }
+
+    total_bytes *= iterations;
+
+    double scalar_ns = run_checks(h2x_header_name_is_valid_scalar, h2x_header_value_is_valid_scalar, samples, iterations);
+    printf("scalar:     %8.3f ns/byte  %8.1f MB/s\n", scalar_ns / total_bytes, total_bytes * 1000.0 / scalar_ns);
+
+    double vector_ns = run_checks(h2x_header_name_is_valid, h2x_header_value_is_valid, samples, iterations);
+    printf("vectorized: %8.3f ns/byte  %8.1f MB/s\n", vector_ns / total_bytes, total_bytes * 1000.0 / vector_ns);
+
+    printf("speedup: %.1fx\n", scalar_ns / vector_ns);
+
+    for(uint32_t i = 0; i < SAMPLE_COUNT; ++i)
+    {
+        free(samples[i].name);
+        free(samples[i].value);
+    }
+
+    return 0;
+}
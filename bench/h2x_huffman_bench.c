@@ -0,0 +1,165 @@
+/*
+ * Compares the table-driven Huffman decoder against the bit-at-a-time reference on header strings
+ * shaped like real traffic: long base64 cookies, user agents and paths.
+ *
+ * Usage: h2x_huffman_bench [iterations]
+ */
+
+#include <h2x_huffman.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLE_COUNT 64
+#define MAX_SAMPLE_LENGTH 4096
+
+struct sample
+{
+    uint8_t* encoded;
+    uint32_t encoded_length;
+    uint8_t* decoded;
+    uint32_t decoded_length;
+};
+
+static uint32_t next_random(uint32_t* seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+
+    return x;
+}
+
+static uint32_t fill_sample_text(uint8_t* text, uint32_t sample_index, uint32_t* seed)
+{
+    static const char base64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    static const char* user_agent = "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36";
+
+    uint32_t length = 0;
+    switch(sample_index % 3)
+    {
+        case 0:
+            // cookie jar: several name=base64 pairs
+            while(length < 512 + next_random(seed) % 2048)
+            {
+                length += sprintf((char*) text + length, "session%u=", next_random(seed) % 100);
+                uint32_t value_length = 16 + next_random(seed) % 128;
+                for(uint32_t i = 0; i < value_length; ++i)
+                {
+                    text[length++] = base64_alphabet[next_random(seed) % 64];
+                }
+                text[length++] = ';';
+                text[length++] = ' ';
+            }
+            break;
+
+        case 1:
+            length = sprintf((char*) text, "%s", user_agent);
+            break;
+
+        default:
+            length = sprintf((char*) text, "/api/v%u/accounts/%u/orders?page=%u&sort=created_at", next_random(seed) % 4, next_random(seed), next_random(seed) % 50);
+            break;
+    }
+
+    return length;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static double run_decoder(int (*decode)(const uint8_t*, uint32_t, uint8_t*, uint32_t, uint32_t*),
+                          struct sample* samples, uint32_t iterations, uint8_t* output, uint64_t* total_decoded)
+{
+    *total_decoded = 0;
+
+    uint64_t start = now_ns();
+    for(uint32_t iteration = 0; iteration < iterations; ++iteration)
+    {
+        for(uint32_t i = 0; i < SAMPLE_COUNT; ++i)
+        {
+            uint32_t output_length = 0;
+            if(decode(samples[i].encoded, samples[i].encoded_length, output, MAX_SAMPLE_LENGTH * 2, &output_length) ||
+               output_length != samples[i].decoded_length)
+            {
+                fprintf(stderr, "Decode of sample %u failed\n", i);
+                exit(1);
+            }
+
+            *total_decoded += output_length;
+        }
+    }
+
+    return (double) (now_ns() - start);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t iterations = argc > 1 ? (uint32_t) atoi(argv[1]) : 2000;
+    uint32_t seed = 0x9E3779B9;
+
+    struct sample samples[SAMPLE_COUNT];
+    uint64_t raw_bytes = 0;
+    uint64_t encoded_bytes = 0;
+    for(uint32_t i = 0; i < SAMPLE_COUNT; ++i)
+    {
+        samples[i].decoded = malloc(MAX_SAMPLE_LENGTH);
+        samples[i].decoded_length = fill_sample_text(samples[i].decoded, i, &seed);
+        samples[i].encoded = malloc(MAX_SAMPLE_LENGTH);
+        samples[i].encoded_length = h2x_huffman_encode(samples[i].decoded, samples[i].decoded_length, samples[i].encoded);
+
+        raw_bytes += samples[i].decoded_length;
+        encoded_bytes += samples[i].encoded_length;
+    }
+
+    uint8_t* output = malloc(MAX_SAMPLE_LENGTH * 2);
+
+    // both decoders have to agree before their timings mean anything
+    for(uint32_t i = 0; i < SAMPLE_COUNT; ++i)
+    {
+        uint32_t output_length = 0;
+        if(h2x_huffman_decode(samples[i].encoded, samples[i].encoded_length, output, MAX_SAMPLE_LENGTH * 2, &output_length) ||
+           output_length != samples[i].decoded_length || memcmp(output, samples[i].decoded, output_length) != 0)
+        {
+            fprintf(stderr, "Table-driven decoder mismatch on sample %u\n", i);
+            return 1;
+        }
+
+        if(h2x_huffman_decode_bitwise(samples[i].encoded, samples[i].encoded_length, output, MAX_SAMPLE_LENGTH * 2, &output_length) ||
+           output_length != samples[i].decoded_length || memcmp(output, samples[i].decoded, output_length) != 0)
+        {
+            fprintf(stderr, "Bitwise decoder mismatch on sample %u\n", i);
+            return 1;
+        }
+    }
+
+    printf("%u samples, %lu raw bytes, %lu Huffman-coded bytes (%.1f%%)\n", SAMPLE_COUNT, (unsigned long) raw_bytes,
+           (unsigned long) encoded_bytes, 100.0 * encoded_bytes / raw_bytes);
+
+    uint64_t decoded = 0;
+    double bitwise_ns = run_decoder(h2x_huffman_decode_bitwise, samples, iterations, output, &decoded);
+    printf("bitwise:      %8.2f ns/byte  %8.1f MB/s\n", bitwise_ns / decoded, decoded * 1000.0 / bitwise_ns);
+
+    double table_ns = run_decoder(h2x_huffman_decode, samples, iterations, output, &decoded);
+    printf("table-driven: %8.2f ns/byte  %8.1f MB/s\n", table_ns / decoded, decoded * 1000.0 / table_ns);
+
+    printf("speedup: %.1fx\n", bitwise_ns / table_ns);
+
+    free(output);
+    for(uint32_t i = 0; i < SAMPLE_COUNT; ++i)
+    {
+        free(samples[i].decoded);
+        free(samples[i].encoded);
+    }
+
+    return 0;
+}
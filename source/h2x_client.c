@@ -36,17 +36,17 @@ static int handle_connect_command(int argc, char** argv, void* context)
     return 0;
 }
 
-void response_header_callback(struct h2x_connection* connection, struct h2x_header_list* headers, uint32_t stream_id, void* user_data)
+void response_header_callback(struct h2x_connection* connection, struct h2x_header_block* headers, uint32_t stream_id, void* user_data)
 {
-    h2x_header_reset_iter(headers);
-
     H2X_LOG(H2X_LOG_LEVEL_INFO, "Received response headers on stream %u, connection %d:", stream_id, connection->fd)
-    struct h2x_header* header = h2x_header_next(headers);
-    while(header)
+
+    uint32_t header_count = h2x_header_block_get_count(headers);
+    for(uint32_t i = 0; i < header_count; ++i)
     {
-        H2X_LOG(H2X_LOG_LEVEL_INFO, " %s = %s", header->name, header->value)
-        header = h2x_header_next(headers);
+        H2X_LOG(H2X_LOG_LEVEL_INFO, " %s = %s", h2x_header_block_get_name(headers, i, NULL), h2x_header_block_get_value(headers, i, NULL))
     }
+
+    h2x_header_block_destroy(headers);
 }
 
 void response_body_callback(struct h2x_connection* connection, uint8_t* data, uint32_t length, uint32_t stream_id, bool lastFrame, void* user_data)
@@ -130,11 +130,7 @@ static int handle_request_command(int argc, char** argv, void* context)
 
             H2X_LOG(H2X_LOG_LEVEL_INFO, "Fake request adding header pair %s=%s", header_name_buffer, header_value_buffer);
 
-            struct h2x_header header;
-            header.name = strdup(header_name_buffer);
-            header.value = strdup(header_value_buffer);
-
-            h2x_header_list_append(&request->header_list, header);
+            h2x_headers_add(request, header_name_buffer, header_value_buffer);
         }
     }
 
@@ -1,6 +1,8 @@
 
 #include <h2x_connection.h>
 
+#include <h2x_frame_pool.h>
+#include <h2x_header_validation.h>
 #include <h2x_log.h>
 #include <h2x_options.h>
 #include <h2x_stream.h>
@@ -8,7 +10,10 @@
 
 #include <assert.h>
 #include <memory.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdlib.h>
+#include <sys/socket.h>
 #include "h2x_net_shared.h"
 
 void h2x_socket_state_init(struct h2x_socket_state* socket_state)
@@ -27,10 +32,17 @@ void h2x_socket_state_init(struct h2x_socket_state* socket_state)
        __typeof__ (b) _b = (b); \
      _a < _b ? _a : _b; })
 
-static uint32_t stream_hash_function(void *arg) {
-    struct h2x_stream *stream = (struct h2x_stream *) arg;
-    return stream->stream_identifier;
-}
+#define max(a, b) \
+   ({ __typeof__ (a) _a = (a); \
+       __typeof__ (b) _b = (b); \
+     _a > _b ? _a : _b; })
+
+// room for a few full-size frames before the outbound ring has to grow
+#define OUTBOUND_BUFFER_INITIAL_SIZE 0x10000
+// once drained, rings that grew past this go back to their initial size
+#define OUTBOUND_BUFFER_SHRINK_WATERMARK 0x40000
+// the least DATA the outbound ring may hold, however small the socket's send buffer claims to be
+#define OUTBOUND_DATA_MIN_BUDGET 0x20000
 
 /*static void get_padding(struct h2x_frame *frame, uint8_t *padding_offset, uint8_t *padding_length) {
     *padding_offset = 0;
@@ -42,29 +54,83 @@ static uint32_t stream_hash_function(void *arg) {
     }
 }*/
 
+uint32_t h2x_connection_fd_hash_function(void* data) {
+    struct h2x_connection* connection = data;
+    return connection->fd;
+}
+
+static uint32_t h2x_connection_get_send_buffer_size(int fd) {
+    int size = 0;
+    socklen_t length = sizeof(size);
+    if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, &length) != 0 || size < 0) {
+        return 0;
+    }
+
+    return (uint32_t) size;
+}
+
+/*
+ * Our SETTINGS lead everything else we send.  The frame is only queued; the first write on the owning
+ * thread picks it up.
+ */
+void h2x_connection_queue_local_settings(struct h2x_connection *connection) {
+    if (connection->local_settings_queued) {
+        return;
+    }
+
+    struct h2x_frame frame;
+    h2x_frame_init_view(&frame, h2x_ring_buffer_reserve(&connection->outbound_buffer, H2X_SETTINGS_MAX_PAYLOAD_LENGTH + FRAME_HEADER_LENGTH),
+                        H2X_SETTINGS_MAX_PAYLOAD_LENGTH + FRAME_HEADER_LENGTH);
+
+    uint32_t length = h2x_settings_encode(&connection->local_settings, h2x_frame_get_payload(&frame));
+    h2x_frame_set_stream_identifier(&frame, 0);
+    h2x_frame_set_type(&frame, H2X_SETTINGS);
+    h2x_frame_set_flags(&frame, 0);
+    h2x_frame_set_length(&frame, length);
+
+    h2x_ring_buffer_commit(&connection->outbound_buffer, length + FRAME_HEADER_LENGTH);
+    connection->local_settings_queued = true;
+}
+
 void h2x_connection_init(struct h2x_connection *connection, struct h2x_thread *owner, int fd) {
-    connection->owner = owner;
+    atomic_init(&connection->owner, owner);
     connection->state = H2X_CS_NEW;
     connection->fd = fd;
     connection->queued_request = NULL;
+    connection->active_stream_count = 0;
 
     h2x_socket_state_init(&connection->socket_state);
+    h2x_uring_socket_state_init(&connection->uring_state);
+    connection->next_new_connection = NULL;
+    connection->migration_target = NULL;
     for (uint32_t i = 0; i < H2X_ICT_COUNT; ++i) {
         connection->intrusive_chains[i] = NULL;
         connection->in_intrusive_chain[i] = false;
     }
 
     connection->current_frame_size = 0;
+    connection->current_frame_read = 0;
+    connection->current_frame = NULL;
     connection->read_frame_state = H2X_RFS_NOT_ON_FRAME;
-    connection->current_outbound_frame = NULL;
-    connection->current_outbound_frame_read_position = 0;
     connection->on_stream_headers_received = NULL;
+    connection->on_stream_header_views_received = NULL;
     connection->on_stream_body_received = NULL;
     connection->on_stream_error = NULL;
     connection->on_stream_data_needed = NULL;
 
+    connection->last_seen_stream_id = 0;
+    connection->last_seen_frame_type = H2X_DATA;
+
     connection->user_data = NULL;
-    h2x_frame_list_init(&connection->outgoing_frames);
+    h2x_ring_buffer_init(&connection->outbound_buffer, OUTBOUND_BUFFER_INITIAL_SIZE, OUTBOUND_BUFFER_SHRINK_WATERMARK);
+    connection->outbound_data_budget = max(h2x_connection_get_send_buffer_size(fd), (uint32_t) OUTBOUND_DATA_MIN_BUDGET);
+    connection->pending_data_length = 0;
+    connection->is_write_paused = false;
+    h2x_hpack_encoder_init(&connection->hpack_encoder);
+    h2x_hpack_decoder_init(&connection->hpack_decoder);
+    connection->header_views = NULL;
+    connection->header_view_count = 0;
+    connection->header_view_capacity = 0;
 
     if (owner->options->mode == H2X_MODE_SERVER) {
         connection->next_outgoing_stream_id = 2;
@@ -72,46 +138,154 @@ void h2x_connection_init(struct h2x_connection *connection, struct h2x_thread *o
         connection->next_outgoing_stream_id = 1;
     }
 
-    h2x_hash_table_init(&connection->streams, 50, &stream_hash_function);
+    h2x_stream_table_init(&connection->streams);
+    memset(connection->recently_reset_stream_ids, 0, sizeof(connection->recently_reset_stream_ids));
+    connection->next_recently_reset_slot = 0;
+    connection->inbound_stream = NULL;
+    h2x_stream_init(&connection->retired_stream);
+
+    connection->send_window = H2X_DEFAULT_WINDOW_SIZE;
+    h2x_receive_window_init(&connection->receive_window, H2X_DEFAULT_WINDOW_SIZE);
+    h2x_stream_scheduler_init(&connection->scheduler);
+
+    h2x_settings_init_local(&connection->local_settings, owner->options);
+    h2x_settings_init(&connection->peer_settings);
+    connection->local_settings_queued = false;
+    connection->local_settings_acked = false;
+    connection->receive_initial_window_size = max(connection->local_settings.initial_window_size, (uint32_t) H2X_DEFAULT_WINDOW_SIZE);
+    connection->peer_stream_count = 0;
+    connection->local_stream_count = 0;
+    connection->goaway_received = false;
+
+    if (connection->local_settings.header_table_size > H2X_HPACK_DEFAULT_TABLE_SIZE) {
+        h2x_hpack_decoder_set_size_limit(&connection->hpack_decoder, connection->local_settings.header_table_size);
+    }
+}
+
+static void destroy_stream(struct h2x_stream *stream, void *context) {
+    h2x_stream_clean(stream);
+    free(stream);
 }
 
 void h2x_connection_cleanup(struct h2x_connection *connection) {
-    h2x_hash_table_cleanup(&connection->streams);
+    /*
+     * Cleanup happens on the connection manager's thread, so anything still held goes straight back
+     * to the heap rather than into the owning thread's frame pool.
+     */
+    if (connection->current_frame) {
+        h2x_frame_destroy(connection->current_frame);
+        connection->current_frame = NULL;
+    }
+
+    h2x_ring_buffer_cleanup(&connection->outbound_buffer);
+    h2x_hpack_encoder_cleanup(&connection->hpack_encoder);
+    h2x_hpack_decoder_cleanup(&connection->hpack_decoder);
+    free(connection->header_views);
+    connection->header_views = NULL;
+
+    h2x_stream_table_visit(&connection->streams, destroy_stream, NULL);
+    h2x_stream_table_cleanup(&connection->streams);
+    h2x_stream_clean(&connection->retired_stream);
+}
+
+static bool h2x_connection_check_frame_length(struct h2x_connection *connection, uint32_t frame_length) {
+    // what we advertise applies straight away: a peer still holding to the default stays well inside it
+    if (frame_length > connection->local_settings.max_frame_size) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received frame of length %u which exceeds the maximum of %u", connection->fd, frame_length,
+                connection->local_settings.max_frame_size);
+        h2x_connection_begin_close(connection);
+        return false;
+    }
+
+    return true;
+}
+
+static struct h2x_frame* h2x_connection_acquire_frame(struct h2x_connection *connection, uint32_t size) {
+    return h2x_frame_pool_acquire(&connection->owner->frame_pool, size);
+}
+
+static void h2x_connection_release_frame(struct h2x_connection *connection, struct h2x_frame* frame) {
+    h2x_frame_pool_release(&connection->owner->frame_pool, frame);
+}
+
+/*
+ * Outbound frames are built as views over a reservation in the outbound ring; they only become
+ * part of the outbound stream once h2x_connection_process_outbound_frame commits them.
+ */
+static void h2x_connection_begin_outbound_frame(struct h2x_connection *connection, struct h2x_frame* frame, uint32_t size) {
+    h2x_frame_init_view(frame, h2x_ring_buffer_reserve(&connection->outbound_buffer, size), size);
+}
+
+static void h2x_connection_commit_outbound_frame(struct h2x_connection *connection, struct h2x_frame *frame) {
+    h2x_ring_buffer_commit(&connection->outbound_buffer, frame->size);
+    h2x_connection_on_new_outbound_data(connection);
+}
+
+static void h2x_connection_release_current_frame(struct h2x_connection *connection) {
+    h2x_connection_release_frame(connection, connection->current_frame);
+    connection->current_frame = NULL;
 }
 
 void h2x_connection_on_data_received(struct h2x_connection *connection, uint8_t *data, uint32_t data_length) {
     uint32_t read = 0;
     uint32_t amount_to_read = 0;
 
-    do {
+    while (read < data_length || connection->read_frame_state == H2X_RFS_HEADER_FILLED) {
+        if (connection->state == H2X_CS_CLOSING) {
+            return;
+        }
+
         switch (connection->read_frame_state) {
             case H2X_RFS_NOT_ON_FRAME:
+                /*
+                 * If the whole frame is already sitting in the read buffer, decode it in place through
+                 * a view rather than copying it out.  Only frames that straddle reads get buffered.
+                 */
+                amount_to_read = data_length - read;
+                if (amount_to_read >= FRAME_HEADER_LENGTH) {
+                    uint32_t frame_length = h2x_frame_header_get_length(data + read);
+                    if (!h2x_connection_check_frame_length(connection, frame_length)) {
+                        return;
+                    }
+
+                    if (amount_to_read >= frame_length + FRAME_HEADER_LENGTH) {
+                        struct h2x_frame frame_view;
+                        h2x_frame_init_view(&frame_view, data + read, frame_length + FRAME_HEADER_LENGTH);
+                        read += frame_view.size;
+
+                        h2x_connection_push_frame_to_stream(connection, &frame_view, H2X_STREAM_INBOUND);
+                        break;
+                    }
+                }
+
                 connection->current_frame_read = 0;
                 connection->current_frame_size = 0;
-                connection->current_frame = (struct h2x_frame *) malloc(sizeof(struct h2x_frame));
-                h2x_frame_init(connection->current_frame);
-
-                connection->current_frame->raw_data = (uint8_t *) malloc(MAX_RECV_FRAME_SIZE);
-                connection->current_frame->size = MAX_RECV_FRAME_SIZE;
                 connection->read_frame_state = H2X_RFS_ON_HEADER;
                 break;
 
             case H2X_RFS_ON_HEADER:
                 amount_to_read = min(data_length - read, FRAME_HEADER_LENGTH - connection->current_frame_read);
-                memcpy(connection->current_frame->raw_data + connection->current_frame_read, data + read,
-                       amount_to_read);
+                memcpy(connection->current_frame_header + connection->current_frame_read, data + read, amount_to_read);
                 connection->current_frame_read += amount_to_read;
                 read += amount_to_read;
 
-                if (amount_to_read >= FRAME_HEADER_LENGTH) {
+                if (connection->current_frame_read >= FRAME_HEADER_LENGTH) {
                     connection->read_frame_state = H2X_RFS_HEADER_FILLED;
                 }
                 break;
 
             case H2X_RFS_HEADER_FILLED:
-                connection->current_frame_size = h2x_frame_get_length(connection->current_frame) + FRAME_HEADER_LENGTH;
+                if (!h2x_connection_check_frame_length(connection, h2x_frame_header_get_length(connection->current_frame_header))) {
+                    connection->read_frame_state = H2X_RFS_NOT_ON_FRAME;
+                    return;
+                }
+
+                // sized to the frame, so a large one comes straight off the heap rather than a pool class
+                connection->current_frame_size = h2x_frame_header_get_length(connection->current_frame_header) + FRAME_HEADER_LENGTH;
+                connection->current_frame = h2x_connection_acquire_frame(connection, connection->current_frame_size);
+                memcpy(connection->current_frame->raw_data, connection->current_frame_header, FRAME_HEADER_LENGTH);
                 connection->read_frame_state = H2X_RFS_ON_DATA;
-                break;
+                /* fall through - zero-length frames are complete as soon as the header is */
 
             case H2X_RFS_ON_DATA:
                 amount_to_read = min(data_length - read, connection->current_frame_size -
@@ -122,161 +296,905 @@ void h2x_connection_on_data_received(struct h2x_connection *connection, uint8_t
                 connection->current_frame_read += amount_to_read;
 
                 if (connection->current_frame_read == connection->current_frame_size) {
-                    h2x_connection_push_frame_to_stream(connection, connection->current_frame, H2X_STREAM_INBOUND);
+                    connection->current_frame->size = connection->current_frame_size;
                     connection->read_frame_state = H2X_RFS_NOT_ON_FRAME;
+                    h2x_connection_push_frame_to_stream(connection, connection->current_frame, H2X_STREAM_INBOUND);
+                    h2x_connection_release_current_frame(connection);
                 }
                 break;
         }
-    } while (read < data_length || connection->read_frame_state != H2X_RFS_NOT_ON_FRAME);
-}
+    }
+}
+
+static void h2x_connection_on_stream_opened(struct h2x_connection *connection) {
+    ++connection->active_stream_count;
+    atomic_fetch_add_explicit(&connection->owner->load.active_streams, 1, memory_order_relaxed);
+}
+
+static bool h2x_connection_is_peer_stream(struct h2x_connection *connection, uint32_t stream_id) {
+    return (stream_id & 1) != (connection->next_outgoing_stream_id & 1);
+}
+
+static void h2x_connection_set_stream_state(struct h2x_connection *connection, struct h2x_stream *stream, h2x_stream_state state) {
+    if (state == H2X_CLOSED && stream->state != H2X_CLOSED) {
+        if (h2x_connection_is_peer_stream(connection, stream->stream_identifier)) {
+            --connection->peer_stream_count;
+        } else {
+            --connection->local_stream_count;
+        }
+        --connection->active_stream_count;
+        atomic_fetch_sub_explicit(&connection->owner->load.active_streams, 1, memory_order_relaxed);
+
+        if (connection->goaway_received && connection->active_stream_count == 0) {
+            h2x_connection_begin_close(connection);
+        }
+    }
+
+    h2x_stream_set_state(stream, state);
+}
+
+static void h2x_connection_write_scheduled_data(struct h2x_connection *connection);
+static void h2x_connection_retire_stream_if_closed(struct h2x_connection *connection, struct h2x_stream *stream);
+static void h2x_connection_release_received_data(struct h2x_connection* connection, struct h2x_receive_window* window, uint32_t stream_id, uint32_t length);
+static void h2x_connection_handle_inbound_connection_window_update(struct h2x_connection* connection, struct h2x_frame* frame);
+static bool h2x_connection_is_receiving_header_block(struct h2x_connection *connection);
+static h2x_connection_error h2x_connection_set_stream_priority(struct h2x_connection* connection, struct h2x_stream* stream, uint8_t* fields);
+
+struct initial_window_change {
+    int64_t delta;
+    bool has_overflowed;
+};
+
+static void apply_initial_send_window_change(struct h2x_stream *stream, void *context) {
+    struct initial_window_change *change = context;
+    stream->send_window += change->delta;
+    if (stream->send_window > H2X_MAX_WINDOW_SIZE) {
+        change->has_overflowed = true;
+    }
+}
+
+static void apply_initial_receive_window_change(struct h2x_stream *stream, void *context) {
+    struct initial_window_change *change = context;
+    h2x_receive_window_adjust(&stream->receive_window, change->delta);
+}
+
+/*
+ * rfc7540 6.9.2: a new SETTINGS_INITIAL_WINDOW_SIZE shifts the send window of every open stream by the
+ * difference, which can leave some of them negative
+ */
+static bool h2x_connection_set_peer_initial_window_size(struct h2x_connection *connection, uint32_t value) {
+    struct initial_window_change change = { (int64_t) value - connection->peer_settings.initial_window_size, false };
+    h2x_stream_table_visit(&connection->streams, apply_initial_send_window_change, &change);
+
+    return !change.has_overflowed;
+}
+
+static void h2x_connection_on_local_settings_acked(struct h2x_connection *connection) {
+    if (connection->local_settings_acked) {
+        return;     // only one SETTINGS frame ever goes out
+    }
+
+    connection->local_settings_acked = true;
+    h2x_hpack_decoder_set_size_limit(&connection->hpack_decoder, connection->local_settings.header_table_size);
+
+    uint32_t initial_window_size = connection->local_settings.initial_window_size;
+    if (initial_window_size != connection->receive_initial_window_size) {
+        struct initial_window_change change = { (int64_t) initial_window_size - connection->receive_initial_window_size, false };
+        h2x_stream_table_visit(&connection->streams, apply_initial_receive_window_change, &change);
+        connection->receive_initial_window_size = initial_window_size;
+    }
+
+    H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d peer acknowledged our settings", connection->fd);
+}
+
+static void h2x_push_settings_ack(struct h2x_connection *connection) {
+    struct h2x_frame frame;
+    h2x_connection_begin_outbound_frame(connection, &frame, FRAME_HEADER_LENGTH);
+    h2x_frame_set_stream_identifier(&frame, 0);
+    h2x_frame_set_type(&frame, H2X_SETTINGS);
+    h2x_frame_set_flags(&frame, H2X_ACK);
+    h2x_frame_set_length(&frame, 0);
+
+    h2x_connection_push_frame_to_stream(connection, &frame, H2X_STREAM_OUTBOUND);
+}
+
+static void h2x_connection_handle_inbound_settings(struct h2x_connection *connection, struct h2x_frame *frame) {
+    uint8_t *payload = h2x_frame_get_payload(frame);
+    uint32_t length = h2x_frame_get_length(frame);
+
+    if (h2x_frame_get_flags(frame) & H2X_ACK) {
+        if (length != 0) {
+            H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received SETTINGS acknowledgement with a payload of length %u", connection->fd, length);
+            h2x_connection_begin_close(connection);
+            return;
+        }
+
+        h2x_connection_on_local_settings_acked(connection);
+        return;
+    }
+
+    if (length % SETTINGS_ENTRY_LENGTH != 0) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received malformed SETTINGS frame of length %u", connection->fd, length);
+        h2x_connection_begin_close(connection);
+        return;
+    }
+
+    for (uint32_t offset = 0; offset < length; offset += SETTINGS_ENTRY_LENGTH) {
+        uint32_t setting_id = h2x_get_integer_as_big_endian(payload + offset, 2);
+        uint32_t value = h2x_get_integer_as_big_endian(payload + offset + 2, 4);
+
+        if (h2x_settings_check(setting_id, value) != H2X_NO_ERROR) {
+            H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received invalid value %u for setting %u", connection->fd, value, setting_id);
+            h2x_connection_begin_close(connection);
+            return;
+        }
+
+        if (setting_id == H2X_SETTINGS_HEADER_TABLE_SIZE) {
+            H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d peer header table size is %u", connection->fd, value);
+            h2x_hpack_encoder_set_size_limit(&connection->hpack_encoder, value);
+        } else if (setting_id == H2X_SETTINGS_INITIAL_WINDOW_SIZE) {
+            H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d peer initial window size is %u", connection->fd, value);
+            if (!h2x_connection_set_peer_initial_window_size(connection, value)) {
+                H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received an initial window size of %u that overflows a stream window", connection->fd, value);
+                h2x_connection_begin_close(connection);
+                return;
+            }
+        }
+
+        h2x_settings_set(&connection->peer_settings, setting_id, value);
+    }
+
+    h2x_push_settings_ack(connection);
+    h2x_connection_write_scheduled_data(connection);
+}
+
+static void h2x_connection_handle_inbound_ping(struct h2x_connection *connection, struct h2x_frame *frame) {
+    if (h2x_frame_get_length(frame) != 8) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received PING frame of length %u", connection->fd, h2x_frame_get_length(frame));
+        h2x_connection_begin_close(connection);
+        return;
+    }
+
+    if (h2x_frame_get_flags(frame) & H2X_ACK) {
+        return;
+    }
+
+    struct h2x_frame response;
+    h2x_connection_begin_outbound_frame(connection, &response, FRAME_HEADER_LENGTH + 8);
+    h2x_frame_set_stream_identifier(&response, 0);
+    h2x_frame_set_type(&response, H2X_PING);
+    h2x_frame_set_flags(&response, H2X_ACK);
+    h2x_frame_set_length(&response, 8);
+    memcpy(h2x_frame_get_payload(&response), h2x_frame_get_payload(frame), 8);
+
+    h2x_connection_push_frame_to_stream(connection, &response, H2X_STREAM_OUTBOUND);
+}
+
+struct unprocessed_stream_search {
+    struct h2x_connection *connection;
+    uint32_t last_stream_id;
+    uint32_t *stream_ids;
+    uint32_t count;
+};
+
+static void find_unprocessed_stream(struct h2x_stream *stream, void *context) {
+    struct unprocessed_stream_search *search = context;
+    if (stream->stream_identifier > search->last_stream_id && stream->state != H2X_CLOSED &&
+        !h2x_connection_is_peer_stream(search->connection, stream->stream_identifier)) {
+        search->stream_ids[search->count++] = stream->stream_identifier;
+    }
+}
+
+/*
+ * rfc7540 6.8: the peer never processed our streams past last_stream_id, so they're refused, which
+ * tells whoever opened them that they're safe to retry elsewhere
+ */
+static void h2x_connection_refuse_unprocessed_streams(struct h2x_connection *connection, uint32_t last_stream_id) {
+    uint32_t stream_count = h2x_stream_table_get_count(&connection->streams);
+    if (stream_count == 0) {
+        return;
+    }
+
+    struct unprocessed_stream_search search = { connection, last_stream_id, malloc(stream_count * sizeof(uint32_t)), 0 };
+    h2x_stream_table_visit(&connection->streams, find_unprocessed_stream, &search);
+
+    for (uint32_t i = 0; i < search.count; ++i) {
+        struct h2x_stream *stream = h2x_stream_table_find(&connection->streams, search.stream_ids[i]);
+        h2x_connection_report_stream_error(connection, H2X_REFUSED_STREAM, stream->stream_identifier, stream->user_data);
+        h2x_connection_set_stream_state(connection, stream, H2X_CLOSED);
+        h2x_connection_retire_stream_if_closed(connection, stream);
+    }
+
+    free(search.stream_ids);
+}
+
+/*
+ * The peer won't take any more streams.  Those it has processed are left to finish, and the connection
+ * closes once the last of them does.
+ */
+static void h2x_connection_handle_inbound_goaway(struct h2x_connection *connection, struct h2x_frame *frame) {
+    if (h2x_frame_get_length(frame) < 8) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received GOAWAY frame of length %u", connection->fd, h2x_frame_get_length(frame));
+        h2x_connection_begin_close(connection);
+        return;
+    }
+
+    uint8_t *payload = h2x_frame_get_payload(frame);
+    uint32_t last_stream_id = h2x_get_integer_as_big_endian(payload, 4) & 0x7FFFFFFF;
+    uint32_t error_code = h2x_get_integer_as_big_endian(payload + 4, 4);
+    H2X_LOG(H2X_LOG_LEVEL_INFO, "Connection %d received GOAWAY with last stream %u and error %u", connection->fd, last_stream_id, error_code);
+
+    connection->goaway_received = true;
+    h2x_connection_refuse_unprocessed_streams(connection, last_stream_id);
+    if (connection->active_stream_count == 0) {
+        h2x_connection_begin_close(connection);
+    }
+}
+
+/*
+ * Frames on stream 0 apply to the connection as a whole rather than to any stream, so they're handled
+ * here without going anywhere near the stream table
+ */
+static void h2x_connection_process_inbound_connection_frame(struct h2x_connection *connection, struct h2x_frame *frame) {
+    h2x_frame_type frame_type = h2x_frame_get_type(frame);
+    if (h2x_connection_is_receiving_header_block(connection)) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received frame of type %s in the middle of a header block", connection->fd,
+                h2x_frame_type_to_string(frame_type));
+        h2x_connection_begin_close(connection);
+        return;
+    }
+
+    switch (frame_type) {
+        case H2X_SETTINGS:
+            h2x_connection_handle_inbound_settings(connection, frame);
+            break;
+        case H2X_PING:
+            h2x_connection_handle_inbound_ping(connection, frame);
+            break;
+        case H2X_GOAWAY:
+            h2x_connection_handle_inbound_goaway(connection, frame);
+            break;
+        case H2X_WINDOW_UPDATE:
+            h2x_connection_handle_inbound_connection_window_update(connection, frame);
+            break;
+        case H2X_DATA:
+        case H2X_HEADERS:
+        case H2X_PRIORITY:
+        case H2X_RST_STREAM:
+        case H2X_PUSH_PROMISE:
+        case H2X_CONTINUATION:
+            H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received frame of type %s on stream 0", connection->fd, h2x_frame_type_to_string(frame_type));
+            h2x_connection_begin_close(connection);
+            break;
+        default:
+            H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Ignoring inbound connection frame of type %u", (uint32_t) frame_type);
+            break;
+    }
+}
+
+static struct h2x_stream* h2x_connection_new_stream(struct h2x_connection *connection, uint32_t stream_id, void *user_data) {
+    struct h2x_stream *stream = h2x_stream_pool_acquire(&connection->owner->stream_pool);
+    stream->stream_identifier = stream_id;
+    stream->user_data = user_data;
+    stream->send_window = connection->peer_settings.initial_window_size;
+    h2x_receive_window_init(&stream->receive_window, connection->receive_initial_window_size);
+
+    if (h2x_connection_is_peer_stream(connection, stream_id)) {
+        ++connection->peer_stream_count;
+    } else {
+        ++connection->local_stream_count;
+    }
+
+    h2x_stream_table_add(&connection->streams, stream);
+    h2x_connection_on_stream_opened(connection);
+
+    return stream;
+}
+
+static bool h2x_connection_was_reset_recently(struct h2x_connection *connection, uint32_t stream_id) {
+    for (uint32_t i = 0; i < H2X_RECENTLY_RESET_STREAM_COUNT; ++i) {
+        if (connection->recently_reset_stream_ids[i] == stream_id) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * rfc7540 6.2: once a header block starts, nothing but its CONTINUATION frames may arrive until it ends.
+ * The block may belong to a stream that was retired, whose fragments sit in the stand-in stream.
+ */
+static bool h2x_connection_is_receiving_header_block(struct h2x_connection *connection) {
+    if (connection->last_seen_frame_type != H2X_HEADERS && connection->last_seen_frame_type != H2X_CONTINUATION &&
+        connection->last_seen_frame_type != H2X_PUSH_PROMISE) {
+        return false;
+    }
+
+    struct h2x_stream *stream = h2x_stream_table_find(&connection->streams, connection->last_seen_stream_id);
+    if (!stream && connection->retired_stream.stream_identifier == connection->last_seen_stream_id) {
+        stream = &connection->retired_stream;
+    }
+
+    return stream && stream->header_fragments.frame_count > 0;
+}
+
+/*
+ * A closed stream leaves the table once nothing is using it: not while one of its inbound frames is
+ * still being processed, and not while the peer is partway through a header block on it
+ */
+static void h2x_connection_retire_stream_if_closed(struct h2x_connection *connection, struct h2x_stream *stream) {
+    if (stream->state != H2X_CLOSED || stream == connection->inbound_stream || stream->header_fragments.frame_count > 0) {
+        return;
+    }
+
+    if (stream->is_scheduled) {
+        h2x_stream_scheduler_remove(&connection->scheduler, stream);
+        connection->pending_data_length -= stream->pending_length;
+    }
+
+    if (stream->reset_locally) {
+        connection->recently_reset_stream_ids[connection->next_recently_reset_slot] = stream->stream_identifier;
+        connection->next_recently_reset_slot = (connection->next_recently_reset_slot + 1) % H2X_RECENTLY_RESET_STREAM_COUNT;
+    }
+
+    h2x_stream_table_remove(&connection->streams, stream->stream_identifier);
+    h2x_stream_pool_release(&connection->owner->stream_pool, stream);
+}
+
+/*
+ * The peer may still send a header block on a stream we reset; it gets decoded into the stand-in
+ * stream and thrown away
+ */
+static void h2x_connection_discard_retired_header_frame(struct h2x_connection *connection, struct h2x_frame *frame) {
+    struct h2x_stream *stream = &connection->retired_stream;
+    uint32_t stream_id = h2x_frame_get_stream_identifier(frame);
+
+    if (h2x_frame_get_type(frame) == H2X_HEADERS) {
+        h2x_stream_clean(stream);
+        stream->stream_identifier = stream_id;
+    } else if (stream->stream_identifier != stream_id || stream->header_fragments.frame_count == 0 || connection->last_seen_stream_id != stream_id) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received a CONTINUATION out of sequence on retired stream %u", connection->fd, stream_id);
+        h2x_connection_begin_close(connection);
+        return;
+    }
+
+    h2x_connection_handle_inbound_header(connection, frame, stream);
+}
+
+/*
+ * rfc7540 5.1: PRIORITY, WINDOW_UPDATE and RST_STREAM can still arrive for a while after a stream closes.
+ * Anything else is ignored if we reset the stream (the peer may have sent it before seeing our
+ * RST_STREAM) and otherwise means the peer is using a stream it already closed, or reusing an id.
+ */
+static void h2x_connection_process_retired_stream_frame(struct h2x_connection *connection, struct h2x_frame *frame, h2x_stream_push_dir push_dir) {
+    h2x_frame_type frame_type = h2x_frame_get_type(frame);
+    uint32_t stream_id = h2x_frame_get_stream_identifier(frame);
+
+    if (push_dir == H2X_STREAM_OUTBOUND) {
+        // a reset is always allowed; anything else was produced before the stream closed and is dropped uncommitted
+        if (frame_type == H2X_RST_STREAM) {
+            h2x_connection_commit_outbound_frame(connection, frame);
+        } else {
+            H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Dropping outbound frame of type %s on retired stream %u", h2x_frame_type_to_string(frame_type), stream_id);
+        }
+        return;
+    }
+
+    if (frame_type != H2X_CONTINUATION && h2x_connection_is_receiving_header_block(connection)) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received frame of type %s on stream %u in the middle of a header block", connection->fd,
+                h2x_frame_type_to_string(frame_type), stream_id);
+        h2x_connection_begin_close(connection);
+        return;
+    }
+
+    switch (frame_type) {
+        case H2X_PRIORITY:
+        case H2X_WINDOW_UPDATE:
+        case H2X_RST_STREAM:
+            break;
+        default:
+            if (!h2x_connection_was_reset_recently(connection, stream_id)) {
+                H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received frame of type %s on closed stream %u", connection->fd,
+                        h2x_frame_type_to_string(frame_type), stream_id);
+                h2x_connection_begin_close(connection);
+            } else if (frame_type == H2X_HEADERS || frame_type == H2X_CONTINUATION) {
+                h2x_connection_discard_retired_header_frame(connection, frame);
+            }
+            break;
+    }
+
+    connection->last_seen_frame_type = frame_type;
+    connection->last_seen_stream_id = stream_id;
+}
+
+void h2x_connection_push_frame_to_stream(struct h2x_connection *connection, struct h2x_frame *frame, h2x_stream_push_dir push_dir) {
+    uint32_t stream_id = h2x_frame_get_stream_identifier(frame);
+    if (stream_id == 0) {
+        if (push_dir == H2X_STREAM_INBOUND) {
+            h2x_connection_process_inbound_connection_frame(connection, frame);
+        } else {
+            h2x_connection_commit_outbound_frame(connection, frame);
+        }
+        return;
+    }
+
+    h2x_frame_type frame_type = h2x_frame_get_type(frame);
+    if (push_dir == H2X_STREAM_INBOUND && (frame_type == H2X_SETTINGS || frame_type == H2X_PING || frame_type == H2X_GOAWAY)) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received frame of type %s on stream %u", connection->fd, h2x_frame_type_to_string(frame_type), stream_id);
+        h2x_connection_begin_close(connection);
+        return;
+    }
+
+    // rfc7540 6.9: every DATA frame counts against the connection window, even one for a stream that's gone
+    bool is_inbound_data = push_dir == H2X_STREAM_INBOUND && frame_type == H2X_DATA;
+    uint32_t data_length = h2x_frame_get_length(frame);
+    if (is_inbound_data && !h2x_receive_window_consume(&connection->receive_window, data_length)) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received more data than the connection flow control window allows", connection->fd);
+        h2x_connection_begin_close(connection);
+        return;
+    }
+
+    struct h2x_stream *stream = h2x_stream_table_find(&connection->streams, stream_id);
+
+    if (!stream && h2x_stream_table_has_passed(&connection->streams, stream_id)) {
+        h2x_connection_process_retired_stream_frame(connection, frame, push_dir);
+    } else if (!stream && frame_type == H2X_PRIORITY) {
+        // rfc7540 5.3.4 lets us forget about idle streams, which beats holding one open in the table
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d ignoring priority for idle stream %u", connection->fd, stream_id);
+    } else {
+        if (!stream) {
+            stream = h2x_connection_new_stream(connection, stream_id, connection->owner->options->mode == H2X_MODE_SERVER ? connection->user_data : NULL);
+
+            // rfc7540 5.1.2: the limit only holds once the peer has seen it
+            if (push_dir == H2X_STREAM_INBOUND && h2x_connection_is_peer_stream(connection, stream_id) && connection->local_settings_acked &&
+                connection->peer_stream_count > connection->local_settings.max_concurrent_streams) {
+                stream->is_refused = true;
+            }
+        }
+
+        if (push_dir == H2X_STREAM_INBOUND) {
+            h2x_connection_process_inbound_frame(connection, frame);
+        } else {
+            h2x_connection_process_outbound_frame(connection, frame);
+        }
+    }
+
+    // inbound data is always fully processed by the time it gets back here, so its credit can go straight back
+    if (is_inbound_data && connection->state != H2X_CS_CLOSING) {
+        h2x_connection_release_received_data(connection, &connection->receive_window, 0, data_length);
+    }
+}
+
+uint32_t h2x_connection_create_outbound_stream(struct h2x_connection *connection, void* user_data) {
+    // a request can be started before the connection's first event makes it visible
+    h2x_connection_queue_local_settings(connection);
+
+    uint32_t stream_id = connection->next_outgoing_stream_id;
+    connection->next_outgoing_stream_id += 2;
+
+    h2x_connection_new_stream(connection, stream_id, user_data);
+
+    return stream_id;
+}
+
+/*
+ * Header blocks go out as one HEADERS frame followed by as many CONTINUATION frames as it takes.  These
+ * stay at the default frame size whatever the peer allows, since each one reserves its full size in
+ * the outbound ring before anything is encoded and header blocks rarely come close to filling one.
+ */
+static uint8_t* h2x_connection_begin_header_frame(struct h2x_connection* connection, struct h2x_frame* frame, uint32_t stream_id, h2x_frame_type frame_type)
+{
+    h2x_connection_begin_outbound_frame(connection, frame, MAX_RECV_FRAME_SIZE);
+    h2x_frame_set_flags(frame, 0);
+    h2x_frame_set_type(frame, frame_type);
+    h2x_frame_set_stream_identifier(frame, stream_id);
+    h2x_frame_set_length(frame, MAX_RECV_FRAME_SIZE - FRAME_HEADER_LENGTH);
+
+    return h2x_frame_get_payload(frame);
+}
+
+static void h2x_connection_finish_header_frame(struct h2x_connection* connection, struct h2x_frame* frame, uint32_t payload_size, bool end_headers)
+{
+    h2x_frame_set_length(frame, payload_size);
+    h2x_frame_set_flags(frame, end_headers ? H2X_END_HEADERS : 0);
+    frame->size = payload_size + FRAME_HEADER_LENGTH;
+
+    h2x_connection_push_frame_to_stream(connection, frame, H2X_STREAM_OUTBOUND);
+}
+
+/*
+ * Whether a HEADERS frame on the stream would be committed by h2x_connection_process_outbound_frame.
+ * Encoding a header block updates the HPACK encoder's dynamic table, so a block the state machine
+ * would drop must never be encoded in the first place or the peer's decoder falls out of step.
+ */
+static bool h2x_connection_can_send_headers(struct h2x_connection* connection, uint32_t stream_id)
+{
+    struct h2x_stream* stream = h2x_stream_table_find(&connection->streams, stream_id);
+    if(!stream)
+    {
+        // an id we've not used yet opens a new stream; one that's been and gone is retired
+        return !h2x_stream_table_has_passed(&connection->streams, stream_id);
+    }
+
+    switch(stream->state)
+    {
+        case H2X_IDLE:
+        case H2X_RESERVED_LOCAL:
+        case H2X_OPEN:
+        case H2X_HALF_CLOSED_REMOTE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Headers are HPACK-encoded straight into the outbound frame.  One that might not fit in what's left
+ * of the frame is encoded off to the side first and then split across frames, since an encoded header
+ * may straddle a frame boundary.
+ */
+void h2x_push_headers(struct h2x_connection* connection, uint32_t stream_id, struct h2x_header_block* headers)
+{
+    if(!h2x_connection_can_send_headers(connection, stream_id))
+    {
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d not sending headers on stream %u which can't take them", connection->fd, stream_id);
+        return;
+    }
+
+    const uint32_t payload_capacity = MAX_RECV_FRAME_SIZE - FRAME_HEADER_LENGTH;
+    struct h2x_hpack_encoder* encoder = &connection->hpack_encoder;
+
+    struct h2x_frame frame;
+    uint8_t* payload = h2x_connection_begin_header_frame(connection, &frame, stream_id, H2X_HEADERS);
+    uint32_t headers_written_size = h2x_hpack_encode_block_start(encoder, payload);
+
+    uint8_t* spill_buffer = NULL;
+    uint64_t spill_capacity = 0;
+
+    uint32_t header_count = h2x_header_block_get_count(headers);
+    for(uint32_t i = 0; i < header_count; ++i)
+    {
+        uint32_t name_len = 0;
+        uint32_t value_len = 0;
+        char* name = h2x_header_block_get_name(headers, i, &name_len);
+        char* value = h2x_header_block_get_value(headers, i, &value_len);
+
+        uint64_t max_encoded_size = H2X_HPACK_MAX_ENCODED_SIZE(name_len, value_len);
+        if(max_encoded_size <= payload_capacity - headers_written_size)
+        {
+            headers_written_size += h2x_hpack_encode_header(encoder, payload + headers_written_size, name, name_len, value, value_len);
+            continue;
+        }
+
+        if(max_encoded_size > spill_capacity)
+        {
+            free(spill_buffer);
+            spill_buffer = malloc(max_encoded_size);
+            spill_capacity = max_encoded_size;
+        }
+
+        uint32_t encoded_size = h2x_hpack_encode_header(encoder, spill_buffer, name, name_len, value, value_len);
+        uint32_t copied_size = 0;
+        while(copied_size < encoded_size)
+        {
+            if(headers_written_size == payload_capacity)
+            {
+                h2x_connection_finish_header_frame(connection, &frame, headers_written_size, false);
+                payload = h2x_connection_begin_header_frame(connection, &frame, stream_id, H2X_CONTINUATION);
+                headers_written_size = 0;
+            }
+
+            uint32_t to_copy = min(encoded_size - copied_size, payload_capacity - headers_written_size);
+            memcpy(payload + headers_written_size, spill_buffer + copied_size, to_copy);
+            copied_size += to_copy;
+            headers_written_size += to_copy;
+        }
+    }
+
+    free(spill_buffer);
+
+    h2x_connection_finish_header_frame(connection, &frame, headers_written_size, true);
+}
+
+/*
+ * Sends as much of the data as the stream and connection send windows allow, ending the stream with
+ * the last of it if end_stream is set and all of it fits.  Returns how much went out.
+ */
+static uint32_t h2x_connection_write_data_frames(struct h2x_connection* connection, struct h2x_stream* stream, uint8_t* data, uint32_t size, bool end_stream)
+{
+    uint32_t stream_id = stream->stream_identifier;
+    uint32_t data_written_size = 0;
+
+    do {
+        int64_t window = min(stream->send_window, connection->send_window);
+        uint32_t to_write = min(size - data_written_size, connection->peer_settings.max_frame_size);
+        if (to_write > 0 && window < to_write) {
+            to_write = window > 0 ? (uint32_t) window : 0;
+            if (to_write == 0) {
+                break;
+            }
+        }
 
-void h2x_connection_push_frame_to_stream(struct h2x_connection *connection, struct h2x_frame *frame, h2x_stream_push_dir push_dir) {
-    struct h2x_stream *stream = h2x_hash_table_find(&connection->streams, h2x_frame_get_stream_identifier(frame));
+        struct h2x_frame frame;
+        h2x_connection_begin_outbound_frame(connection, &frame, to_write + FRAME_HEADER_LENGTH);
+        h2x_frame_set_stream_identifier(&frame, stream_id);
+        h2x_frame_set_type(&frame, H2X_DATA);
+        h2x_frame_set_length(&frame, to_write);
+        h2x_frame_set_flags(&frame, 0);
 
-    if (!stream) {
-        stream = (struct h2x_stream *) malloc(sizeof(struct h2x_stream));
-        h2x_stream_init(stream);
-        stream->stream_identifier = h2x_frame_get_stream_identifier(frame);
+        memcpy(frame.raw_data + FRAME_HEADER_LENGTH, data + data_written_size, to_write);
+        data_written_size += to_write;
+        stream->send_window -= to_write;
+        connection->send_window -= to_write;
 
-        if(connection->owner->options->mode == H2X_MODE_SERVER) {
-            stream->user_data = connection->user_data;
+        if(data_written_size == size && end_stream)
+        {
+            // the stream may retire as this goes out, so it's the last thing touched
+            h2x_frame_set_flags(&frame, H2X_END_STREAM);
         }
 
-        h2x_hash_table_add(&connection->streams, stream);
-    }
+        h2x_connection_push_frame_to_stream(connection, &frame, H2X_STREAM_OUTBOUND);
+    } while(data_written_size < size);
 
-    if (push_dir == H2X_STREAM_INBOUND) {
-        h2x_connection_process_inbound_frame(connection, frame);
-    } else {
-        h2x_connection_process_outbound_frame(connection, frame);
-    }
+    return data_written_size;
 }
 
-uint32_t h2x_connection_create_outbound_stream(struct h2x_connection *connection, void* user_data) {
-    uint32_t stream_id = connection->next_outgoing_stream_id;
-    connection->next_outgoing_stream_id += 2;
+/*
+ * How much more DATA the outbound ring may take.  Feeding bodies in as the socket drains, rather than
+ * all at once, keeps the ring near the size of the socket buffer and lets other streams' frames and
+ * control frames in between.  There's always room for one full-size frame.
+ */
+static uint32_t h2x_connection_get_outbound_data_room(struct h2x_connection *connection)
+{
+    uint32_t budget = max(connection->outbound_data_budget, connection->peer_settings.max_frame_size + FRAME_HEADER_LENGTH);
+    uint32_t used = h2x_ring_buffer_get_used(&connection->outbound_buffer);
 
-    struct h2x_stream *stream = (struct h2x_stream *) malloc(sizeof(struct h2x_stream));
-    h2x_stream_init(stream);
-    stream->stream_identifier = stream_id;
-    stream->user_data = user_data;
-    h2x_hash_table_add(&connection->streams, stream);
+    return used < budget ? budget - used : 0;
+}
 
-    return stream_id;
+/*
+ * Data goes straight out when nothing else is waiting to send.  Otherwise, or for whatever the send
+ * windows have no room for, it's held on the stream until the scheduler gives the stream a turn, and
+ * anything pushed after it queues behind it so the data goes out in order.
+ */
+void h2x_push_data_segment(struct h2x_connection* connection, uint32_t stream_id, uint8_t* data, uint32_t size, bool lastFrame)
+{
+    struct h2x_stream* stream = h2x_stream_table_find(&connection->streams, stream_id);
+    if(!stream)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Dropping %u bytes of data for stream %u which isn't open", size, stream_id);
+        return;
+    }
+
+    bool is_queued = connection->scheduler.count > 0;
+    uint32_t data_written_size = 0;
+    if(!is_queued)
+    {
+        uint32_t direct_size = min(size, h2x_connection_get_outbound_data_room(connection));
+        if(direct_size > 0 || size == 0)
+        {
+            data_written_size = h2x_connection_write_data_frames(connection, stream, data, direct_size, lastFrame && direct_size == size);
+        }
+    }
+
+    if(is_queued || data_written_size < size)
+    {
+        h2x_stream_append_pending_data(stream, data + data_written_size, size - data_written_size);
+        stream->pending_end_stream = lastFrame;
+        connection->pending_data_length += size - data_written_size;
+        if(!stream->is_scheduled)
+        {
+            h2x_stream_scheduler_add(&connection->scheduler, stream);
+            h2x_connection_write_scheduled_data(connection);
+        }
+    }
 }
 
-void h2x_push_headers(struct h2x_connection* connection, uint32_t stream_id, struct h2x_header_list* header_list)
+/*
+ * Holds between the two watermarks, so a producer that's been stopped doesn't restart on every frame
+ * that goes out
+ */
+static bool h2x_update_write_paused(bool *is_paused, uint64_t queued_length, uint32_t low_watermark, uint32_t high_watermark)
 {
-    struct h2x_frame* frame = (struct h2x_frame*)malloc(sizeof(struct h2x_frame));
-    h2x_frame_init(frame);
-    frame->raw_data = (uint8_t *) malloc(MAX_RECV_FRAME_SIZE);
-    frame->size = MAX_RECV_FRAME_SIZE;
-    h2x_frame_set_type(frame, H2X_HEADERS);
-    h2x_frame_set_stream_identifier(frame, stream_id);
-    h2x_frame_set_length(frame, MAX_RECV_FRAME_SIZE - FRAME_HEADER_LENGTH);
-    uint32_t headers_written_size = 0;
-    uint32_t size_of_eq = 1;
-    uint32_t size_of_end = 2;
+    *is_paused = queued_length >= (*is_paused ? low_watermark : high_watermark);
 
-    struct h2x_header* cur = NULL;
+    return *is_paused;
+}
 
-    while((cur = h2x_header_next(header_list)))
+bool h2x_connection_wants_stream_data(struct h2x_connection* connection, uint32_t stream_id)
+{
+    struct h2x_stream* stream = h2x_stream_table_find(&connection->streams, stream_id);
+    if(!stream)
     {
-        char* name = cur->name;
-        char* value = cur->value;
+        // whatever is pushed gets dropped, but the producer still has to be run to the end
+        return true;
+    }
 
-        size_t name_len = strlen(name);
-        size_t value_len = strlen(value);
+    struct h2x_options* options = connection->owner->options;
+    uint64_t connection_queued_length = connection->pending_data_length + h2x_ring_buffer_get_used(&connection->outbound_buffer);
+    bool is_connection_paused = h2x_update_write_paused(&connection->is_write_paused, connection_queued_length,
+                                                        options->connection_write_low_watermark, options->connection_write_high_watermark);
+    bool is_stream_paused = h2x_update_write_paused(&stream->is_write_paused, stream->pending_length,
+                                                    options->stream_write_low_watermark, options->stream_write_high_watermark);
 
-        if(name_len + value_len + size_of_eq + size_of_end + headers_written_size > h2x_frame_get_length(frame) )
-        {
-            h2x_frame_set_length(frame, headers_written_size);
-            frame->size = headers_written_size + FRAME_HEADER_LENGTH;
-            h2x_connection_push_frame_to_stream(connection, frame, H2X_STREAM_OUTBOUND);
-            headers_written_size = 0;
-            frame = (struct h2x_frame*)malloc(sizeof(struct h2x_frame));
-            h2x_frame_init(frame);
-            frame->raw_data = (uint8_t *) malloc(MAX_RECV_FRAME_SIZE);
-            frame->size = MAX_RECV_FRAME_SIZE;
-            h2x_frame_set_type(frame, H2X_CONTINUATION);
-            h2x_frame_set_stream_identifier(frame, stream_id);
-            h2x_frame_set_length(frame, MAX_RECV_FRAME_SIZE - FRAME_HEADER_LENGTH);
-        }
-
-        memcpy(frame->raw_data + FRAME_HEADER_LENGTH + headers_written_size, name, name_len);
-        headers_written_size += name_len;
-        memcpy(frame->raw_data + FRAME_HEADER_LENGTH + headers_written_size, "=", size_of_eq);
-        headers_written_size += size_of_eq;
-        memcpy(frame->raw_data + FRAME_HEADER_LENGTH + headers_written_size, value, value_len);
-        headers_written_size += value_len;
-        memcpy(frame->raw_data + FRAME_HEADER_LENGTH + headers_written_size, "\r\n", size_of_end);
-        headers_written_size += size_of_end;
-    }
-
-    h2x_frame_set_length(frame, headers_written_size);
-    h2x_frame_set_flags(frame, H2X_END_HEADERS);
-    frame->size = headers_written_size + FRAME_HEADER_LENGTH;
+    return !is_connection_paused && !is_stream_paused && stream->send_window > 0 && connection->send_window > 0;
+}
 
-    h2x_connection_push_frame_to_stream(connection, frame, H2X_STREAM_OUTBOUND);
+/*
+ * rfc7540 5.3.1: a stream should only get resources that none of the streams it depends on can use.
+ * The walk is bounded in case the peer has built something pathological.
+ */
+static bool h2x_connection_is_stream_sendable(struct h2x_connection *connection, struct h2x_stream *stream)
+{
+    // an empty frame that ends the stream isn't flow controlled
+    if (stream->pending_length > 0 && stream->send_window <= 0) {
+        return false;
+    }
+
+    uint32_t dependency = stream->dependency;
+    for (uint32_t depth = 0; dependency != 0 && depth < H2X_MAX_PRIORITY_DEPTH; ++depth) {
+        struct h2x_stream *parent = h2x_stream_table_find(&connection->streams, dependency);
+        if (!parent) {
+            break;
+        }
+
+        if (parent->is_scheduled && parent->send_window > 0) {
+            return false;
+        }
+
+        dependency = parent->dependency;
+    }
+
+    return true;
 }
 
-void h2x_push_data_segment(struct h2x_connection* connection, uint32_t stream_id, uint8_t* data, uint32_t size, bool lastFrame)
+/*
+ * Gives the scheduled streams their turns until the connection window or the outbound ring's room for
+ * DATA runs out, or none of them can send.  A stream whose own window cuts its turn short gives up the
+ * rest of it.
+ */
+static void h2x_connection_write_scheduled_data(struct h2x_connection *connection)
 {
-    uint32_t data_written_size = 0;
+    struct h2x_stream_scheduler *scheduler = &connection->scheduler;
+    uint32_t skipped_count = 0;
+    uint32_t room = 0;
+    while (scheduler->count > skipped_count && connection->send_window > 0 && connection->state != H2X_CS_CLOSING &&
+           (room = h2x_connection_get_outbound_data_room(connection)) > 0) {
+        struct h2x_stream *stream = scheduler->current;
+        if (!h2x_connection_is_stream_sendable(connection, stream)) {
+            h2x_stream_scheduler_advance(scheduler);
+            ++skipped_count;
+            continue;
+        }
 
-    do {
-        struct h2x_frame* frame = (struct h2x_frame*)malloc(sizeof(struct h2x_frame));
-        h2x_frame_init(frame);
-        uint32_t to_write = min(size, (uint32_t)(MAX_RECV_FRAME_SIZE - FRAME_HEADER_LENGTH));
-        uint32_t total_frame_size = to_write + FRAME_HEADER_LENGTH;
-        frame->raw_data = (uint8_t *) malloc(total_frame_size);
-        frame->size = total_frame_size;
-        h2x_frame_set_stream_identifier(frame, stream_id);
-        h2x_frame_set_type(frame, H2X_DATA);
-        h2x_frame_set_length(frame, to_write);
-        h2x_frame_set_flags(frame, 0);
-
-        memcpy(frame->raw_data + FRAME_HEADER_LENGTH, data, to_write);
-        data_written_size += to_write;
+        skipped_count = 0;
+
+        int64_t window = min(min(stream->send_window, connection->send_window), (int64_t) room);
+        uint32_t turn_size = (uint32_t) min(window, (int64_t) h2x_stream_scheduler_get_turn(scheduler));
+        if (turn_size < stream->pending_length) {
+            uint32_t data_written_size = h2x_connection_write_data_frames(connection, stream, stream->pending_data + stream->pending_offset,
+                                                                          turn_size, false);
+            h2x_stream_consume_pending_data(stream, data_written_size);
+            connection->pending_data_length -= data_written_size;
+            if (stream->send_window <= 0) {
+                h2x_stream_scheduler_advance(scheduler);
+            } else {
+                h2x_stream_scheduler_use_turn(scheduler, data_written_size);
+            }
+            continue;
+        }
 
-        if(data_written_size == size && lastFrame)
-        {
-            h2x_frame_set_flags(frame, H2X_END_STREAM);
+        /*
+         * Everything left fits, and the stream may retire as its last frame goes out, so it comes off
+         * the scheduler and gives up its buffer first
+         */
+        uint32_t stream_id = stream->stream_identifier;
+        uint8_t *pending_data = stream->pending_data;
+        uint8_t *data = pending_data + stream->pending_offset;
+        uint32_t size = stream->pending_length;
+        bool end_stream = stream->pending_end_stream;
+        bool has_pending_reset = stream->has_pending_reset;
+
+        h2x_stream_scheduler_remove(scheduler, stream);
+        stream->pending_data = NULL;
+        h2x_stream_discard_pending_data(stream);
+        connection->pending_data_length -= size;
+
+        h2x_connection_write_data_frames(connection, stream, data, size, end_stream);
+        free(pending_data);
+
+        if (has_pending_reset) {
+            h2x_push_rst_stream(connection, stream_id, H2X_NO_ERROR);
         }
+    }
+}
 
-        h2x_connection_push_frame_to_stream(connection, frame, H2X_STREAM_OUTBOUND);
-    } while(data_written_size < size);
+static void h2x_push_window_update(struct h2x_connection* connection, uint32_t stream_id, uint32_t increment)
+{
+    uint32_t to_write = sizeof(uint32_t);
+    struct h2x_frame frame;
+    h2x_connection_begin_outbound_frame(connection, &frame, to_write + FRAME_HEADER_LENGTH);
+    h2x_frame_set_stream_identifier(&frame, stream_id);
+    h2x_frame_set_type(&frame, H2X_WINDOW_UPDATE);
+    h2x_frame_set_flags(&frame, 0);
+    h2x_frame_set_length(&frame, to_write);
+    h2x_set_integer_as_big_endian(h2x_frame_get_payload(&frame), increment, sizeof(uint32_t));
+
+    h2x_connection_push_frame_to_stream(connection, &frame, H2X_STREAM_OUTBOUND);
 }
 
-void h2x_push_rst_stream(struct h2x_connection* connection, uint32_t stream_id, h2x_connection_error error) {
+/*
+ * The kernel's smoothed round trip estimate for the connection, in microseconds; 0 if there isn't one
+ */
+static uint32_t h2x_connection_get_rtt_us(struct h2x_connection* connection)
+{
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    if (getsockopt(connection->fd, IPPROTO_TCP, TCP_INFO, &info, &length) != 0) {
+        return 0;
+    }
 
-    struct h2x_frame* frame = (struct h2x_frame*)malloc(sizeof(struct h2x_frame));
-    h2x_frame_init(frame);
-    uint32_t to_write = FRAME_HEADER_LENGTH + sizeof(uint32_t);
-    uint32_t total_frame_size = to_write + FRAME_HEADER_LENGTH;
-    frame->raw_data = (uint8_t *) malloc(total_frame_size);
-    frame->size = total_frame_size;
-    h2x_frame_set_stream_identifier(frame, stream_id);
-    h2x_frame_set_type(frame, H2X_RST_STREAM);
-    h2x_frame_set_length(frame, to_write);
-    uint32_t error_code = error;
-    h2x_set_integer_as_big_endian(h2x_frame_get_payload(frame), error_code, sizeof(uint32_t));
+    return info.tcpi_rtt;
+}
 
-    h2x_connection_push_frame_to_stream(connection, frame, H2X_STREAM_OUTBOUND);
+static void h2x_connection_release_received_data(struct h2x_connection* connection, struct h2x_receive_window* window, uint32_t stream_id, uint32_t length)
+{
+    if (!h2x_receive_window_release(window, length)) {
+        return;
+    }
+
+    uint32_t increment = h2x_receive_window_take_update(window, connection->owner->options->max_receive_window,
+                                                        h2x_connection_get_rtt_us(connection), h2x_load_metrics_now_ns());
+    if (increment > 0) {
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d returning %u bytes of credit on stream %u, window target %u", connection->fd, increment,
+                stream_id, window->target_size);
+        h2x_push_window_update(connection, stream_id, increment);
+    }
 }
 
+void h2x_push_rst_stream(struct h2x_connection* connection, uint32_t stream_id, h2x_connection_error error) {
+    struct h2x_stream* stream = h2x_stream_table_find(&connection->streams, stream_id);
+    if (stream && stream->is_scheduled) {
+        // a graceful reset waits for the data ahead of it; anything else abandons that data
+        if (error == H2X_NO_ERROR) {
+            stream->has_pending_reset = true;
+            return;
+        }
+
+        h2x_stream_scheduler_remove(&connection->scheduler, stream);
+        connection->pending_data_length -= stream->pending_length;
+        h2x_stream_discard_pending_data(stream);
+    }
+
+    uint32_t to_write = sizeof(uint32_t);
+    struct h2x_frame frame;
+    h2x_connection_begin_outbound_frame(connection, &frame, to_write + FRAME_HEADER_LENGTH);
+    h2x_frame_set_stream_identifier(&frame, stream_id);
+    h2x_frame_set_type(&frame, H2X_RST_STREAM);
+    h2x_frame_set_flags(&frame, 0);
+    h2x_frame_set_length(&frame, to_write);
+    uint32_t error_code = error;
+    h2x_set_integer_as_big_endian(h2x_frame_get_payload(&frame), error_code, sizeof(uint32_t));
 
-struct h2x_frame *h2x_connection_pop_frame(struct h2x_connection *connection) {
-    return h2x_frame_list_pop(&connection->outgoing_frames);
+    h2x_connection_push_frame_to_stream(connection, &frame, H2X_STREAM_OUTBOUND);
 }
 
 void h2x_connection_set_stream_headers_receieved_callback(struct h2x_connection *connection,
                                                           void(*callback)(struct h2x_connection *,
-                                                                          struct h2x_header_list *headers, uint32_t,
+                                                                          struct h2x_header_block *headers, uint32_t,
                                                                           void *)) {
     connection->on_stream_headers_received = callback;
 }
 
+void h2x_connection_set_stream_header_views_received_callback(struct h2x_connection *connection,
+                                                              void(*callback)(struct h2x_connection *,
+                                                                              struct h2x_header_view *headers,
+                                                                              uint32_t header_count, uint32_t,
+                                                                              void *)) {
+    connection->on_stream_header_views_received = callback;
+}
+
 void h2x_connection_set_stream_body_receieved_callback(struct h2x_connection *connection,
                                                        void(*callback)(struct h2x_connection *, uint8_t *data,
                                                                        uint32_t length, uint32_t, bool finalFrame,
@@ -309,6 +1227,14 @@ void h2x_connection_add_to_intrusive_chain(struct h2x_connection *connection, h2
         return;
     }
 
+    /*
+     * Requests and bodies are pushed after the thread's read/write pass, so a connection that errored
+     * during that pass would otherwise rejoin the write chain just before it's released
+     */
+    if (chain != H2X_ICT_PENDING_CLOSE && h2x_connection_is_in_intrusive_chain(connection, H2X_ICT_PENDING_CLOSE)) {
+        return;
+    }
+
     H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Adding connection %d to chain %s", connection->fd, h2x_intrusive_chain_type_to_string(chain));
 
     struct h2x_thread* thread = connection->owner;
@@ -324,7 +1250,7 @@ void h2x_connection_add_to_intrusive_chain(struct h2x_connection *connection, h2
     }
 
     connection->intrusive_chains[chain] = thread->intrusive_chains[chain];
-    thread->intrusive_chains[chain] = connection->intrusive_chains[chain];
+    thread->intrusive_chains[chain] = connection;
 }
 
 void h2x_connection_remove_from_intrusive_chain(struct h2x_connection** connection_ref, h2x_intrusive_chain_type chain)
@@ -346,18 +1272,24 @@ void h2x_connection_on_new_outbound_data(struct h2x_connection* connection)
     h2x_connection_add_to_intrusive_chain(connection, H2X_ICT_PENDING_WRITE);
 }
 
-void h2x_connection_pump_outbound_frame(struct h2x_connection *connection) {
-    if (connection->current_outbound_frame &&
-        connection->current_outbound_frame_read_position >= connection->current_outbound_frame->size) {
-        h2x_frame_cleanup(connection->current_outbound_frame);
-        free(connection->current_outbound_frame);
+bool h2x_connection_has_outbound_data(struct h2x_connection* connection) {
+    return !h2x_ring_buffer_is_empty(&connection->outbound_buffer);
+}
+
+/*
+ * Fills iovecs (at least H2X_RING_BUFFER_MAX_SEGMENTS of them) with everything queued in the outbound
+ * ring, so that a single writev flushes every pending frame.
+ */
+uint32_t h2x_connection_gather_outbound_data(struct h2x_connection* connection, struct iovec* iovecs, uint32_t* total_size) {
+    return h2x_ring_buffer_get_read_segments(&connection->outbound_buffer, iovecs, total_size);
+}
 
-        connection->current_outbound_frame = NULL;
-    }
+void h2x_connection_on_outbound_data_written(struct h2x_connection* connection, uint32_t bytes_written) {
+    h2x_ring_buffer_consume(&connection->outbound_buffer, bytes_written);
 
-    if (!connection->current_outbound_frame) {
-        connection->current_outbound_frame = h2x_connection_pop_frame(connection);
-        connection->current_outbound_frame_read_position = 0;
+    // the writer has made room, so the scheduler can top the ring back up
+    if (connection->scheduler.count > 0) {
+        h2x_connection_write_scheduled_data(connection);
     }
 }
 
@@ -368,16 +1300,16 @@ void h2x_connection_process_inbound_frame(struct h2x_connection* connection, str
     uint8_t frame_flags = h2x_frame_get_flags(frame);
     h2x_connection_error error = H2X_NO_ERROR;
 
-    struct h2x_stream* stream = h2x_hash_table_find(&connection->streams, stream_id);
+    struct h2x_stream* stream = h2x_stream_table_find(&connection->streams, stream_id);
     assert(stream);
+    connection->inbound_stream = stream;
 
     h2x_stream_state stream_state = stream->state;
     h2x_stream_state next_state = stream_state;
 
     //continuation doesn't really fit into the state model. Handle it first
     //then use a normal state pattern after that.
-    if (connection->last_seen_frame_type == H2X_CONTINUATION && frame_type != H2X_CONTINUATION &&
-        !stream->end_header_sent) {
+    if (frame_type != H2X_CONTINUATION && h2x_connection_is_receiving_header_block(connection)) {
         error = H2X_PROTOCOL_ERROR;
     } else if (frame_type == H2X_CONTINUATION) {
         if (stream_id != connection->last_seen_stream_id || stream->end_header_sent ||
@@ -405,7 +1337,7 @@ void h2x_connection_process_inbound_frame(struct h2x_connection* connection, str
                         break;
                     case H2X_HEADERS:
                         h2x_process_frame = h2x_connection_handle_inbound_header;
-                        next_state = H2X_OPEN;
+                        next_state = (frame_flags & H2X_END_STREAM) ? H2X_HALF_CLOSED_REMOTE : H2X_OPEN;
                         break;
                     default:
                         error = H2X_PROTOCOL_ERROR;
@@ -495,6 +1427,10 @@ void h2x_connection_process_inbound_frame(struct h2x_connection* connection, str
                         error = H2X_PROTOCOL_ERROR;
                         break;
                 }
+
+                if (frame_flags & H2X_END_STREAM && error == H2X_NO_ERROR) {
+                    next_state = H2X_CLOSED;
+                }
                 break;
             case H2X_CLOSED:
                 if (frame_type == H2X_PRIORITY) {
@@ -511,7 +1447,7 @@ void h2x_connection_process_inbound_frame(struct h2x_connection* connection, str
     }
 
     if(!error) {
-        h2x_stream_set_state(stream, next_state);
+        h2x_connection_set_stream_state(connection, stream, next_state);
     }
 
     if(h2x_process_frame && !error) {
@@ -519,13 +1455,20 @@ void h2x_connection_process_inbound_frame(struct h2x_connection* connection, str
     }
 
     if(error) {
-        h2x_stream_set_state(stream, H2X_CLOSED);
+        h2x_connection_set_stream_state(connection, stream, H2X_CLOSED);
         h2x_connection_handle_inbound_stream_error(connection, frame, stream, error);
         h2x_push_rst_stream(connection, stream_id, error);
     }
 
-    h2x_frame_cleanup(frame);
-    free(frame);
+    if(stream->is_refused && stream->state != H2X_CLOSED) {
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d refusing stream %u past the limit of %u", connection->fd, stream_id,
+                connection->local_settings.max_concurrent_streams);
+        h2x_connection_set_stream_state(connection, stream, H2X_CLOSED);
+        h2x_push_rst_stream(connection, stream_id, H2X_REFUSED_STREAM);
+    }
+
+    connection->inbound_stream = NULL;
+    h2x_connection_retire_stream_if_closed(connection, stream);
 }
 
 void h2x_connection_process_outbound_frame(struct h2x_connection *connection, struct h2x_frame *frame) {
@@ -535,7 +1478,7 @@ void h2x_connection_process_outbound_frame(struct h2x_connection *connection, st
     uint8_t frame_flags = h2x_frame_get_flags(frame);
     //h2x_connection_error error = H2X_NO_ERROR;
 
-    struct h2x_stream* stream = h2x_hash_table_find(&connection->streams, stream_id);
+    struct h2x_stream* stream = h2x_stream_table_find(&connection->streams, stream_id);
     assert(stream);
 
     h2x_stream_state stream_state = stream->state;
@@ -586,7 +1529,9 @@ void h2x_connection_process_outbound_frame(struct h2x_connection *connection, st
             }
             break;
         case H2X_OPEN:
-            if(frame_flags & H2X_END_STREAM) {
+            if(frame_type == H2X_RST_STREAM) {
+                next_state = H2X_CLOSED;
+            } else if(frame_flags & H2X_END_STREAM) {
                 next_state = H2X_HALF_CLOSED_LOCAL;
             }
             break;
@@ -605,18 +1550,17 @@ void h2x_connection_process_outbound_frame(struct h2x_connection *connection, st
             }
             break;
         case H2X_HALF_CLOSED_REMOTE:
-            switch(frame_type) {
-                case H2X_RST_STREAM:
-                    next_state = H2X_CLOSED;
-                    break;
-                default:
-                    break;
+            if(frame_type == H2X_RST_STREAM || frame_flags & H2X_END_STREAM) {
+                next_state = H2X_CLOSED;
             }
             break;
         case H2X_CLOSED:
             switch(frame_type) {
                 case H2X_PRIORITY:
                     break;
+                case H2X_RST_STREAM:
+                    // the stream error path closes the stream before queueing its reset
+                    break;
                 default:
                     valid_state = false;
                     break;
@@ -628,122 +1572,471 @@ void h2x_connection_process_outbound_frame(struct h2x_connection *connection, st
     }
 
     if(valid_state) {
-        h2x_stream_set_state(stream, next_state);
-        h2x_frame_list_append(&connection->outgoing_frames, frame);
-        h2x_connection_on_new_outbound_data(connection);
+        if(frame_type == H2X_RST_STREAM) {
+            stream->reset_locally = true;
+        }
+        h2x_connection_set_stream_state(connection, stream, next_state);
+        h2x_connection_commit_outbound_frame(connection, frame);
+    } else {
+        // never committed, so the reservation is simply reused by the next outbound frame
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Dropping outbound frame of type %s on stream %u in state %s", h2x_frame_type_to_string(frame_type),
+                stream_id, h2x_stream_state_to_string(stream_state));
     }
+
+    h2x_connection_retire_stream_if_closed(connection, stream);
 }
 
 h2x_connection_error h2x_connection_handle_inbound_push_promise(struct h2x_connection* connection, struct h2x_frame* frame, struct h2x_stream* stream) {
     return H2X_NO_ERROR;
 }
 
-void parse_header_frames_and_trigger_callback(struct h2x_connection* connection, struct h2x_stream* stream) {
-    struct h2x_frame_list* header_fragments = &stream->header_fragments;
-    struct h2x_header_list* header_list = (struct h2x_header_list*)malloc(sizeof(struct h2x_header_list));
-    h2x_header_list_init(header_list);
-    struct h2x_frame* current_frame = NULL;
-
-    while((current_frame = h2x_frame_list_pop(header_fragments))) {
-
-        uint32_t read_index = 0;
-        uint32_t line_end_index = 0;
-        uint32_t delimiter_index = 0;
-        uint32_t start_mark = 0;
-        uint32_t current_char = 0;
-        uint8_t* payload = h2x_frame_get_payload(current_frame);
-        uint32_t payload_length = h2x_frame_get_length(current_frame);
-        uint8_t* payloadIter = payload;
-
-        while(read_index < payload_length && (current_char = *payloadIter++)) {
-            if(current_char == '=') {
-                delimiter_index = read_index;
+/*
+ * A HEADERS frame may carry padding and priority fields around its piece of the header block
+ */
+static bool get_header_block_fragment(struct h2x_frame* frame, uint8_t** fragment, uint32_t* fragment_length) {
+    uint8_t* payload = h2x_frame_get_payload(frame);
+    uint32_t length = h2x_frame_get_length(frame);
+
+    if (h2x_frame_get_type(frame) == H2X_HEADERS) {
+        uint8_t flags = h2x_frame_get_flags(frame);
+        uint32_t padding_length = 0;
+
+        if (flags & H2X_PADDED) {
+            if (length < 1) {
+                return false;
+            }
+            padding_length = payload[0];
+            payload += 1;
+            length -= 1;
+        }
+
+        if (flags & H2X_PRIORITY_FLAG) {
+            if (length < 5) {
+                return false;
             }
-            if(current_char == '\r') {
-                line_end_index = read_index;
+            payload += 5;
+            length -= 5;
+        }
+
+        if (padding_length > length) {
+            return false;
+        }
+        length -= padding_length;
+    }
+
+    *fragment = payload;
+    *fragment_length = length;
+
+    return true;
+}
+
+/*
+ * Fields are checked as they come off the decoder, while they're still in cache.  A bad one doesn't stop
+ * decoding: the rest of the block still has to go through the HPACK tables to keep them in step with
+ * the peer's.
+ */
+struct header_decode_context {
+    struct h2x_connection* connection;
+    struct h2x_header_block* block;
+    bool is_malformed;
+};
+
+static bool check_decoded_header(struct header_decode_context* decode_context, char* name, uint32_t name_length, char* value, uint32_t value_length) {
+    if (!h2x_header_name_is_valid(name, name_length) || !h2x_header_value_is_valid(value, value_length)) {
+        decode_context->is_malformed = true;
+    }
+
+    return !decode_context->is_malformed;
+}
+
+static void append_decoded_header(void* context, char* name, uint32_t name_length, char* value, uint32_t value_length) {
+    struct header_decode_context* decode_context = context;
+    if (check_decoded_header(decode_context, name, name_length, value, value_length)) {
+        h2x_header_block_append(decode_context->block, name, name_length, value, value_length);
+    }
+}
+
+static void append_decoded_header_view(void* context, char* name, uint32_t name_length, char* value, uint32_t value_length) {
+    struct header_decode_context* decode_context = context;
+    if (!check_decoded_header(decode_context, name, name_length, value, value_length)) {
+        return;
+    }
+
+    struct h2x_connection* connection = decode_context->connection;
+    if (connection->header_view_count == connection->header_view_capacity) {
+        connection->header_view_capacity = connection->header_view_capacity ? connection->header_view_capacity * 2 : 16;
+        connection->header_views = realloc(connection->header_views, connection->header_view_capacity * sizeof(struct h2x_header_view));
+    }
+
+    struct h2x_header_view* view = &connection->header_views[connection->header_view_count++];
+    view->name = name;
+    view->name_length = name_length;
+    view->value = value;
+    view->value_length = value_length;
+}
+
+/*
+ * Views point into the block and the decoder's state, both of which hold still until the next block
+ * is decoded, so the callback sees them without anything being copied
+ */
+static h2x_connection_error deliver_header_views(struct h2x_connection* connection, struct h2x_stream* stream, uint8_t* block, uint32_t block_length) {
+    struct header_decode_context decode_context = { connection, NULL, false };
+
+    connection->header_view_count = 0;
+    if (h2x_hpack_decode_block(&connection->hpack_decoder, block, block_length, append_decoded_header_view, &decode_context)) {
+        return H2X_COMPRESSION_ERROR;
+    }
+
+    if (decode_context.is_malformed) {
+        return H2X_PROTOCOL_ERROR;
+    }
+
+    connection->on_stream_header_views_received(connection, connection->header_views, connection->header_view_count,
+                                                stream->stream_identifier, stream->user_data);
+
+    return H2X_NO_ERROR;
+}
+
+static h2x_connection_error deliver_header_block(struct h2x_connection* connection, struct h2x_stream* stream, uint8_t* block, uint32_t block_length) {
+    // indexed headers decode to far more than their encoded size, so start the arena well past it
+    struct header_decode_context decode_context = { connection, h2x_header_block_new(block_length * 4), false };
+
+    h2x_connection_error error = H2X_NO_ERROR;
+    if (h2x_hpack_decode_block(&connection->hpack_decoder, block, block_length, append_decoded_header, &decode_context)) {
+        error = H2X_COMPRESSION_ERROR;
+    } else if (decode_context.is_malformed) {
+        error = H2X_PROTOCOL_ERROR;
+    }
+
+    if (!error && connection->on_stream_headers_received) {
+        // the callback owns the block from here on
+        connection->on_stream_headers_received(connection, decode_context.block, stream->stream_identifier, stream->user_data);
+    } else {
+        h2x_header_block_destroy(decode_context.block);
+    }
+
+    return error;
+}
+
+static void discard_decoded_header(void* context, char* name, uint32_t name_length, char* value, uint32_t value_length) {
+}
+
+/*
+ * A block sent on a stream we've already reset still has to go through the decoder to keep the
+ * HPACK dynamic table in step with the peer's, but nothing is delivered
+ */
+static h2x_connection_error discard_header_block(struct h2x_connection* connection, uint8_t* block, uint32_t block_length) {
+    if (h2x_hpack_decode_block(&connection->hpack_decoder, block, block_length, discard_decoded_header, NULL)) {
+        return H2X_COMPRESSION_ERROR;
+    }
+
+    return H2X_NO_ERROR;
+}
+
+/*
+ * Header fragments ahead of the final one have to outlive the frame they arrived in (which is
+ * often just a view into the read buffer), so they're copied.  The final fragment is parsed in place.
+ */
+static void retain_header_fragment(struct h2x_connection* connection, struct h2x_stream* stream, struct h2x_frame* frame) {
+    struct h2x_frame* fragment = h2x_connection_acquire_frame(connection, frame->size);
+    memcpy(fragment->raw_data, frame->raw_data, frame->size);
+
+    h2x_frame_list_append(&stream->header_fragments, fragment);
+}
+
+/*
+ * An encoded header can straddle frames, so a block split across CONTINUATIONs is stitched back
+ * together before decoding; the common single-frame block is decoded where it sits.
+ */
+static h2x_connection_error parse_header_frames_and_trigger_callback(struct h2x_connection* connection, struct h2x_stream* stream, struct h2x_frame* final_frame) {
+    struct h2x_frame_list* header_fragments = &stream->header_fragments;
+    h2x_connection_error error = H2X_NO_ERROR;
+    uint8_t* assembled_block = NULL;
+    uint8_t* block = NULL;
+    uint32_t block_length = 0;
+
+    if (!get_header_block_fragment(final_frame, &block, &block_length)) {
+        error = H2X_PROTOCOL_ERROR;
+    }
+
+    if (header_fragments->frame_count > 0) {
+        uint64_t total_length = block_length;
+        struct h2x_frame_list_node* node = header_fragments->head;
+        while (node && !error) {
+            uint8_t* fragment = NULL;
+            uint32_t fragment_length = 0;
+            if (!get_header_block_fragment(node->frame, &fragment, &fragment_length)) {
+                error = H2X_PROTOCOL_ERROR;
             }
+            total_length += fragment_length;
+            node = node->next;
+        }
+
+        if (!error) {
+            assembled_block = malloc(total_length);
+        }
 
-            if(delimiter_index && line_end_index) {
-                char* name = (char*)malloc((delimiter_index - start_mark / sizeof(char)) + 1);
-                char* value = (char*)malloc((line_end_index - delimiter_index / sizeof(char)) + 1);
-                name[(delimiter_index - start_mark)/sizeof(char)] = 0;
-                value[(line_end_index - delimiter_index)/sizeof(char)] = 0;
-                memcpy(name, payload + start_mark, delimiter_index - start_mark);
-                memcpy(value, payload + delimiter_index + 1, line_end_index - delimiter_index - 1);
-                start_mark = line_end_index + 2;
-
-                delimiter_index = 0;
-                line_end_index = 0;
-
-                struct h2x_header header;
-                h2x_header_init(&header, name, value);
-                h2x_header_list_append(header_list, header);
+        uint32_t assembled_length = 0;
+        struct h2x_frame* current_frame = NULL;
+        while ((current_frame = h2x_frame_list_pop(header_fragments))) {
+            uint8_t* fragment = NULL;
+            uint32_t fragment_length = 0;
+            if (assembled_block && get_header_block_fragment(current_frame, &fragment, &fragment_length)) {
+                memcpy(assembled_block + assembled_length, fragment, fragment_length);
+                assembled_length += fragment_length;
             }
+            h2x_connection_release_frame(connection, current_frame);
+        }
 
-            read_index++;
+        if (assembled_block) {
+            memcpy(assembled_block + assembled_length, block, block_length);
+            block = assembled_block;
+            block_length = assembled_length + block_length;
         }
     }
 
-    if(connection->on_stream_headers_received) {
-        connection->on_stream_headers_received(connection, header_list, stream->stream_identifier, stream->user_data);
+    if (error) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received malformed HEADERS frame on stream %u", connection->fd, stream->stream_identifier);
+        return error;
     }
+
+    if (stream == &connection->retired_stream || stream->is_refused) {
+        error = discard_header_block(connection, block, block_length);
+    } else if (connection->on_stream_header_views_received) {
+        error = deliver_header_views(connection, stream, block, block_length);
+    } else {
+        error = deliver_header_block(connection, stream, block, block_length);
+    }
+
+    if (error == H2X_COMPRESSION_ERROR) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d failed to decode header block on stream %u", connection->fd, stream->stream_identifier);
+    } else if (error) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received a malformed header field on stream %u", connection->fd, stream->stream_identifier);
+    }
+
+    free(assembled_block);
+
+    return error;
+}
+
+/*
+ * A header block that can't be decoded leaves the HPACK tables out of step with the peer's, which
+ * poisons every later block, so that's fatal to the whole connection
+ */
+static h2x_connection_error h2x_connection_on_end_headers(struct h2x_connection* connection, struct h2x_frame* frame, struct h2x_stream* stream) {
+    stream->end_header_sent = true;
+
+    h2x_connection_error error = parse_header_frames_and_trigger_callback(connection, stream, frame);
+    if (error == H2X_COMPRESSION_ERROR) {
+        h2x_connection_begin_close(connection);
+    }
+
+    return error;
 }
 
 h2x_connection_error h2x_connection_handle_inbound_header(struct h2x_connection* connection, struct h2x_frame* frame, struct h2x_stream* stream) {
-    if(h2x_frame_get_flags(frame) & H2X_END_HEADERS) {
-        h2x_frame_list_append(&stream->header_fragments, frame);
-        stream->end_header_sent = true;
-        parse_header_frames_and_trigger_callback(connection, stream);
+    uint8_t flags = h2x_frame_get_flags(frame);
+    if((flags & H2X_PRIORITY_FLAG) && stream != &connection->retired_stream) {
+        uint32_t priority_offset = (flags & H2X_PADDED) ? 1 : 0;
+        if(h2x_frame_get_length(frame) < priority_offset + 5) {
+            return H2X_FRAME_SIZE_ERROR;
+        }
 
-    } else {
-        h2x_frame_list_append(&stream->header_fragments, frame);
+        h2x_connection_error error = h2x_connection_set_stream_priority(connection, stream, h2x_frame_get_payload(frame) + priority_offset);
+        if(error != H2X_NO_ERROR) {
+            return error;
+        }
     }
 
+    if(flags & H2X_END_HEADERS) {
+        return h2x_connection_on_end_headers(connection, frame, stream);
+    }
+
+    retain_header_fragment(connection, stream, frame);
+
     return H2X_NO_ERROR;
 }
 
 h2x_connection_error h2x_connection_handle_inbound_continuation(struct h2x_connection* connection, struct h2x_frame* frame, struct h2x_stream* stream) {
     if(h2x_frame_get_flags(frame) & H2X_END_HEADERS) {
-        h2x_frame_list_append(&stream->header_fragments, frame);
-        stream->end_header_sent = true;
-        parse_header_frames_and_trigger_callback(connection, stream);
-
-    } else {
-        h2x_frame_list_append(&stream->header_fragments, frame);
+        return h2x_connection_on_end_headers(connection, frame, stream);
     }
 
+    retain_header_fragment(connection, stream, frame);
+
     return H2X_NO_ERROR;
 }
 
+/*
+ * The peer reset the stream; a REFUSED_STREAM among these is how it turns away streams past its limit
+ */
 h2x_connection_error h2x_connection_handle_inbound_stream_closed(struct h2x_connection* connection, struct h2x_frame* frame, struct h2x_stream* stream) {
+    if (h2x_frame_get_length(frame) != sizeof(uint32_t)) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received RST_STREAM frame of length %u", connection->fd, h2x_frame_get_length(frame));
+        h2x_connection_begin_close(connection);
+        return H2X_NO_ERROR;
+    }
+
+    h2x_connection_error error = h2x_get_integer_as_big_endian(h2x_frame_get_payload(frame), sizeof(uint32_t));
+    H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d stream %u reset by the peer with error %u", connection->fd, stream->stream_identifier, (uint32_t) error);
+    h2x_connection_report_stream_error(connection, error, stream->stream_identifier, stream->user_data);
+
     return H2X_NO_ERROR;
 }
 
 h2x_connection_error h2x_connection_handle_inbound_stream_data(struct h2x_connection* connection, struct h2x_frame* frame, struct h2x_stream* stream) {
+    uint32_t length = h2x_frame_get_length(frame);
+    if (!h2x_receive_window_consume(&stream->receive_window, length)) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received more data than the flow control window of stream %u allows", connection->fd,
+                stream->stream_identifier);
+        return H2X_FLOW_CONTROL_ERROR;
+    }
 
      if(connection->on_stream_body_received) {
-         connection->on_stream_body_received(connection, h2x_frame_get_payload(frame), h2x_frame_get_length(frame), stream->stream_identifier,
+         connection->on_stream_body_received(connection, h2x_frame_get_payload(frame), length, stream->stream_identifier,
                                              h2x_frame_get_flags(frame) & H2X_STREAM_CLOSED, stream->user_data);
      }
 
+    // there's no point returning credit the peer can't use once it has ended its side
+    if (stream->state == H2X_OPEN || stream->state == H2X_HALF_CLOSED_LOCAL) {
+        h2x_connection_release_received_data(connection, &stream->receive_window, stream->stream_identifier, length);
+    }
+
     return H2X_NO_ERROR;
 }
 
+static bool get_window_update_increment(struct h2x_connection* connection, struct h2x_frame* frame, uint32_t* increment) {
+    if (h2x_frame_get_length(frame) != sizeof(uint32_t)) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received WINDOW_UPDATE frame of length %u", connection->fd, h2x_frame_get_length(frame));
+        h2x_connection_begin_close(connection);
+        return false;
+    }
+
+    *increment = h2x_get_integer_as_big_endian(h2x_frame_get_payload(frame), sizeof(uint32_t)) & H2X_MAX_WINDOW_SIZE;
+
+    return true;
+}
+
+static void h2x_connection_handle_inbound_connection_window_update(struct h2x_connection* connection, struct h2x_frame* frame) {
+    uint32_t increment = 0;
+    if (!get_window_update_increment(connection, frame, &increment)) {
+        return;
+    }
+
+    if (increment == 0 || !h2x_send_window_increase(&connection->send_window, increment)) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received invalid connection window increment %u", connection->fd, increment);
+        h2x_connection_begin_close(connection);
+        return;
+    }
+
+    h2x_connection_write_scheduled_data(connection);
+}
+
 h2x_connection_error h2x_connection_handle_inbound_stream_window_update(struct h2x_connection* connection, struct h2x_frame* frame, struct h2x_stream* stream) {
+    uint32_t increment = 0;
+    if (!get_window_update_increment(connection, frame, &increment)) {
+        return H2X_FRAME_SIZE_ERROR;
+    }
+
+    if (increment == 0) {
+        return H2X_PROTOCOL_ERROR;
+    }
+
+    if (!h2x_send_window_increase(&stream->send_window, increment)) {
+        return H2X_FLOW_CONTROL_ERROR;
+    }
+
+    if (stream->is_scheduled) {
+        h2x_connection_write_scheduled_data(connection);
+    }
+
     return H2X_NO_ERROR;
 }
 
-h2x_connection_error h2x_connection_handle_inbound_stream_priority(struct h2x_connection* connection, struct h2x_frame* frame, struct h2x_stream* stream) {
+struct exclusive_dependency_change {
+    uint32_t parent_id;
+    uint32_t stream_id;
+};
+
+static void adopt_sibling(struct h2x_stream *stream, void *context) {
+    struct exclusive_dependency_change *change = context;
+    if (stream->dependency == change->parent_id && stream->stream_identifier != change->stream_id) {
+        stream->dependency = change->stream_id;
+    }
+}
+
+/*
+ * Applies the 5 bytes of priority fields a PRIORITY frame or a HEADERS frame with the PRIORITY flag
+ * carries (rfc7540 6.3)
+ */
+static h2x_connection_error h2x_connection_set_stream_priority(struct h2x_connection* connection, struct h2x_stream* stream, uint8_t* fields) {
+    uint32_t stream_id = stream->stream_identifier;
+    bool is_exclusive = (fields[0] & 0x80) != 0;
+    uint32_t dependency = h2x_get_integer_as_big_endian(fields, 4) & 0x7FFFFFFF;
+    if (dependency == stream_id) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received priority making stream %u depend on itself", connection->fd, stream_id);
+        return H2X_PROTOCOL_ERROR;
+    }
+
+    // rfc7540 5.3.3: a stream can't come to depend on its own descendant, so that descendant moves up first
+    struct h2x_stream *parent = h2x_stream_table_find(&connection->streams, dependency);
+    uint32_t ancestor_id = parent ? parent->dependency : 0;
+    for (uint32_t depth = 0; ancestor_id != 0 && depth < H2X_MAX_PRIORITY_DEPTH; ++depth) {
+        if (ancestor_id == stream_id) {
+            parent->dependency = stream->dependency;
+            break;
+        }
+
+        struct h2x_stream *ancestor = h2x_stream_table_find(&connection->streams, ancestor_id);
+        ancestor_id = ancestor ? ancestor->dependency : 0;
+    }
+
+    if (is_exclusive) {
+        struct exclusive_dependency_change change = { dependency, stream_id };
+        h2x_stream_table_visit(&connection->streams, adopt_sibling, &change);
+    }
+
+    stream->dependency = dependency;
+    stream->weight = (uint16_t) fields[4] + 1;
+
     return H2X_NO_ERROR;
 }
 
+h2x_connection_error h2x_connection_handle_inbound_stream_priority(struct h2x_connection* connection, struct h2x_frame* frame, struct h2x_stream* stream) {
+    if (h2x_frame_get_length(frame) != 5) {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Connection %d received PRIORITY frame of length %u", connection->fd, h2x_frame_get_length(frame));
+        return H2X_FRAME_SIZE_ERROR;
+    }
+
+    return h2x_connection_set_stream_priority(connection, stream, h2x_frame_get_payload(frame));
+}
+
 h2x_connection_error h2x_connection_handle_inbound_stream_error(struct h2x_connection* connection, struct h2x_frame* frame, struct h2x_stream* stream, h2x_connection_error error) {
+    h2x_connection_report_stream_error(connection, error, stream->stream_identifier, stream->user_data);
     return H2X_NO_ERROR;
 }
 
 void h2x_connection_add_request(struct h2x_connection* connection, struct h2x_request* request)
 {
-    h2x_thread_add_request(connection->owner, request);
+    h2x_thread_add_request(atomic_load_explicit(&connection->owner, memory_order_acquire), request);
+}
+
+bool h2x_connection_is_accepting_streams(struct h2x_connection* connection)
+{
+    return !connection->goaway_received && connection->state != H2X_CS_CLOSING;
+}
+
+bool h2x_connection_can_open_outbound_stream(struct h2x_connection* connection)
+{
+    return connection->local_stream_count < connection->peer_settings.max_concurrent_streams;
+}
+
+void h2x_connection_report_stream_error(struct h2x_connection* connection, h2x_connection_error error, uint32_t stream_id, void* user_data)
+{
+    if(connection->on_stream_error)
+    {
+        connection->on_stream_error(connection, error, stream_id, user_data);
+    }
 }
 
 void h2x_connection_begin_close(struct h2x_connection* connection)
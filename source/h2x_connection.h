@@ -3,19 +3,27 @@
 #define H2X_CONNECTION_H
 
 #include <stdint.h>
+#include <sys/uio.h>
 #include <h2x_enum_types.h>
+#include <h2x_flow_control.h>
 #include <h2x_frame.h>
-#include <h2x_hash_table.h>
 #include <h2x_headers.h>
+#include <h2x_hpack.h>
 #include <h2x_request.h>
-
-//per rfc7540 section 4.2
-#define MAX_RECV_FRAME_SIZE 0x4000
-
-struct h2x_header_list;
+#include <h2x_ring_buffer.h>
+#include <h2x_settings.h>
+#include <h2x_stream.h>
+#include <h2x_stream_scheduler.h>
+#include <h2x_stream_table.h>
+#include <h2x_uring.h>
+
+struct h2x_header_block;
 struct h2x_stream;
 struct h2x_thread;
 
+// how many of the streams we reset are remembered after they leave the stream table
+#define H2X_RECENTLY_RESET_STREAM_COUNT 32
+
 struct h2x_socket_state {
     uint64_t bytes_written;
     uint64_t bytes_read;
@@ -28,8 +36,9 @@ struct h2x_socket_state {
 void h2x_socket_state_init(struct h2x_socket_state* socket_state);
 
 struct h2x_connection {
-    struct h2x_thread* owner;
+    struct h2x_thread* _Atomic owner;   // shared state: requests submitted from other threads find the owner through it
     h2x_connection_state state;
+    uint32_t active_stream_count;   // streams that haven't reached H2X_CLOSED; mirrored in the owner's load metrics
     int fd;
     struct h2x_request* queued_request;
 
@@ -55,34 +64,116 @@ struct h2x_connection {
      */
     bool in_intrusive_chain[H2X_ICT_COUNT];
 
-    struct h2x_hash_table streams;
+    struct h2x_stream_table streams;
+    /*
+     Streams are retired from the table and recycled as soon as they close.  Anything that turns up
+     for them later is either ignored or a protocol error, depending on whether we were the ones who
+     reset the stream, so the ids of the last few we reset are kept here.
+     */
+    uint32_t recently_reset_stream_ids[H2X_RECENTLY_RESET_STREAM_COUNT];
+    uint32_t next_recently_reset_slot;
+    struct h2x_stream* inbound_stream;      // the stream an inbound frame is being processed on; it can't retire until that's done
+    struct h2x_stream retired_stream;       // stands in for a reset stream the peer sends a header block on, which still has to be decoded
     uint32_t next_outgoing_stream_id;
+
+    /*
+     SETTINGS (rfc7540 6.5).  Ours go out as the connection's first frame.  Until the peer acks them it
+     may still be working to the defaults, so anything we lower only takes effect on the ack, while
+     anything we raise is honoured straight away.
+     */
+    struct h2x_settings local_settings;
+    struct h2x_settings peer_settings;
+    bool local_settings_queued;
+    bool local_settings_acked;
+    uint32_t receive_initial_window_size;   // the receive window new streams start with
+    uint32_t peer_stream_count;             // streams the peer opened that haven't closed
+    uint32_t local_stream_count;            // streams we opened that haven't closed; held to the peer's limit
+    bool goaway_received;                   // no new streams; the connection closes once the last one does
+
+    /*
+     Connection-level flow control.  Streams with DATA that couldn't go out straight away wait on the
+     scheduler for their turn and for the windows to have room.
+     */
+    int64_t send_window;
+    struct h2x_receive_window receive_window;
+    struct h2x_stream_scheduler scheduler;
+
+    /*
+     A frame that straddles reads is buffered in current_frame, which isn't acquired until the header
+     is in and says how big the frame is.  Until then the header collects in current_frame_header.
+     */
     uint32_t current_frame_size;
     uint32_t current_frame_read;
+    uint8_t current_frame_header[H2X_FRAME_HEADER_LENGTH];
     struct h2x_frame* current_frame;
-    struct h2x_frame_list outgoing_frames;
     h2x_read_frame_state read_frame_state;
 
-    struct h2x_frame* current_outbound_frame;
-    uint32_t current_outbound_frame_read_position;
+    /*
+     Outbound frames are serialized directly into this ring and drained from it by the write loop.
+     DATA only goes in while the ring holds less than outbound_data_budget, sized from the socket's
+     send buffer; the rest waits on the scheduler until the writer frees up room.
+     */
+    struct h2x_ring_buffer outbound_buffer;
+    uint32_t outbound_data_budget;
+
+    /*
+     Backpressure on whoever produces stream data: pending_data_length is what the streams hold
+     between them waiting on the scheduler.  See h2x_connection_wants_stream_data.
+     */
+    uint64_t pending_data_length;
+    bool is_write_paused;
+
+    /*
+     Header compression state; every header block this connection sends goes through the encoder and
+     every block it receives through the decoder, in wire order
+     */
+    struct h2x_hpack_encoder hpack_encoder;
+    struct h2x_hpack_decoder hpack_decoder;
+
+    /*
+     Reused for every block delivered through on_stream_header_views_received
+     */
+    struct h2x_header_view* header_views;
+    uint32_t header_view_count;
+    uint32_t header_view_capacity;
+
+    struct h2x_uring_socket_state uring_state;
+    struct h2x_connection* next_new_connection;     // handoff link from the connection manager to the owning thread
+    struct h2x_thread* migration_target;    // non-NULL while the owner drains io before handing the connection off
 
     uint32_t last_seen_stream_id;
     h2x_frame_type last_seen_frame_type;
 
     void* user_data;
-    void(*on_stream_headers_received)(struct h2x_connection*, struct h2x_header_list* headers, uint32_t stream_id, void*);
+    void(*on_stream_headers_received)(struct h2x_connection*, struct h2x_header_block* headers, uint32_t stream_id, void*);
+    void(*on_stream_header_views_received)(struct h2x_connection*, struct h2x_header_view* headers, uint32_t header_count, uint32_t stream_id, void*);
     void(*on_stream_body_received)(struct h2x_connection*, uint8_t* data, uint32_t length, uint32_t, bool lastFrame, void*);
     void(*on_stream_error)(struct h2x_connection*, h2x_connection_error, uint32_t, void*);
     bool(*on_stream_data_needed)(struct h2x_connection*, uint32_t, uint8_t*, uint32_t, uint32_t*, void*);
 
 };
 
+uint32_t h2x_connection_fd_hash_function(void* data);
+
 void h2x_connection_init(struct h2x_connection* connection, struct h2x_thread* owner, int fd);
+
+/*
+ * Puts our SETTINGS at the head of the outbound ring.  Called on the owning thread once the connection
+ * reaches it, so the ring is first touched on that thread's node; only the first call does anything.
+ */
+void h2x_connection_queue_local_settings(struct h2x_connection* connection);
 void h2x_connection_cleanup(struct h2x_connection *connection);
 void h2x_connection_on_data_received(struct h2x_connection *connection, uint8_t* data, uint32_t data_length);
 
 void h2x_connection_set_stream_headers_receieved_callback(struct h2x_connection* connection,
-                                                          void(*callback)(struct h2x_connection*, struct h2x_header_list* headers, uint32_t, void*));
+                                                          void(*callback)(struct h2x_connection*, struct h2x_header_block* headers, uint32_t, void*));
+/*
+ * The zero-copy alternative to the headers callback: the views are only good until the callback
+ * returns, so nothing gets copied unless the handler retains it.  Takes precedence over the headers
+ * callback when both are set.
+ */
+void h2x_connection_set_stream_header_views_received_callback(struct h2x_connection* connection,
+                                                              void(*callback)(struct h2x_connection*, struct h2x_header_view* headers, uint32_t header_count, uint32_t, void*));
 void h2x_connection_set_stream_body_receieved_callback(struct h2x_connection* connection,
                                                        void(*callback)(struct h2x_connection*, uint8_t* data, uint32_t length, uint32_t, bool finalFrame, void*));
 void h2x_connection_set_stream_data_needed_callback(struct h2x_connection* connection,
@@ -93,24 +184,44 @@ void h2x_connection_set_stream_error_callback(struct h2x_connection* connection,
 
 void h2x_connection_push_frame_to_stream(struct h2x_connection *connection, struct h2x_frame* frame, h2x_stream_push_dir stream_push_dir);
 
-void h2x_push_headers(struct h2x_connection* connection, uint32_t stream_id, struct h2x_header_list*);
+void h2x_push_headers(struct h2x_connection* connection, uint32_t stream_id, struct h2x_header_block*);
 void h2x_push_data_segment(struct h2x_connection* connection, uint32_t stream_id, uint8_t* data, uint32_t size, bool lastFrame);
+
+/*
+ * Whether a producer should push more data on the stream yet.  The connection and the stream each stop
+ * wanting data once what they have queued reaches their high watermark, and want it again once that
+ * drains below the low one.  Nothing is wanted while a send window is shut.
+ */
+bool h2x_connection_wants_stream_data(struct h2x_connection* connection, uint32_t stream_id);
 void h2x_push_rst_stream(struct h2x_connection* connection, uint32_t stream_id, h2x_connection_error error);
 uint32_t h2x_connection_create_outbound_stream(struct h2x_connection *connection, void* user_data);
 
-struct h2x_frame* h2x_connection_pop_frame(struct h2x_connection* connection);
 void h2x_connection_on_new_outbound_data(struct h2x_connection* connection);
 
 void h2x_connection_add_to_intrusive_chain(struct h2x_connection* connection, h2x_intrusive_chain_type chain);
 void h2x_connection_remove_from_intrusive_chain(struct h2x_connection** connection_ref, h2x_intrusive_chain_type chain);
 
-void h2x_connection_pump_outbound_frame(struct h2x_connection* connection);
+bool h2x_connection_has_outbound_data(struct h2x_connection* connection);
+uint32_t h2x_connection_gather_outbound_data(struct h2x_connection* connection, struct iovec* iovecs, uint32_t* total_size);
+void h2x_connection_on_outbound_data_written(struct h2x_connection* connection, uint32_t bytes_written);
 
 void h2x_connection_process_inbound_frame(struct h2x_connection* connection, struct h2x_frame* frame);
 void h2x_connection_process_outbound_frame(struct h2x_connection* connection, struct h2x_frame* frame);
 
 void h2x_connection_add_request(struct h2x_connection* connection, struct h2x_request* request);
 
+// false once the peer has sent GOAWAY or the connection is closing
+bool h2x_connection_is_accepting_streams(struct h2x_connection* connection);
+
+// whether another stream of ours would stay within the peer's SETTINGS_MAX_CONCURRENT_STREAMS
+bool h2x_connection_can_open_outbound_stream(struct h2x_connection* connection);
+
+/*
+ * Passes a stream's failure on to on_stream_error.  A request that never got as far as a stream is
+ * reported with stream id 0.
+ */
+void h2x_connection_report_stream_error(struct h2x_connection* connection, h2x_connection_error error, uint32_t stream_id, void* user_data);
+
 h2x_connection_error h2x_connection_handle_inbound_push_promise(struct h2x_connection* connection, struct h2x_frame* frame, struct h2x_stream* stream);
 h2x_connection_error h2x_connection_handle_inbound_header(struct h2x_connection* connection, struct h2x_frame* frame, struct h2x_stream* stream);
 h2x_connection_error h2x_connection_handle_inbound_continuation(struct h2x_connection* connection, struct h2x_frame* frame, struct h2x_stream* stream);
@@ -2,6 +2,7 @@
 #include <h2x_connection_manager.h>
 #include <h2x_stream.h>
 #include <h2x_connection.h>
+#include <h2x_cpu_affinity.h>
 #include <h2x_log.h>
 #include <h2x_net_shared.h>
 #include <h2x_options.h>
@@ -11,14 +12,72 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+
+/*
+ * Groups the pinned threads by node so placement can prefer threads local to the node a connection
+ * arrived on
+ */
+static void build_node_thread_arrays(struct h2x_connection_manager* connection_manager)
+{
+    uint32_t node_count = 0;
+    for(uint32_t i = 0; i < connection_manager->thread_count; ++i)
+    {
+        int node = connection_manager->thread_array[i]->numa_node;
+        if(node >= 0 && (uint32_t) node + 1 > node_count)
+        {
+            node_count = node + 1;
+        }
+    }
+
+    if(node_count == 0)
+    {
+        return;
+    }
+
+    connection_manager->node_count = node_count;
+    connection_manager->node_threads = calloc(node_count, sizeof(struct h2x_thread**));
+    connection_manager->node_thread_counts = calloc(node_count, sizeof(uint32_t));
+    for(uint32_t node = 0; node < node_count; ++node)
+    {
+        connection_manager->node_threads[node] = calloc(connection_manager->thread_count, sizeof(struct h2x_thread*));
+    }
+
+    for(uint32_t i = 0; i < connection_manager->thread_count; ++i)
+    {
+        struct h2x_thread* thread = connection_manager->thread_array[i];
+        if(thread->numa_node >= 0)
+        {
+            connection_manager->node_threads[thread->numa_node][connection_manager->node_thread_counts[thread->numa_node]++] = thread;
+        }
+    }
+}
+
 int h2x_connection_manager_init(struct h2x_options *options, struct h2x_connection_manager* connection_manager)
 {
     connection_manager->options = h2x_options_copy(options);
     connection_manager->finished_connections = NULL;
     connection_manager->next_thread_id = 0;
-    connection_manager->connection_counts = NULL;
+    connection_manager->thread_array = NULL;
+    connection_manager->thread_count = 0;
+    connection_manager->placement_seed = 0x9E3779B9;
+    connection_manager->last_balance_check_ns = 0;
+    connection_manager->node_count = 0;
+    connection_manager->node_threads = NULL;
+    connection_manager->node_thread_counts = NULL;
+
+    struct h2x_cpu_plan* cpu_plan = &connection_manager->cpu_plan;
+    memset(cpu_plan, 0, sizeof(struct h2x_cpu_plan));
+    if(options->pin_threads && h2x_cpu_plan_init(cpu_plan, options->numa_aware))
+    {
+        H2X_LOG(H2X_LOG_LEVEL_WARN, "Unable to work out cpu topology, processing threads will not be pinned");
+    }
 
     if(pthread_mutex_init(&connection_manager->finished_connection_lock, NULL))
     {
@@ -30,7 +89,10 @@ int h2x_connection_manager_init(struct h2x_options *options, struct h2x_connecti
 
     for(i = 0; i < options->threads; ++i)
     {
-        struct h2x_thread* thread = h2x_thread_new(options, h2x_processing_thread_function, connection_manager->next_thread_id++);
+        int cpu = -1, node = -1;
+        h2x_cpu_plan_get_thread_cpu(cpu_plan, connection_manager->next_thread_id, &cpu, &node);
+
+        struct h2x_thread* thread = h2x_thread_new(options, h2x_processing_thread_function, connection_manager->next_thread_id++, cpu, node);
         h2x_thread_set_finished_connection_channel(thread, &connection_manager->finished_connection_lock, &connection_manager->finished_connections);
 
         *thread_node = malloc(sizeof(struct h2x_thread_node));
@@ -42,7 +104,18 @@ int h2x_connection_manager_init(struct h2x_options *options, struct h2x_connecti
         H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Adding thread %u to connection manager", thread->thread_id);
     }
 
-    connection_manager->connection_counts = calloc(options->threads, sizeof(uint32_t));
+    connection_manager->thread_array = calloc(options->threads, sizeof(struct h2x_thread*));
+    thread_node = &connection_manager->processing_threads;
+    while(*thread_node)
+    {
+        connection_manager->thread_array[connection_manager->thread_count++] = (*thread_node)->thread;
+        thread_node = &((*thread_node)->next);
+    }
+
+    if(options->numa_aware)
+    {
+        build_node_thread_arrays(connection_manager);
+    }
 
     return 0;
 }
@@ -64,7 +137,7 @@ int h2x_connection_manager_cleanup(struct h2x_connection_manager* connection_man
 
         H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Sending quit signal to thread %u", thread->thread_id);
 
-        atomic_store(&thread->should_quit, true);
+        h2x_thread_request_quit(thread);
 
         thread_node = thread_node->next;
     }
@@ -104,31 +177,126 @@ int h2x_connection_manager_cleanup(struct h2x_connection_manager* connection_man
     h2x_options_cleanup(connection_manager->options);
 
     free(connection_manager->options);
-    free(connection_manager->connection_counts);
+    free(connection_manager->thread_array);
+
+    for(uint32_t node = 0; node < connection_manager->node_count; ++node)
+    {
+        free(connection_manager->node_threads[node]);
+    }
+    free(connection_manager->node_threads);
+    free(connection_manager->node_thread_counts);
+    h2x_cpu_plan_cleanup(&connection_manager->cpu_plan);
 
     return 0;
 }
 
-struct h2x_connection* h2x_connection_manager_add_connection(struct h2x_connection_manager* connection_manager, int fd)
+static uint32_t next_placement_random(struct h2x_connection_manager* connection_manager)
 {
-    struct h2x_thread *add_thread = NULL;
-    uint32_t lowest_count = (uint32_t)-1;
-    struct h2x_thread_node *thread_node = connection_manager->processing_threads;
-    while (thread_node)
+    // xorshift32; placement only needs cheap, roughly uniform picks
+    uint32_t x = connection_manager->placement_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    connection_manager->placement_seed = x;
+
+    return x;
+}
+
+static bool thread_has_room(struct h2x_thread* thread)
+{
+    return atomic_load_explicit(&thread->load.open_connections, memory_order_relaxed) < thread->options->connections_per_thread;
+}
+
+/*
+ * Power-of-two-choices: sample two distinct threads at random and take the less loaded one.  This
+ * avoids the herding a strict least-loaded pick causes when every decision reads the same slightly
+ * stale metrics, while still steering new connections away from hot threads.  Falls back to a scan
+ * when neither sampled thread has room.
+ */
+static struct h2x_thread* choose_thread_from(struct h2x_connection_manager* connection_manager, struct h2x_thread** threads, uint32_t thread_count, int fd)
+{
+    if (thread_count == 0)
     {
-        struct h2x_thread *thread = thread_node->thread;
-        uint32_t thread_connection_count = connection_manager->connection_counts[thread->thread_id];
-        H2X_LOG(H2X_LOG_LEVEL_TRACE, "Considering adding connection %d to thread %u with %u(%u) connections", fd, thread->thread_id, thread_connection_count, thread->options->connections_per_thread);
-        if (thread_connection_count <= lowest_count &&
-            thread_connection_count < thread->options->connections_per_thread)
+        return NULL;
+    }
+
+    uint32_t first_index = next_placement_random(connection_manager) % thread_count;
+    uint32_t second_index = first_index;
+    if (thread_count > 1)
+    {
+        second_index = (first_index + 1 + next_placement_random(connection_manager) % (thread_count - 1)) % thread_count;
+    }
+
+    struct h2x_thread* first = threads[first_index];
+    struct h2x_thread* second = threads[second_index];
+
+    uint64_t first_score = h2x_load_metrics_get_score(&first->load);
+    uint64_t second_score = h2x_load_metrics_get_score(&second->load);
+    H2X_LOG(H2X_LOG_LEVEL_TRACE, "Considering adding connection %d to thread %u (score %lu) or thread %u (score %lu)", fd,
+            first->thread_id, (unsigned long) first_score, second->thread_id, (unsigned long) second_score);
+
+    struct h2x_thread* best = second_score < first_score ? second : first;
+    struct h2x_thread* other = best == first ? second : first;
+    if (thread_has_room(best))
+    {
+        return best;
+    }
+
+    if (thread_has_room(other))
+    {
+        return other;
+    }
+
+    struct h2x_thread* add_thread = NULL;
+    uint64_t lowest_score = UINT64_MAX;
+    for (uint32_t i = 0; i < thread_count; ++i)
+    {
+        struct h2x_thread* thread = threads[i];
+        uint64_t score = h2x_load_metrics_get_score(&thread->load);
+        if (thread_has_room(thread) && score < lowest_score)
         {
             add_thread = thread;
-            lowest_count = thread_connection_count;
+            lowest_score = score;
         }
+    }
 
-        thread_node = thread_node->next;
+    return add_thread;
+}
+
+/*
+ * With --numa, a connection first goes to a thread on the node whose core took the socket's packets
+ * (the one the NIC queue interrupts), and only spills over to other nodes when those threads are full
+ */
+static struct h2x_thread* choose_thread_for_connection(struct h2x_connection_manager* connection_manager, int fd)
+{
+    if (connection_manager->node_count > 0)
+    {
+        int incoming_cpu = -1;
+        socklen_t option_length = sizeof(incoming_cpu);
+        if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &incoming_cpu, &option_length) == 0 && incoming_cpu >= 0)
+        {
+            int node = h2x_cpu_plan_get_cpu_node(&connection_manager->cpu_plan, incoming_cpu);
+            if ((uint32_t) node < connection_manager->node_count)
+            {
+                struct h2x_thread* local_thread = choose_thread_from(connection_manager, connection_manager->node_threads[node], connection_manager->node_thread_counts[node], fd);
+                if (local_thread)
+                {
+                    return local_thread;
+                }
+            }
+        }
     }
 
+    return choose_thread_from(connection_manager, connection_manager->thread_array, connection_manager->thread_count, fd);
+}
+
+/*
+ * on_connection_created, if given, runs before the connection is handed to its processing thread, which
+ * makes it the place to install callbacks
+ */
+struct h2x_connection* h2x_connection_manager_add_connection(struct h2x_connection_manager* connection_manager, int fd, void (*on_connection_created)(struct h2x_connection*))
+{
+    struct h2x_thread *add_thread = choose_thread_for_connection(connection_manager, fd);
     if (add_thread == NULL)
     {
         H2X_LOG(H2X_LOG_LEVEL_INFO, "No available threads with room for a connection.");
@@ -139,9 +307,18 @@ struct h2x_connection* h2x_connection_manager_add_connection(struct h2x_connecti
     struct h2x_connection* new_connection = malloc(sizeof(struct h2x_connection));
     h2x_connection_init(new_connection, add_thread, fd);
 
+    // counted right away so back-to-back placements see it; the processing thread uncounts it when released
+    atomic_fetch_add(&add_thread->load.open_connections, 1);
+
+    if (on_connection_created)
+    {
+        (*on_connection_created)(new_connection);
+    }
+
     if (h2x_thread_add_connection(add_thread, new_connection))
     {
         H2X_LOG(H2X_LOG_LEVEL_INFO, "Something went very wrong in h2x_thread_add_connection");
+        atomic_fetch_sub(&add_thread->load.open_connections, 1);
         h2x_connection_cleanup(new_connection); // TODO connection cleanup is F'ed up
         close(fd);
         free(new_connection);
@@ -150,12 +327,50 @@ struct h2x_connection* h2x_connection_manager_add_connection(struct h2x_connecti
     else
     {
         H2X_LOG(H2X_LOG_LEVEL_INFO, "Added connection %d to thread %u", fd, add_thread->thread_id);
-        connection_manager->connection_counts[add_thread->thread_id]++;
     }
 
     return new_connection;
 }
 
+/*
+ * Gives every processing thread its own SO_REUSEPORT listener on the configured port, so the kernel
+ * spreads incoming connections across threads and each one accepts locally
+ */
+int h2x_connection_manager_add_reuseport_listeners(struct h2x_connection_manager* connection_manager, void (*on_connection_accepted)(struct h2x_connection*))
+{
+    struct h2x_thread_node *thread_node = connection_manager->processing_threads;
+    while (thread_node)
+    {
+        struct h2x_thread *thread = thread_node->thread;
+
+        int listener_fd = h2x_create_listener_socket(connection_manager->options->port, true);
+        if (listener_fd < 0)
+        {
+            H2X_LOG(H2X_LOG_LEVEL_FATAL, "Unable to create and bind listener socket for thread %u, errno = %d", thread->thread_id, errno);
+            return -1;
+        }
+
+        /*
+         * A pinned thread's listener claims connections whose packets are processed on its core, so the
+         * socket stays on the cpu (and node) the NIC delivers it to
+         */
+        if (thread->cpu >= 0 && setsockopt(listener_fd, SOL_SOCKET, SO_INCOMING_CPU, &thread->cpu, sizeof(thread->cpu)))
+        {
+            H2X_LOG(H2X_LOG_LEVEL_WARN, "Unable to steer thread %u listener to cpu %d, errno = %d", thread->thread_id, thread->cpu, errno);
+        }
+
+        if (h2x_thread_add_listener(thread, listener_fd, on_connection_accepted))
+        {
+            close(listener_fd);
+            return -1;
+        }
+
+        thread_node = thread_node->next;
+    }
+
+    return 0;
+}
+
 void h2x_connection_manager_pump_closed_connections(struct h2x_connection_manager* manager)
 {
     struct h2x_connection* finished_connections = NULL;
@@ -189,6 +404,67 @@ void h2x_connection_manager_pump_closed_connections(struct h2x_connection_manage
     }
 }
 
+// how often thread load is compared; one connection moves per check at most
+#define BALANCE_CHECK_INTERVAL_NS 1000000000ULL
+// a thread this busy sheds a connection, but only to a thread that's at most this busy
+#define MIGRATION_HOT_BUSY_PER_MILLE 750
+#define MIGRATION_COLD_BUSY_PER_MILLE 400
+
+/*
+ * Looks for a saturated thread and, if another thread has headroom, asks the saturated thread to move
+ * one of its quiescent connections over.  A thread with a single connection is left alone since moving
+ * it would just move the hot spot.
+ */
+void h2x_connection_manager_balance_load(struct h2x_connection_manager* manager)
+{
+    uint64_t now = h2x_load_metrics_now_ns();
+    if (manager->thread_count < 2 || now - manager->last_balance_check_ns < BALANCE_CHECK_INTERVAL_NS)
+    {
+        return;
+    }
+
+    manager->last_balance_check_ns = now;
+
+    struct h2x_thread* hottest = NULL;
+    struct h2x_thread* coldest = NULL;
+    uint64_t hottest_score = 0;
+    uint64_t coldest_score = UINT64_MAX;
+    for (uint32_t i = 0; i < manager->thread_count; ++i)
+    {
+        struct h2x_thread* thread = manager->thread_array[i];
+        uint64_t score = h2x_load_metrics_get_score(&thread->load);
+        if (hottest == NULL || score > hottest_score)
+        {
+            hottest = thread;
+            hottest_score = score;
+        }
+
+        if (thread_has_room(thread) && score < coldest_score)
+        {
+            coldest = thread;
+            coldest_score = score;
+        }
+    }
+
+    if (coldest == NULL || coldest == hottest)
+    {
+        return;
+    }
+
+    uint32_t hottest_busy = atomic_load_explicit(&hottest->load.busy_per_mille, memory_order_relaxed);
+    uint32_t coldest_busy = atomic_load_explicit(&coldest->load.busy_per_mille, memory_order_relaxed);
+    uint32_t hottest_connections = atomic_load_explicit(&hottest->load.open_connections, memory_order_relaxed);
+    if (hottest_busy < MIGRATION_HOT_BUSY_PER_MILLE || coldest_busy > MIGRATION_COLD_BUSY_PER_MILLE || hottest_connections < 2)
+    {
+        return;
+    }
+
+    H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Thread %u is %u/1000 busy, asking it to migrate a connection to thread %u (%u/1000 busy)",
+            hottest->thread_id, hottest_busy, coldest->thread_id, coldest_busy);
+
+    h2x_thread_request_migration(hottest, coldest);
+}
+
 struct h2x_connection* h2x_connection_manager_add_client_connection(struct h2x_connection_manager* manager, char* address_string, int port)
 {
     struct sockaddr_in dest_addr;
@@ -220,5 +496,5 @@ struct h2x_connection* h2x_connection_manager_add_client_connection(struct h2x_c
         return NULL;
     }
 
-    return h2x_connection_manager_add_connection(manager, socket_fd);
+    return h2x_connection_manager_add_connection(manager, socket_fd, NULL);
 }
@@ -2,10 +2,13 @@
 #ifndef H2X_CONNECTION_MANAGER_H
 #define H2X_CONNECTION_MANAGER_H
 
+#include <h2x_cpu_affinity.h>
+
 #include <pthread.h>
 #include <stdint.h>
 
 struct h2x_connection;
+struct h2x_thread;
 struct h2x_thread_node;
 struct h2x_options;
 
@@ -17,15 +20,27 @@ struct h2x_connection_manager {
     struct h2x_connection* finished_connections;
     uint32_t next_thread_id;
 
-    uint32_t *connection_counts;
+    struct h2x_thread** thread_array;   // processing threads indexed by thread id, for random placement
+    uint32_t thread_count;
+    uint32_t placement_seed;
+
+    // with --numa, the same threads grouped by the node they're pinned to; node_count is 0 otherwise
+    uint32_t node_count;
+    struct h2x_thread*** node_threads;
+    uint32_t* node_thread_counts;
+    struct h2x_cpu_plan cpu_plan;       // kept for looking up the node of a connection's incoming cpu
+
+    uint64_t last_balance_check_ns;
 };
 
 int h2x_connection_manager_init(struct h2x_options *options, struct h2x_connection_manager* connection_manager);
 int h2x_connection_manager_cleanup(struct h2x_connection_manager* connection_manager);
 
-struct h2x_connection* h2x_connection_manager_add_connection(struct h2x_connection_manager* connection_manager, int fd);
+struct h2x_connection* h2x_connection_manager_add_connection(struct h2x_connection_manager* connection_manager, int fd, void (*on_connection_created)(struct h2x_connection*));
+int h2x_connection_manager_add_reuseport_listeners(struct h2x_connection_manager* connection_manager, void (*on_connection_accepted)(struct h2x_connection*));
 struct h2x_connection* h2x_connection_manager_add_client_connection(struct h2x_connection_manager* connection_manager, char* address_string, int port);
 
 void h2x_connection_manager_pump_closed_connections(struct h2x_connection_manager* manager);
+void h2x_connection_manager_balance_load(struct h2x_connection_manager* manager);
 
 #endif // H2X_CONNECTION_MANAGER_H
@@ -0,0 +1,167 @@
+#define _GNU_SOURCE
+
+#include <h2x_cpu_affinity.h>
+
+#include <h2x_log.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int h2x_get_cpu_node(int cpu)
+{
+    char path[64];
+    sprintf(path, "/sys/devices/system/cpu/cpu%d", cpu);
+
+    DIR* cpu_dir = opendir(path);
+    if(cpu_dir == NULL)
+    {
+        return 0;
+    }
+
+    int node = 0;
+    struct dirent* entry = NULL;
+    while((entry = readdir(cpu_dir)) != NULL)
+    {
+        if(strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9')
+        {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+
+    closedir(cpu_dir);
+
+    return node;
+}
+
+int h2x_cpu_plan_get_cpu_node(struct h2x_cpu_plan* plan, int cpu)
+{
+    if(cpu >= 0 && (uint32_t) cpu < plan->cpu_node_count)
+    {
+        return plan->cpu_nodes[cpu];
+    }
+
+    return h2x_get_cpu_node(cpu);
+}
+
+int h2x_cpu_plan_init(struct h2x_cpu_plan* plan, bool spread_across_nodes)
+{
+    plan->cpu_count = 0;
+    plan->cpus = NULL;
+    plan->nodes = NULL;
+    plan->cpu_node_count = 0;
+    plan->cpu_nodes = NULL;
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if(sched_getaffinity(0, sizeof(cpu_set_t), &allowed))
+    {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Unable to read process cpu affinity, errno = %d", (int) errno);
+        return -1;
+    }
+
+    uint32_t allowed_count = CPU_COUNT(&allowed);
+    if(allowed_count == 0)
+    {
+        return -1;
+    }
+
+    // sysfs is only scanned here, so placing a connection by node is a lookup
+    long configured_count = sysconf(_SC_NPROCESSORS_CONF);
+    plan->cpu_node_count = configured_count > 0 ? (uint32_t) configured_count : 0;
+    plan->cpu_nodes = calloc(plan->cpu_node_count, sizeof(int));
+    for(uint32_t cpu = 0; cpu < plan->cpu_node_count; ++cpu)
+    {
+        plan->cpu_nodes[cpu] = h2x_get_cpu_node(cpu);
+    }
+
+    int* cpus = calloc(allowed_count, sizeof(int));
+    int* nodes = calloc(allowed_count, sizeof(int));
+    int max_node = 0;
+    for(int cpu = 0; cpu < CPU_SETSIZE && plan->cpu_count < allowed_count; ++cpu)
+    {
+        if(CPU_ISSET(cpu, &allowed))
+        {
+            cpus[plan->cpu_count] = cpu;
+            nodes[plan->cpu_count] = h2x_cpu_plan_get_cpu_node(plan, cpu);
+            if(nodes[plan->cpu_count] > max_node)
+            {
+                max_node = nodes[plan->cpu_count];
+            }
+            ++plan->cpu_count;
+        }
+    }
+
+    plan->cpus = malloc(plan->cpu_count * sizeof(int));
+    plan->nodes = malloc(plan->cpu_count * sizeof(int));
+
+    if(!spread_across_nodes || max_node == 0)
+    {
+        memcpy(plan->cpus, cpus, plan->cpu_count * sizeof(int));
+        memcpy(plan->nodes, nodes, plan->cpu_count * sizeof(int));
+    }
+    else
+    {
+        // round robin over the nodes, taking each node's cores in ascending order
+        uint32_t assigned = 0;
+        bool* taken = calloc(plan->cpu_count, sizeof(bool));
+        while(assigned < plan->cpu_count)
+        {
+            for(int node = 0; node <= max_node; ++node)
+            {
+                for(uint32_t i = 0; i < plan->cpu_count; ++i)
+                {
+                    if(!taken[i] && nodes[i] == node)
+                    {
+                        taken[i] = true;
+                        plan->cpus[assigned] = cpus[i];
+                        plan->nodes[assigned] = nodes[i];
+                        ++assigned;
+                        break;
+                    }
+                }
+            }
+        }
+
+        free(taken);
+    }
+
+    free(cpus);
+    free(nodes);
+
+    return 0;
+}
+
+void h2x_cpu_plan_cleanup(struct h2x_cpu_plan* plan)
+{
+    free(plan->cpus);
+    free(plan->nodes);
+    free(plan->cpu_nodes);
+    plan->cpus = NULL;
+    plan->nodes = NULL;
+    plan->cpu_nodes = NULL;
+    plan->cpu_count = 0;
+    plan->cpu_node_count = 0;
+}
+
+/*
+ * More threads than cores wrap around, doubling up in the same order
+ */
+void h2x_cpu_plan_get_thread_cpu(struct h2x_cpu_plan* plan, uint32_t thread_id, int* cpu, int* node)
+{
+    if(plan->cpu_count == 0)
+    {
+        *cpu = -1;
+        *node = -1;
+        return;
+    }
+
+    uint32_t index = thread_id % plan->cpu_count;
+    *cpu = plan->cpus[index];
+    *node = plan->nodes[index];
+}
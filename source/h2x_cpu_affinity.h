@@ -0,0 +1,33 @@
+#ifndef H2X_CPU_AFFINITY_H
+#define H2X_CPU_AFFINITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Works out which core each processing thread is pinned to.  Cores come from the process's own
+ * affinity mask (so taskset and cgroup limits are respected); with NUMA spreading they're interleaved
+ * across nodes so consecutive threads land on different nodes.  Node membership is read from sysfs,
+ * which avoids a libnuma dependency.
+ */
+struct h2x_cpu_plan {
+    uint32_t cpu_count;
+    int* cpus;      // in assignment order
+    int* nodes;     // node of the matching cpu
+
+    // node of every configured cpu, allowed or not, indexed by cpu id; the NIC may interrupt any of them
+    uint32_t cpu_node_count;
+    int* cpu_nodes;
+};
+
+int h2x_cpu_plan_init(struct h2x_cpu_plan* plan, bool spread_across_nodes);
+void h2x_cpu_plan_cleanup(struct h2x_cpu_plan* plan);
+
+void h2x_cpu_plan_get_thread_cpu(struct h2x_cpu_plan* plan, uint32_t thread_id, int* cpu, int* node);
+
+// falls back to sysfs for a cpu the plan didn't see
+int h2x_cpu_plan_get_cpu_node(struct h2x_cpu_plan* plan, int cpu);
+
+int h2x_get_cpu_node(int cpu);
+
+#endif // H2X_CPU_AFFINITY_H
@@ -13,6 +13,16 @@ typedef enum {
     H2X_SECURITY_TLS
 } h2x_security_protocol_type;
 
+typedef enum {
+    H2X_IO_EPOLL,
+    H2X_IO_URING
+} h2x_io_mode;
+
+typedef enum {
+    H2X_LISTENER_SHARED,
+    H2X_LISTENER_REUSEPORT
+} h2x_listener_mode;
+
 typedef enum {
     H2X_RFS_NOT_ON_FRAME,
     H2X_RFS_ON_HEADER,
@@ -38,7 +48,11 @@ typedef enum {
 typedef enum {
     H2X_NO_ERROR = 0x00,
     H2X_PROTOCOL_ERROR = 0x01,
-    H2X_STREAM_CLOSED = 0x05
+    H2X_FLOW_CONTROL_ERROR = 0x03,
+    H2X_STREAM_CLOSED = 0x05,
+    H2X_FRAME_SIZE_ERROR = 0x06,
+    H2X_REFUSED_STREAM = 0x07,
+    H2X_COMPRESSION_ERROR = 0x09
 } h2x_connection_error;
 
 typedef enum {
@@ -55,6 +69,16 @@ typedef enum {
 } h2x_frame_type;
 
 typedef enum {
+    H2X_SETTINGS_HEADER_TABLE_SIZE = 0x01,
+    H2X_SETTINGS_ENABLE_PUSH = 0x02,
+    H2X_SETTINGS_MAX_CONCURRENT_STREAMS = 0x03,
+    H2X_SETTINGS_INITIAL_WINDOW_SIZE = 0x04,
+    H2X_SETTINGS_MAX_FRAME_SIZE = 0x05,
+    H2X_SETTINGS_MAX_HEADER_LIST_SIZE = 0x06
+} h2x_settings_id;
+
+typedef enum {
+    H2X_ACK = 0x01,
     H2X_END_STREAM = 0x01,
     H2X_END_HEADERS = 0x04,
     H2X_PADDED = 0x08,
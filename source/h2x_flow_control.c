@@ -0,0 +1,73 @@
+#include <h2x_flow_control.h>
+
+#define NANOSECONDS_PER_MICROSECOND 1000ULL
+
+bool h2x_send_window_increase(int64_t* window, uint32_t increment)
+{
+    if(*window + increment > H2X_MAX_WINDOW_SIZE)
+    {
+        return false;
+    }
+
+    *window += increment;
+
+    return true;
+}
+
+void h2x_receive_window_init(struct h2x_receive_window* window, uint32_t initial_size)
+{
+    window->available = initial_size;
+    window->target_size = initial_size;
+    window->consumed = 0;
+    window->last_update_ns = 0;
+}
+
+void h2x_receive_window_adjust(struct h2x_receive_window* window, int64_t delta)
+{
+    window->available += delta;
+
+    int64_t target_size = (int64_t) window->target_size + delta;
+    window->target_size = target_size > 0 ? (uint32_t) target_size : 0;
+}
+
+bool h2x_receive_window_consume(struct h2x_receive_window* window, uint32_t length)
+{
+    if(length > window->available)
+    {
+        return false;
+    }
+
+    window->available -= length;
+
+    return true;
+}
+
+bool h2x_receive_window_release(struct h2x_receive_window* window, uint32_t length)
+{
+    window->consumed += length;
+
+    return window->consumed >= window->target_size / 2;
+}
+
+uint32_t h2x_receive_window_take_update(struct h2x_receive_window* window, uint32_t max_size, uint32_t rtt_us, uint64_t now_ns)
+{
+    bool is_window_limited = rtt_us > 0 && window->last_update_ns > 0 &&
+                             now_ns - window->last_update_ns < 2 * rtt_us * NANOSECONDS_PER_MICROSECOND;
+    if(is_window_limited && window->target_size < max_size)
+    {
+        uint64_t target_size = (uint64_t) window->target_size * 2;
+        window->target_size = target_size < max_size ? (uint32_t) target_size : max_size;
+    }
+
+    uint32_t increment = 0;
+    if(window->available < window->target_size)
+    {
+        increment = (uint32_t) (window->target_size - window->available);
+        window->available = window->target_size;
+    }
+
+    window->consumed = 0;
+    window->last_update_ns = now_ns;
+
+    return increment;
+}
@@ -0,0 +1,59 @@
+#ifndef H2X_FLOW_CONTROL_H
+#define H2X_FLOW_CONTROL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// rfc7540 6.9.2: every window, connection or stream, in either direction, starts here
+#define H2X_DEFAULT_WINDOW_SIZE 65535
+#define H2X_MAX_WINDOW_SIZE 0x7FFFFFFF
+
+/*
+ * Send windows are signed: a SETTINGS_INITIAL_WINDOW_SIZE reduction can legitimately push one below
+ * zero.  Fails if the increment would take the window past H2X_MAX_WINDOW_SIZE.
+ */
+bool h2x_send_window_increase(int64_t* window, uint32_t increment);
+
+/*
+ * Our side of the flow control for the connection or one stream: how much more the peer may send,
+ * and how much it has sent that we've processed but not yet handed back as credit.
+ *
+ * Credit goes back in batches, once half of the window has been used, rather than one WINDOW_UPDATE
+ * per DATA frame.  Each batch tops the window back up to target_size.
+ *
+ * The target is auto-tuned against the bandwidth-delay product.  If a batch is due less than two
+ * round trips after the last one, the peer is using up the whole window in under a round trip.  That
+ * means the window rather than the link is limiting it, so the target doubles, up to a configured
+ * maximum.
+ */
+struct h2x_receive_window {
+    int64_t available;          // what the peer may still send before it has to wait for credit
+    uint32_t target_size;
+    uint32_t consumed;          // processed but not yet returned to the peer
+    uint64_t last_update_ns;    // when credit last went back; 0 before the first time
+};
+
+void h2x_receive_window_init(struct h2x_receive_window* window, uint32_t initial_size);
+
+/*
+ * Moves the window by the difference when our SETTINGS_INITIAL_WINDOW_SIZE changes (rfc7540 6.9.2)
+ */
+void h2x_receive_window_adjust(struct h2x_receive_window* window, int64_t delta);
+
+/*
+ * Accounts for a DATA frame's payload on arrival; fails if the peer sent more than the window allowed
+ */
+bool h2x_receive_window_consume(struct h2x_receive_window* window, uint32_t length);
+
+/*
+ * Marks length received bytes as processed; true once enough has built up that credit is due
+ */
+bool h2x_receive_window_release(struct h2x_receive_window* window, uint32_t length);
+
+/*
+ * Takes the credit that's due, retuning the target first, and returns the WINDOW_UPDATE increment to
+ * send.  rtt_us is 0 when there's no round trip estimate, which leaves the target alone.
+ */
+uint32_t h2x_receive_window_take_update(struct h2x_receive_window* window, uint32_t max_size, uint32_t rtt_us, uint64_t now_ns);
+
+#endif // H2X_FLOW_CONTROL_H
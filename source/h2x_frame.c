@@ -7,8 +7,6 @@
 #include <stdlib.h>
 
 //see rfc7540 section 4.1
-static const uint8_t SHIFT_THREE_BYTES = 0x18;
-static const uint8_t SHIFT_TWO_BYTES = 0x10;
 static const uint8_t SHIFT_ONE_BYTE = 0x08;
 static const uint8_t SHIFT_SEVEN_BITS = 0x07;
 static const uint32_t STREAM_ID_MASK = 0x7FFFFFFF;
@@ -18,28 +16,72 @@ void h2x_frame_init(struct h2x_frame* frame)
 {
     frame->raw_data = NULL;
     frame->size = 0;
+    frame->capacity = 0;
+    frame->owns_data = true;
+    frame->pool_next = NULL;
+}
+
+struct h2x_frame* h2x_frame_new(uint32_t capacity)
+{
+    struct h2x_frame* frame = (struct h2x_frame*)malloc(sizeof(struct h2x_frame) + capacity);
+
+    frame->raw_data = (uint8_t*)(frame + 1);
+    frame->size = capacity;
+    frame->capacity = capacity;
+    frame->owns_data = false;
+    frame->pool_next = NULL;
+
+    return frame;
+}
+
+void h2x_frame_destroy(struct h2x_frame* frame)
+{
+    h2x_frame_cleanup(frame);
+    free(frame);
+}
+
+void h2x_frame_init_view(struct h2x_frame* frame, uint8_t* raw_data, uint32_t size)
+{
+    assert(size >= FRAME_HEADER_LENGTH);
+
+    frame->raw_data = raw_data;
+    frame->size = size;
+    frame->capacity = size;
+    frame->owns_data = false;
+    frame->pool_next = NULL;
 }
 
 void h2x_frame_cleanup(struct h2x_frame* frame)
 {
-    free(frame->raw_data);
+    if(frame->owns_data)
+    {
+        free(frame->raw_data);
+    }
+
+    frame->raw_data = NULL;
     frame->size = 0;
 }
 
-uint32_t h2x_frame_get_length(struct h2x_frame* frame)
+uint32_t h2x_frame_header_get_length(uint8_t* frame_header)
 {
     uint32_t frame_length = 0;
-    assert(frame->size >= FRAME_HEADER_LENGTH);
 
-    frame_length |= frame->raw_data[0];
-    frame_length <<= SHIFT_TWO_BYTES;
-    frame_length |= frame->raw_data[1];
+    frame_length |= frame_header[0];
     frame_length <<= SHIFT_ONE_BYTE;
-    frame_length |= frame->raw_data[2];
+    frame_length |= frame_header[1];
+    frame_length <<= SHIFT_ONE_BYTE;
+    frame_length |= frame_header[2];
 
     return frame_length;
 }
 
+uint32_t h2x_frame_get_length(struct h2x_frame* frame)
+{
+    assert(frame->size >= FRAME_HEADER_LENGTH);
+
+    return h2x_frame_header_get_length(frame->raw_data);
+}
+
 void h2x_frame_set_length(struct h2x_frame* frame, uint32_t length)
 {
     assert(frame->size >= FRAME_HEADER_LENGTH);
@@ -71,9 +113,9 @@ uint32_t h2x_frame_get_stream_identifier(struct h2x_frame* frame)
     assert(frame->size >= FRAME_HEADER_LENGTH);
 
     stream_id |= frame->raw_data[5];
-    stream_id <<= SHIFT_THREE_BYTES;
+    stream_id <<= SHIFT_ONE_BYTE;
     stream_id |= frame->raw_data[6];
-    stream_id <<= SHIFT_TWO_BYTES;
+    stream_id <<= SHIFT_ONE_BYTE;
     stream_id |= frame->raw_data[7];
     stream_id <<= SHIFT_ONE_BYTE;
     stream_id |= frame->raw_data[8];
@@ -139,7 +181,7 @@ void h2x_frame_list_clean(struct h2x_frame_list* list)
     {
         struct h2x_frame_list_node* to_free = cur;
         cur = cur->next;
-        free(to_free->frame);
+        h2x_frame_destroy(to_free->frame);
         free(to_free);
     }
 
@@ -4,23 +4,48 @@
 
 #include <h2x_enum_types.h>
 
+#include <stdbool.h>
 #include <stdint.h>
 
-static const uint8_t FRAME_HEADER_LENGTH = 9;
+//per rfc7540 section 4.1; the define is for sizing arrays
+#define H2X_FRAME_HEADER_LENGTH 9
+static const uint8_t FRAME_HEADER_LENGTH = H2X_FRAME_HEADER_LENGTH;
+
+//per rfc7540 section 4.2
+#define MAX_RECV_FRAME_SIZE 0x4000
+
+//per rfc7540 section 6.5.1, a 16 bit identifier and a 32 bit value
+#define SETTINGS_ENTRY_LENGTH 6
 
 struct h2x_frame
 {
     uint8_t* raw_data;
     uint32_t size;
+    uint32_t capacity;
+    bool owns_data;     // false for views that point into someone else's buffer (ie a socket read buffer)
+
+    struct h2x_frame* pool_next;    // free list link while sitting in an h2x_frame_pool
 };
 
 
 void h2x_frame_init(struct h2x_frame* frame);
 
+/*
+ * Allocates a frame whose struct and raw data share a single block; release with h2x_frame_destroy
+ * (or hand it back to the h2x_frame_pool it came from)
+ */
+struct h2x_frame* h2x_frame_new(uint32_t capacity);
+
+void h2x_frame_destroy(struct h2x_frame* frame);
+
+void h2x_frame_init_view(struct h2x_frame* frame, uint8_t* raw_data, uint32_t size);
+
 void h2x_frame_cleanup(struct h2x_frame* frame);
 
 uint32_t h2x_frame_get_length(struct h2x_frame* frame);
 
+uint32_t h2x_frame_header_get_length(uint8_t* frame_header);
+
 void h2x_frame_set_length(struct h2x_frame* frame, uint32_t length);
 
 uint8_t* h2x_frame_get_payload(struct h2x_frame* frame);
@@ -49,7 +74,7 @@ struct h2x_frame_list_node
 
 struct h2x_frame_list
 {
-    uint16_t frame_count;
+    uint32_t frame_count;
     struct h2x_frame_list_node* head;
     struct h2x_frame_list_node* tail;
 };
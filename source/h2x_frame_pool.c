@@ -0,0 +1,118 @@
+
+#include <h2x_frame_pool.h>
+
+#include <h2x_frame.h>
+#include <h2x_log.h>
+
+#include <stdlib.h>
+
+// control frames (settings, ping, rst_stream, window_update, goaway) all fit comfortably in 64 bytes
+#define CONTROL_FRAME_CAPACITY 64
+#define SMALL_FRAME_CAPACITY 2048
+
+static void init_pool_class(struct h2x_frame_pool_class* pool_class, uint32_t capacity, uint32_t max_free_count)
+{
+    pool_class->capacity = capacity;
+    pool_class->max_free_count = max_free_count;
+    pool_class->free_count = 0;
+    pool_class->free_frames = NULL;
+    pool_class->hits = 0;
+    pool_class->misses = 0;
+}
+
+void h2x_frame_pool_init(struct h2x_frame_pool* pool)
+{
+    init_pool_class(&pool->classes[H2X_FPC_CONTROL], CONTROL_FRAME_CAPACITY, 256);
+    init_pool_class(&pool->classes[H2X_FPC_SMALL], SMALL_FRAME_CAPACITY, 128);
+    init_pool_class(&pool->classes[H2X_FPC_FULL], MAX_RECV_FRAME_SIZE + FRAME_HEADER_LENGTH, 32);
+    pool->oversized_allocations = 0;
+}
+
+void h2x_frame_pool_cleanup(struct h2x_frame_pool* pool)
+{
+    for(uint32_t i = 0; i < H2X_FPC_COUNT; ++i)
+    {
+        struct h2x_frame_pool_class* pool_class = &pool->classes[i];
+        struct h2x_frame* frame = pool_class->free_frames;
+        while(frame)
+        {
+            struct h2x_frame* next_frame = frame->pool_next;
+            h2x_frame_destroy(frame);
+            frame = next_frame;
+        }
+
+        pool_class->free_frames = NULL;
+        pool_class->free_count = 0;
+    }
+}
+
+static struct h2x_frame_pool_class* find_pool_class(struct h2x_frame_pool* pool, uint32_t size)
+{
+    for(uint32_t i = 0; i < H2X_FPC_COUNT; ++i)
+    {
+        if(size <= pool->classes[i].capacity)
+        {
+            return &pool->classes[i];
+        }
+    }
+
+    return NULL;
+}
+
+struct h2x_frame* h2x_frame_pool_acquire(struct h2x_frame_pool* pool, uint32_t size)
+{
+    struct h2x_frame_pool_class* pool_class = find_pool_class(pool, size);
+    struct h2x_frame* frame = NULL;
+
+    if(pool_class == NULL)
+    {
+        ++pool->oversized_allocations;
+        frame = h2x_frame_new(size);
+    }
+    else if(pool_class->free_frames)
+    {
+        ++pool_class->hits;
+        frame = pool_class->free_frames;
+        pool_class->free_frames = frame->pool_next;
+        --pool_class->free_count;
+        frame->pool_next = NULL;
+    }
+    else
+    {
+        ++pool_class->misses;
+        frame = h2x_frame_new(pool_class->capacity);
+    }
+
+    frame->size = size;
+
+    return frame;
+}
+
+void h2x_frame_pool_release(struct h2x_frame_pool* pool, struct h2x_frame* frame)
+{
+    struct h2x_frame_pool_class* pool_class = find_pool_class(pool, frame->capacity);
+
+    // only recycle frames whose capacity exactly matches a class; anything else is an oversized one-off
+    if(pool_class == NULL || pool_class->capacity != frame->capacity || pool_class->free_count >= pool_class->max_free_count)
+    {
+        h2x_frame_destroy(frame);
+        return;
+    }
+
+    frame->size = frame->capacity;
+    frame->pool_next = pool_class->free_frames;
+    pool_class->free_frames = frame;
+    ++pool_class->free_count;
+}
+
+void h2x_frame_pool_log_stats(struct h2x_frame_pool* pool, uint32_t thread_id)
+{
+    for(uint32_t i = 0; i < H2X_FPC_COUNT; ++i)
+    {
+        struct h2x_frame_pool_class* pool_class = &pool->classes[i];
+        H2X_LOG(H2X_LOG_LEVEL_INFO, "Thread %u frame pool class %u (capacity %u) - hits:%llu, misses:%llu, free:%u", thread_id, i,
+                pool_class->capacity, (unsigned long long) pool_class->hits, (unsigned long long) pool_class->misses, pool_class->free_count);
+    }
+
+    H2X_LOG(H2X_LOG_LEVEL_INFO, "Thread %u frame pool oversized allocations: %llu", thread_id, (unsigned long long) pool->oversized_allocations);
+}
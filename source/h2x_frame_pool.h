@@ -0,0 +1,48 @@
+
+#ifndef H2X_FRAME_POOL_H
+#define H2X_FRAME_POOL_H
+
+#include <stdint.h>
+
+struct h2x_frame;
+
+/*
+ * Frames are recycled through a small set of size classes.  Each class keeps a free list
+ * of frames whose struct and raw data live in a single allocation.  Requests larger than the
+ * biggest class are satisfied (and later destroyed) directly from the heap.
+ */
+typedef enum {
+    H2X_FPC_CONTROL,
+    H2X_FPC_SMALL,
+    H2X_FPC_FULL,
+    H2X_FPC_COUNT
+} h2x_frame_pool_class_type;
+
+struct h2x_frame_pool_class {
+    uint32_t capacity;
+    uint32_t max_free_count;
+    uint32_t free_count;
+    struct h2x_frame* free_frames;
+
+    uint64_t hits;
+    uint64_t misses;
+};
+
+/*
+ * Not thread-safe; each processing thread owns one and all frames for that thread's connections
+ * are acquired and released through it.
+ */
+struct h2x_frame_pool {
+    struct h2x_frame_pool_class classes[H2X_FPC_COUNT];
+    uint64_t oversized_allocations;
+};
+
+void h2x_frame_pool_init(struct h2x_frame_pool* pool);
+void h2x_frame_pool_cleanup(struct h2x_frame_pool* pool);
+
+struct h2x_frame* h2x_frame_pool_acquire(struct h2x_frame_pool* pool, uint32_t size);
+void h2x_frame_pool_release(struct h2x_frame_pool* pool, struct h2x_frame* frame);
+
+void h2x_frame_pool_log_stats(struct h2x_frame_pool* pool, uint32_t thread_id);
+
+#endif // H2X_FRAME_POOL_H
@@ -3,111 +3,290 @@
 #include <assert.h>
 #include <stdlib.h>
 
-void h2x_hash_table_init(struct h2x_hash_table* hash_table, uint32_t buckets, uint32_t (*hash_function)(void*))
+#define HASH_TABLE_MIN_CAPACITY 8
+#define HASH_TABLE_DRAIN_STEP 8     // draining slots moved per add or remove
+
+static void slots_init(struct h2x_hash_slots* slots, uint32_t capacity)
 {
-    assert(buckets > 0);
+    uint32_t log2_capacity = 0;
+    while((1U << log2_capacity) < capacity)
+    {
+        ++log2_capacity;
+    }
 
-    hash_table->bucket_count = buckets;
-    hash_table->hash_function = hash_function;
-    hash_table->buckets = calloc(buckets, sizeof(struct h2x_hash_entry*));
+    slots->capacity = 1U << log2_capacity;
+    slots->shift = 32 - log2_capacity;
+    slots->slots = calloc(slots->capacity, sizeof(struct h2x_hash_slot));
+    slots->count = 0;
+    slots->max_distance = 0;
 }
 
-static uint32_t hash_key_to_bucket(struct h2x_hash_table* table, uint32_t key)
+static void slots_reset(struct h2x_hash_slots* slots)
 {
-    return key % table->bucket_count;
+    slots->slots = NULL;
+    slots->capacity = 0;
+    slots->shift = 32;
+    slots->count = 0;
+    slots->max_distance = 0;
 }
 
-bool h2x_hash_table_add(struct h2x_hash_table* table, void* data)
+static void slots_clear(struct h2x_hash_slots* slots)
+{
+    free(slots->slots);
+    slots_reset(slots);
+}
+
+/*
+ * Keys are often sequential (fds, stream ids of one parity), so they're spread with a Fibonacci
+ * multiply and the top bits taken, rather than masked directly
+ */
+static inline uint32_t home_slot(struct h2x_hash_slots* slots, uint32_t key)
+{
+    return (key * 2654435769U) >> slots->shift;
+}
+
+static void slots_insert(struct h2x_hash_slots* slots, uint32_t key, void* data)
 {
-    uint32_t hash_key = (table->hash_function)(data);
-    uint32_t bucket = hash_key_to_bucket(table, hash_key);
+    uint32_t mask = slots->capacity - 1;
+    uint32_t index = home_slot(slots, key);
+    struct h2x_hash_slot incoming = { data, key, 0 };
 
-    struct h2x_hash_entry** entry_ptr = &table->buckets[bucket];
-    while(*entry_ptr != NULL)
+    while(true)
     {
-        uint32_t existing_hash_key = (table->hash_function)((*entry_ptr)->data);
-        if(existing_hash_key == hash_key)
+        struct h2x_hash_slot* slot = &slots->slots[index];
+        if(slot->data == NULL || slot->distance < incoming.distance)
         {
-            return false;   // keys should be unique
+            if(incoming.distance > slots->max_distance)
+            {
+                slots->max_distance = incoming.distance;
+            }
+
+            struct h2x_hash_slot displaced = *slot;
+            *slot = incoming;
+            if(displaced.data == NULL)
+            {
+                break;
+            }
+
+            // the poorer entry keeps the slot and the richer one carries on looking
+            incoming = displaced;
         }
 
-        entry_ptr = &((*entry_ptr)->next);
+        index = (index + 1) & mask;
+        ++incoming.distance;
     }
 
-    *entry_ptr = malloc(sizeof(struct h2x_hash_entry));
-    (*entry_ptr)->data = data;
-    (*entry_ptr)->next = NULL;
+    ++slots->count;
+}
 
-    return true;
+/*
+ * Robin Hood order means the key can't be any further along once the probe passes an entry that's
+ * closer to home than the key would be
+ */
+static struct h2x_hash_slot* slots_find(struct h2x_hash_slots* slots, uint32_t key)
+{
+    if(slots->count == 0)
+    {
+        return NULL;
+    }
+
+    uint32_t mask = slots->capacity - 1;
+    uint32_t index = home_slot(slots, key);
+    for(uint32_t distance = 0; ; ++distance)
+    {
+        struct h2x_hash_slot* slot = &slots->slots[index];
+        if(slot->data == NULL || slot->distance < distance)
+        {
+            return NULL;
+        }
+
+        if(slot->key == key)
+        {
+            return slot;
+        }
+
+        index = (index + 1) & mask;
+    }
 }
 
-bool h2x_hash_table_remove(struct h2x_hash_table* table, uint32_t key)
+static void slots_remove(struct h2x_hash_slots* slots, struct h2x_hash_slot* slot)
 {
-    uint32_t bucket = hash_key_to_bucket(table, key);
-    struct h2x_hash_entry** entry_ptr = &table->buckets[bucket];
-    while(*entry_ptr != NULL)
+    uint32_t mask = slots->capacity - 1;
+    uint32_t index = (uint32_t) (slot - slots->slots);
+
+    while(true)
     {
-        uint32_t existing_hash_key = (table->hash_function)((*entry_ptr)->data);
-        if(existing_hash_key == key)
+        uint32_t next_index = (index + 1) & mask;
+        struct h2x_hash_slot* next_slot = &slots->slots[next_index];
+        if(next_slot->data == NULL || next_slot->distance == 0)
         {
-            struct h2x_hash_entry* remove = *entry_ptr;
-            *entry_ptr = (*entry_ptr)->next;
-            free(remove);
-            return true;
+            slots->slots[index].data = NULL;
+            break;
         }
 
-        entry_ptr = &((*entry_ptr)->next);
+        slots->slots[index] = *next_slot;
+        --slots->slots[index].distance;
+        index = next_index;
     }
 
-    return false;
+    --slots->count;
 }
 
-void* h2x_hash_table_find(struct h2x_hash_table* table, uint32_t key)
+/*
+ * A draining table has holes where entries have already moved out, so the early exits above don't
+ * hold; instead every slot an entry could have probed to is checked
+ */
+static struct h2x_hash_slot* draining_find(struct h2x_hash_slots* slots, uint32_t key)
 {
-    uint32_t bucket = hash_key_to_bucket(table, key);
-    struct h2x_hash_entry* entry_ptr = table->buckets[bucket];
-    while(entry_ptr != NULL)
+    if(slots->count == 0)
+    {
+        return NULL;
+    }
+
+    uint32_t mask = slots->capacity - 1;
+    uint32_t index = home_slot(slots, key);
+    for(uint32_t distance = 0; distance <= slots->max_distance; ++distance)
     {
-        uint32_t existing_hash_key = (table->hash_function)(entry_ptr->data);
-        if(existing_hash_key == key)
+        struct h2x_hash_slot* slot = &slots->slots[index];
+        if(slot->data != NULL && slot->key == key)
         {
-            return entry_ptr->data;
+            return slot;
         }
 
-        entry_ptr = entry_ptr->next;
+        index = (index + 1) & mask;
     }
 
     return NULL;
 }
 
-static void free_bucket(struct h2x_hash_entry* entry)
+static void drain(struct h2x_hash_table* table, uint32_t steps)
 {
-    while(entry)
+    struct h2x_hash_slots* draining = &table->draining;
+    while(draining->count > 0 && steps-- > 0)
     {
-        struct h2x_hash_entry* next_entry = entry->next;
-        free(entry);
-        entry = next_entry;
+        struct h2x_hash_slot* slot = &draining->slots[table->drain_position++];
+        if(slot->data != NULL)
+        {
+            slots_insert(&table->current, slot->key, slot->data);
+            slot->data = NULL;
+            --draining->count;
+        }
+    }
+
+    if(draining->slots != NULL && draining->count == 0)
+    {
+        slots_clear(draining);
+        table->drain_position = 0;
     }
 }
 
+static void grow(struct h2x_hash_table* table)
+{
+    // a resize can't start until the last one has finished
+    drain(table, UINT32_MAX);
+
+    table->draining = table->current;
+    table->drain_position = 0;
+    slots_init(&table->current, table->current.capacity * 2);
+}
+
+void h2x_hash_table_init(struct h2x_hash_table* hash_table, uint32_t initial_capacity, uint32_t (*hash_function)(void*))
+{
+    // leave room to reach the initial capacity without a resize
+    uint64_t capacity = (uint64_t) initial_capacity * 4 / 3 + 1;
+    if(capacity < HASH_TABLE_MIN_CAPACITY)
+    {
+        capacity = HASH_TABLE_MIN_CAPACITY;
+    }
+
+    slots_init(&hash_table->current, (uint32_t) capacity);
+    slots_reset(&hash_table->draining);
+    hash_table->drain_position = 0;
+    hash_table->hash_function = hash_function;
+}
+
 void h2x_hash_table_cleanup(struct h2x_hash_table *table)
 {
-    for(uint32_t i = 0; i < table->bucket_count; ++i)
+    slots_clear(&table->current);
+    slots_clear(&table->draining);
+    table->drain_position = 0;
+}
+
+bool h2x_hash_table_add(struct h2x_hash_table* table, void* data)
+{
+    assert(data != NULL);
+
+    uint32_t key = (table->hash_function)(data);
+    if(h2x_hash_table_find(table, key) != NULL)
+    {
+        return false;   // keys should be unique
+    }
+
+    drain(table, HASH_TABLE_DRAIN_STEP);
+
+    uint64_t count = (uint64_t) table->current.count + table->draining.count + 1;
+    if(count * 4 > (uint64_t) table->current.capacity * 3)
+    {
+        grow(table);
+    }
+
+    slots_insert(&table->current, key, data);
+
+    return true;
+}
+
+bool h2x_hash_table_remove(struct h2x_hash_table* table, uint32_t key)
+{
+    struct h2x_hash_slot* slot = slots_find(&table->current, key);
+    if(slot != NULL)
     {
-        free_bucket(table->buckets[i]);
+        slots_remove(&table->current, slot);
     }
-    free(table->buckets);
+    else
+    {
+        slot = draining_find(&table->draining, key);
+        if(slot == NULL)
+        {
+            return false;
+        }
+
+        slot->data = NULL;
+        --table->draining.count;
+    }
+
+    drain(table, HASH_TABLE_DRAIN_STEP);
+
+    return true;
+}
+
+void* h2x_hash_table_find(struct h2x_hash_table* table, uint32_t key)
+{
+    struct h2x_hash_slot* slot = slots_find(&table->current, key);
+    if(slot == NULL)
+    {
+        slot = draining_find(&table->draining, key);
+    }
+
+    return slot ? slot->data : NULL;
+}
+
+uint32_t h2x_hash_table_get_count(struct h2x_hash_table* table)
+{
+    return table->current.count + table->draining.count;
 }
 
 void h2x_hash_table_visit(struct h2x_hash_table *table, void (*visit_function)(void*, void*), void* context)
 {
-    for(uint32_t i = 0; i < table->bucket_count; ++i)
+    struct h2x_hash_slots* tables[] = { &table->current, &table->draining };
+    for(uint32_t i = 0; i < 2; ++i)
     {
-        struct h2x_hash_entry* entry = table->buckets[i];
-        while(entry)
+        for(uint32_t j = 0; j < tables[i]->capacity; ++j)
         {
-            (*visit_function)(entry->data, context);
-            entry = entry->next;
+            void* data = tables[i]->slots[j].data;
+            if(data != NULL)
+            {
+                (*visit_function)(data, context);
+            }
         }
     }
 }
@@ -1,27 +1,55 @@
-
 #ifndef H2X_HASH_TABLE_H
 #define H2X_HASH_TABLE_H
 
 #include <stdbool.h>
 #include <stdint.h>
 
-struct h2x_hash_entry {
-    void* data;
-    struct h2x_hash_entry* next;
+/*
+ * Open-addressing table of pointers keyed by a 32-bit key that hash_function pulls out of the data.
+ * The key is stored next to the pointer when the data is added, so probes compare keys without
+ * touching the data.
+ *
+ * Entries are placed Robin Hood style (an entry that has probed further takes the slot from one that
+ * has probed less), which keeps probe sequences short and lets a lookup stop as soon as it meets an
+ * entry closer to its home slot than the key would be.  Removal shifts the rest of the run back a slot
+ * instead of leaving a tombstone.
+ *
+ * The table doubles when it gets three quarters full.  Rather than rehashing everything at once, the
+ * old slots are kept as a draining table and each add or remove moves a few of them across, so no
+ * single operation pays for the whole resize.
+ */
+struct h2x_hash_slot {
+    void* data;         // NULL when the slot is empty
+    uint32_t key;
+    uint32_t distance;  // how far the entry sits from its home slot
+};
+
+struct h2x_hash_slots {
+    struct h2x_hash_slot* slots;
+    uint32_t capacity;      // power of two
+    uint32_t shift;         // 32 - log2(capacity)
+    uint32_t count;
+    uint32_t max_distance;  // longest probe any entry has needed; bounds lookups in a draining table
 };
 
 struct h2x_hash_table {
-    struct h2x_hash_entry** buckets;
-    uint32_t bucket_count;
+    struct h2x_hash_slots current;
+    struct h2x_hash_slots draining;     // slots from before the last resize that haven't moved yet
+    uint32_t drain_position;
     uint32_t (*hash_function)(void*);
 };
 
-void h2x_hash_table_init(struct h2x_hash_table* hash_table, uint32_t buckets, uint32_t (*hash_function)(void*));
+void h2x_hash_table_init(struct h2x_hash_table* hash_table, uint32_t initial_capacity, uint32_t (*hash_function)(void*));
 void h2x_hash_table_cleanup(struct h2x_hash_table *table);
 
 bool h2x_hash_table_add(struct h2x_hash_table* table, void* data);
 bool h2x_hash_table_remove(struct h2x_hash_table* table, uint32_t key);
 void* h2x_hash_table_find(struct h2x_hash_table* table, uint32_t key);
+uint32_t h2x_hash_table_get_count(struct h2x_hash_table* table);
+
+/*
+ * The visit function must not add or remove entries
+ */
 void h2x_hash_table_visit(struct h2x_hash_table *table, void (*visit_function)(void *, void*), void* context);
 
 #endif // H2X_HASH_TABLE_H
@@ -0,0 +1,223 @@
+#include <h2x_header_validation.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define H2X_HEADER_VALIDATION_X86
+#include <immintrin.h>
+#endif
+
+static inline bool is_invalid_name_byte(uint8_t byte)
+{
+    return byte <= 0x20 || byte >= 0x7F || (byte >= 'A' && byte <= 'Z') || byte == ':';
+}
+
+static inline bool is_invalid_value_byte(uint8_t byte)
+{
+    return byte == 0 || byte == '\r' || byte == '\n';
+}
+
+static inline bool is_field_whitespace(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static bool has_invalid_name_byte_scalar(const uint8_t* bytes, uint32_t length)
+{
+    for(uint32_t i = 0; i < length; ++i)
+    {
+        if(is_invalid_name_byte(bytes[i]))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool has_invalid_value_byte_scalar(const uint8_t* bytes, uint32_t length)
+{
+    for(uint32_t i = 0; i < length; ++i)
+    {
+        if(is_invalid_value_byte(bytes[i]))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#ifdef H2X_HEADER_VALIDATION_X86
+
+/*
+ * The vector scans OR each chunk's failures into an accumulator and only look at it once the whole
+ * string is done; fields are almost always valid, so a branch per chunk would buy nothing.
+ *
+ * SSE2/AVX2 only have signed byte compares, which works in our favour for names: bytes 0x80-0xff are
+ * negative, so the one "less than 0x21" compare rejects them along with the controls and space.
+ */
+static bool has_invalid_name_byte_sse2(const uint8_t* bytes, uint32_t length)
+{
+    const __m128i below_printable = _mm_set1_epi8(0x21);
+    const __m128i delete = _mm_set1_epi8(0x7F);
+    const __m128i before_uppercase = _mm_set1_epi8('A' - 1);
+    const __m128i after_uppercase = _mm_set1_epi8('Z' + 1);
+    const __m128i colon = _mm_set1_epi8(':');
+
+    __m128i invalid = _mm_setzero_si128();
+    uint32_t i = 0;
+    for(; i + 16 <= length; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*) (bytes + i));
+        __m128i uppercase = _mm_and_si128(_mm_cmpgt_epi8(chunk, before_uppercase), _mm_cmplt_epi8(chunk, after_uppercase));
+
+        invalid = _mm_or_si128(invalid, _mm_cmplt_epi8(chunk, below_printable));
+        invalid = _mm_or_si128(invalid, _mm_cmpeq_epi8(chunk, delete));
+        invalid = _mm_or_si128(invalid, _mm_cmpeq_epi8(chunk, colon));
+        invalid = _mm_or_si128(invalid, uppercase);
+    }
+
+    return _mm_movemask_epi8(invalid) != 0 || has_invalid_name_byte_scalar(bytes + i, length - i);
+}
+
+static bool has_invalid_value_byte_sse2(const uint8_t* bytes, uint32_t length)
+{
+    const __m128i nul = _mm_setzero_si128();
+    const __m128i carriage_return = _mm_set1_epi8('\r');
+    const __m128i line_feed = _mm_set1_epi8('\n');
+
+    __m128i invalid = _mm_setzero_si128();
+    uint32_t i = 0;
+    for(; i + 16 <= length; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*) (bytes + i));
+
+        invalid = _mm_or_si128(invalid, _mm_cmpeq_epi8(chunk, nul));
+        invalid = _mm_or_si128(invalid, _mm_cmpeq_epi8(chunk, carriage_return));
+        invalid = _mm_or_si128(invalid, _mm_cmpeq_epi8(chunk, line_feed));
+    }
+
+    return _mm_movemask_epi8(invalid) != 0 || has_invalid_value_byte_scalar(bytes + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static bool has_invalid_name_byte_avx2(const uint8_t* bytes, uint32_t length)
+{
+    const __m256i below_printable = _mm256_set1_epi8(0x21);
+    const __m256i delete = _mm256_set1_epi8(0x7F);
+    const __m256i before_uppercase = _mm256_set1_epi8('A' - 1);
+    const __m256i after_uppercase = _mm256_set1_epi8('Z' + 1);
+    const __m256i colon = _mm256_set1_epi8(':');
+
+    __m256i invalid = _mm256_setzero_si256();
+    uint32_t i = 0;
+    for(; i + 32 <= length; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*) (bytes + i));
+        __m256i uppercase = _mm256_and_si256(_mm256_cmpgt_epi8(chunk, before_uppercase), _mm256_cmpgt_epi8(after_uppercase, chunk));
+
+        invalid = _mm256_or_si256(invalid, _mm256_cmpgt_epi8(below_printable, chunk));
+        invalid = _mm256_or_si256(invalid, _mm256_cmpeq_epi8(chunk, delete));
+        invalid = _mm256_or_si256(invalid, _mm256_cmpeq_epi8(chunk, colon));
+        invalid = _mm256_or_si256(invalid, uppercase);
+    }
+
+    return _mm256_movemask_epi8(invalid) != 0 || has_invalid_name_byte_sse2(bytes + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static bool has_invalid_value_byte_avx2(const uint8_t* bytes, uint32_t length)
+{
+    const __m256i nul = _mm256_setzero_si256();
+    const __m256i carriage_return = _mm256_set1_epi8('\r');
+    const __m256i line_feed = _mm256_set1_epi8('\n');
+
+    __m256i invalid = _mm256_setzero_si256();
+    uint32_t i = 0;
+    for(; i + 32 <= length; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*) (bytes + i));
+
+        invalid = _mm256_or_si256(invalid, _mm256_cmpeq_epi8(chunk, nul));
+        invalid = _mm256_or_si256(invalid, _mm256_cmpeq_epi8(chunk, carriage_return));
+        invalid = _mm256_or_si256(invalid, _mm256_cmpeq_epi8(chunk, line_feed));
+    }
+
+    return _mm256_movemask_epi8(invalid) != 0 || has_invalid_value_byte_sse2(bytes + i, length - i);
+}
+
+#endif // H2X_HEADER_VALIDATION_X86
+
+/*
+ * SSE2 is part of the x86-64 baseline; AVX2 is picked at runtime, and only for strings long enough to
+ * fill one of its registers
+ */
+static bool has_invalid_name_byte(const uint8_t* bytes, uint32_t length)
+{
+#ifdef H2X_HEADER_VALIDATION_X86
+    if(length >= 32 && __builtin_cpu_supports("avx2"))
+    {
+        return has_invalid_name_byte_avx2(bytes, length);
+    }
+
+    return has_invalid_name_byte_sse2(bytes, length);
+#else
+    return has_invalid_name_byte_scalar(bytes, length);
+#endif
+}
+
+static bool has_invalid_value_byte(const uint8_t* bytes, uint32_t length)
+{
+#ifdef H2X_HEADER_VALIDATION_X86
+    if(length >= 32 && __builtin_cpu_supports("avx2"))
+    {
+        return has_invalid_value_byte_avx2(bytes, length);
+    }
+
+    return has_invalid_value_byte_sse2(bytes, length);
+#else
+    return has_invalid_value_byte_scalar(bytes, length);
+#endif
+}
+
+bool h2x_header_name_is_valid(const char* name, uint32_t name_length)
+{
+    // a pseudo-header's leading colon is the only one allowed
+    if(name_length > 0 && name[0] == ':')
+    {
+        ++name;
+        --name_length;
+    }
+
+    return name_length > 0 && !has_invalid_name_byte((const uint8_t*) name, name_length);
+}
+
+bool h2x_header_value_is_valid(const char* value, uint32_t value_length)
+{
+    if(value_length > 0 && (is_field_whitespace(value[0]) || is_field_whitespace(value[value_length - 1])))
+    {
+        return false;
+    }
+
+    return !has_invalid_value_byte((const uint8_t*) value, value_length);
+}
+
+bool h2x_header_name_is_valid_scalar(const char* name, uint32_t name_length)
+{
+    if(name_length > 0 && name[0] == ':')
+    {
+        ++name;
+        --name_length;
+    }
+
+    return name_length > 0 && !has_invalid_name_byte_scalar((const uint8_t*) name, name_length);
+}
+
+bool h2x_header_value_is_valid_scalar(const char* value, uint32_t value_length)
+{
+    if(value_length > 0 && (is_field_whitespace(value[0]) || is_field_whitespace(value[value_length - 1])))
+    {
+        return false;
+    }
+
+    return !has_invalid_value_byte_scalar((const uint8_t*) value, value_length);
+}
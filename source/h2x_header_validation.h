@@ -0,0 +1,26 @@
+#ifndef H2X_HEADER_VALIDATION_H
+#define H2X_HEADER_VALIDATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Field checks from rfc9113 8.2.1.  A name must be non-empty and hold no controls, spaces, uppercase
+ * letters, DEL or bytes above 0x7f, and no colon past the one that starts a pseudo-header.  A value
+ * must hold no NUL, CR or LF and can't start or end with a space or tab.  A request or response
+ * carrying a field that fails either is malformed.
+ *
+ * Values like cookies and authorization tokens run to kilobytes, so the byte scans are done 16 bytes
+ * at a time with SSE2, or 32 at a time with AVX2 when the cpu has it.
+ */
+bool h2x_header_name_is_valid(const char* name, uint32_t name_length);
+bool h2x_header_value_is_valid(const char* value, uint32_t value_length);
+
+/*
+ * Byte-at-a-time versions of the same checks, used for the tails of the vectorized scans and as the
+ * reference they're measured against
+ */
+bool h2x_header_name_is_valid_scalar(const char* name, uint32_t name_length);
+bool h2x_header_value_is_valid_scalar(const char* value, uint32_t value_length);
+
+#endif // H2X_HEADER_VALIDATION_H
@@ -1,68 +1,219 @@
 
 #include <h2x_headers.h>
 #include <stddef.h>
-#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
 
-void h2x_header_init(struct h2x_header* header, char* name, char* value)
+#define HEADER_BLOCK_MIN_ARENA_CAPACITY 256
+
+// FNV-1a; names are short, so anything cheap with reasonable spread will do
+static uint32_t hash_header_name(const char* name, uint32_t name_length)
 {
-    header->name = name;
-    header->value = value;
+    uint32_t hash = 2166136261U;
+    for(uint32_t i = 0; i < name_length; ++i)
+    {
+        hash ^= (uint8_t) name[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
 }
 
-void h2x_header_cleanup(struct h2x_header* header)
+void h2x_header_block_init(struct h2x_header_block* block, uint32_t arena_capacity)
 {
-    free(header->name);
-    free(header->value);
+    if(arena_capacity < HEADER_BLOCK_MIN_ARENA_CAPACITY)
+    {
+        arena_capacity = HEADER_BLOCK_MIN_ARENA_CAPACITY;
+    }
+
+    block->arena = malloc(arena_capacity);
+    block->arena_size = 0;
+    block->arena_capacity = arena_capacity;
+
+    block->fields = block->inline_fields;
+    block->field_count = 0;
+    block->field_capacity = H2X_HEADER_BLOCK_INLINE_FIELDS;
+    memset(block->buckets, 0, sizeof(block->buckets));
 }
 
-void h2x_header_list_init(struct h2x_header_list* list)
+void h2x_header_block_cleanup(struct h2x_header_block* block)
 {
-    list->head = list->cur = list->tail = NULL;
+    free(block->arena);
+    block->arena = NULL;
+
+    if(block->fields != block->inline_fields)
+    {
+        free(block->fields);
+    }
+    block->fields = block->inline_fields;
+    block->field_count = 0;
 }
 
-void h2x_header_list_cleanup(struct h2x_header_list* list)
+struct h2x_header_block* h2x_header_block_new(uint32_t arena_capacity)
 {
-    struct h2x_header_list_node* iter = list->head;
+    struct h2x_header_block* block = malloc(sizeof(struct h2x_header_block));
+    h2x_header_block_init(block, arena_capacity);
+
+    return block;
+}
 
-    while(iter)
+void h2x_header_block_destroy(struct h2x_header_block* block)
+{
+    if(block)
     {
-        struct h2x_header_list_node* next = iter->next;
-        h2x_header_cleanup(&iter->header);
+        h2x_header_block_cleanup(block);
+        free(block);
+    }
+}
 
-        free(iter);
-        iter = next;
+static uint32_t reserve_arena(struct h2x_header_block* block, uint32_t size)
+{
+    uint64_t needed = (uint64_t) block->arena_size + size;
+    if(needed > block->arena_capacity)
+    {
+        uint64_t new_capacity = (uint64_t) block->arena_capacity * 2;
+        while(new_capacity < needed)
+        {
+            new_capacity *= 2;
+        }
+
+        block->arena = realloc(block->arena, new_capacity);
+        block->arena_capacity = (uint32_t) new_capacity;
     }
+
+    uint32_t offset = block->arena_size;
+    block->arena_size += size;
+
+    return offset;
 }
 
-void h2x_header_list_append(struct h2x_header_list* list, struct h2x_header header)
+void h2x_header_block_append(struct h2x_header_block* block, const char* name, uint32_t name_length, const char* value, uint32_t value_length)
 {
-    struct h2x_header_list_node* new_node = (struct h2x_header_list_node*)malloc(sizeof(struct h2x_header_list_node));
-    new_node->next = NULL;
-    new_node->header = header;
+    if(block->field_count == block->field_capacity)
+    {
+        uint32_t new_capacity = block->field_capacity * 2;
+        struct h2x_header_field* new_fields = malloc(new_capacity * sizeof(struct h2x_header_field));
+        memcpy(new_fields, block->fields, block->field_count * sizeof(struct h2x_header_field));
 
-    if(!list->head)
+        if(block->fields != block->inline_fields)
+        {
+            free(block->fields);
+        }
+
+        block->fields = new_fields;
+        block->field_capacity = new_capacity;
+    }
+
+    uint32_t offset = reserve_arena(block, name_length + value_length + 2);
+    memcpy(block->arena + offset, name, name_length);
+    block->arena[offset + name_length] = 0;
+    memcpy(block->arena + offset + name_length + 1, value, value_length);
+    block->arena[offset + name_length + 1 + value_length] = 0;
+
+    uint32_t bucket = hash_header_name(name, name_length) & (H2X_HEADER_BLOCK_BUCKETS - 1);
+
+    struct h2x_header_field* field = &block->fields[block->field_count];
+    field->name_offset = offset;
+    field->name_length = name_length;
+    field->value_offset = offset + name_length + 1;
+    field->value_length = value_length;
+    field->next_in_bucket = block->buckets[bucket];
+
+    block->buckets[bucket] = ++block->field_count;
+}
+
+uint32_t h2x_header_block_get_count(struct h2x_header_block* block)
+{
+    return block->field_count;
+}
+
+char* h2x_header_block_get_name(struct h2x_header_block* block, uint32_t index, uint32_t* name_length)
+{
+    struct h2x_header_field* field = &block->fields[index];
+    if(name_length)
+    {
+        *name_length = field->name_length;
+    }
+
+    return block->arena + field->name_offset;
+}
+
+char* h2x_header_block_get_value(struct h2x_header_block* block, uint32_t index, uint32_t* value_length)
+{
+    struct h2x_header_field* field = &block->fields[index];
+    if(value_length)
+    {
+        *value_length = field->value_length;
+    }
+
+    return block->arena + field->value_offset;
+}
+
+/*
+ * Bucket chains run newest to oldest, so keep walking to the end to return the first occurrence
+ */
+char* h2x_header_block_find(struct h2x_header_block* block, const char* name, uint32_t name_length, uint32_t* value_length)
+{
+    uint32_t bucket = hash_header_name(name, name_length) & (H2X_HEADER_BLOCK_BUCKETS - 1);
+    struct h2x_header_field* found = NULL;
+
+    uint32_t next = block->buckets[bucket];
+    while(next)
+    {
+        struct h2x_header_field* field = &block->fields[next - 1];
+        if(field->name_length == name_length && memcmp(block->arena + field->name_offset, name, name_length) == 0)
+        {
+            found = field;
+        }
+
+        next = field->next_in_bucket;
+    }
+
+    if(!found)
     {
-        list->head = list->cur = list->tail = new_node;
+        return NULL;
     }
-    else
+
+    if(value_length)
     {
-        list->tail->next = new_node;
-        list->tail = new_node;
+        *value_length = found->value_length;
     }
+
+    return block->arena + found->value_offset;
 }
 
-struct h2x_header* h2x_header_next(struct h2x_header_list* list)
+char* h2x_header_views_find(struct h2x_header_view* views, uint32_t view_count, const char* name, uint32_t name_length, uint32_t* value_length)
 {
-    struct h2x_header_list_node* temp = list->cur;
-    if(list->cur)
+    for(uint32_t i = 0; i < view_count; ++i)
     {
-        list->cur = list->cur->next;
-        return &temp->header;
+        struct h2x_header_view* view = &views[i];
+        if(view->name_length == name_length && memcmp(view->name, name, name_length) == 0)
+        {
+            if(value_length)
+            {
+                *value_length = view->value_length;
+            }
+
+            return view->value;
+        }
     }
+
     return NULL;
 }
 
-void h2x_header_reset_iter(struct h2x_header_list* list)
+struct h2x_header_block* h2x_header_views_retain(struct h2x_header_view* views, uint32_t view_count)
 {
-    list->cur = list->head;
+    uint64_t arena_size = 0;
+    for(uint32_t i = 0; i < view_count; ++i)
+    {
+        arena_size += (uint64_t) views[i].name_length + views[i].value_length + 2;
+    }
+
+    struct h2x_header_block* block = h2x_header_block_new((uint32_t) arena_size);
+    for(uint32_t i = 0; i < view_count; ++i)
+    {
+        h2x_header_block_append(block, views[i].name, views[i].name_length, views[i].value, views[i].value_length);
+    }
+
+    return block;
 }
@@ -1,32 +1,83 @@
 #ifndef H2X_HEADERS_H
 #define H2X_HEADERS_H
 
-struct h2x_header
+#include <stdint.h>
+
+/*
+ * A header block keeps every name and value of a request or response in one contiguous arena, each
+ * NUL-terminated, and indexes them with a compact array of offsets.  A block costs one or two
+ * allocations however many headers it carries and is freed in one call.  Names are hashed into a
+ * small bucket table as they're added so lookups by name don't walk the whole block.
+ *
+ * Appending may move the arena, so names and values fetched from a block are only good until the
+ * next append.
+ */
+#define H2X_HEADER_BLOCK_INLINE_FIELDS 24
+#define H2X_HEADER_BLOCK_BUCKETS 16
+
+struct h2x_header_field
 {
-    char* name;
-    char* value;
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t value_offset;
+    uint32_t value_length;
+    uint32_t next_in_bucket;    // index + 1 of the next field in the same bucket, 0 at the end of the chain
 };
 
-void h2x_header_init(struct h2x_header* header, char* name, char* value);
-void h2x_header_cleanup(struct h2x_header* header);
-
-struct h2x_header_list_node
+struct h2x_header_block
 {
-    struct h2x_header header;
-    struct h2x_header_list_node* next;
+    char* arena;
+    uint32_t arena_size;
+    uint32_t arena_capacity;
+
+    struct h2x_header_field* fields;    // points at inline_fields until the block outgrows them
+    uint32_t field_count;
+    uint32_t field_capacity;
+    uint32_t buckets[H2X_HEADER_BLOCK_BUCKETS];     // index + 1 of the newest field in each bucket
+
+    struct h2x_header_field inline_fields[H2X_HEADER_BLOCK_INLINE_FIELDS];
 };
 
-struct h2x_header_list
+void h2x_header_block_init(struct h2x_header_block* block, uint32_t arena_capacity);
+void h2x_header_block_cleanup(struct h2x_header_block* block);
+
+struct h2x_header_block* h2x_header_block_new(uint32_t arena_capacity);
+void h2x_header_block_destroy(struct h2x_header_block* block);
+
+void h2x_header_block_append(struct h2x_header_block* block, const char* name, uint32_t name_length, const char* value, uint32_t value_length);
+
+uint32_t h2x_header_block_get_count(struct h2x_header_block* block);
+
+/*
+ * The lengths are optional
+ */
+char* h2x_header_block_get_name(struct h2x_header_block* block, uint32_t index, uint32_t* name_length);
+char* h2x_header_block_get_value(struct h2x_header_block* block, uint32_t index, uint32_t* value_length);
+
+/*
+ * Returns the value of the first header with this name, or NULL if there isn't one
+ */
+char* h2x_header_block_find(struct h2x_header_block* block, const char* name, uint32_t name_length, uint32_t* value_length);
+
+/*
+ * A header view points straight at a decoded name and value wherever the decoder left them (in the
+ * received header block, the HPACK tables or the decoder's scratch space) rather than copying them.
+ * Neither is NUL-terminated and both are only valid for the duration of the callback that receives
+ * them; anything that has to outlive it is copied out with h2x_header_views_retain.
+ */
+struct h2x_header_view
 {
-    struct h2x_header_list_node* head;
-    struct h2x_header_list_node* tail;
-    struct h2x_header_list_node* cur;
+    char* name;
+    uint32_t name_length;
+    char* value;
+    uint32_t value_length;
 };
 
-void h2x_header_list_init(struct h2x_header_list* list);
-void h2x_header_list_cleanup(struct h2x_header_list* list);
-void h2x_header_list_append(struct h2x_header_list* list, struct h2x_header header);
-struct h2x_header* h2x_header_next(struct h2x_header_list* list);
-void h2x_header_reset_iter(struct h2x_header_list* list);
+char* h2x_header_views_find(struct h2x_header_view* views, uint32_t view_count, const char* name, uint32_t name_length, uint32_t* value_length);
+
+/*
+ * Copies the views into a new block owned by the caller
+ */
+struct h2x_header_block* h2x_header_views_retain(struct h2x_header_view* views, uint32_t view_count);
 
 #endif
@@ -0,0 +1,668 @@
+#include <h2x_hpack.h>
+
+#include <h2x_huffman.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// rfc7541 4.1: every entry costs its name and value plus an estimate of per-entry overhead
+#define HPACK_ENTRY_OVERHEAD 32
+#define HPACK_INITIAL_TABLE_CAPACITY 16
+
+struct hpack_static_entry
+{
+    char* name;
+    uint32_t name_length;
+    char* value;
+    uint32_t value_length;
+};
+
+// rfc7541 Appendix A; index 1 is the first element
+static const struct hpack_static_entry hpack_static_table[] = {
+    { ":authority", 10, "", 0 },
+    { ":method", 7, "GET", 3 },
+    { ":method", 7, "POST", 4 },
+    { ":path", 5, "/", 1 },
+    { ":path", 5, "/index.html", 11 },
+    { ":scheme", 7, "http", 4 },
+    { ":scheme", 7, "https", 5 },
+    { ":status", 7, "200", 3 },
+    { ":status", 7, "204", 3 },
+    { ":status", 7, "206", 3 },
+    { ":status", 7, "304", 3 },
+    { ":status", 7, "400", 3 },
+    { ":status", 7, "404", 3 },
+    { ":status", 7, "500", 3 },
+    { "accept-charset", 14, "", 0 },
+    { "accept-encoding", 15, "gzip, deflate", 13 },
+    { "accept-language", 15, "", 0 },
+    { "accept-ranges", 13, "", 0 },
+    { "accept", 6, "", 0 },
+    { "access-control-allow-origin", 27, "", 0 },
+    { "age", 3, "", 0 },
+    { "allow", 5, "", 0 },
+    { "authorization", 13, "", 0 },
+    { "cache-control", 13, "", 0 },
+    { "content-disposition", 19, "", 0 },
+    { "content-encoding", 16, "", 0 },
+    { "content-language", 16, "", 0 },
+    { "content-length", 14, "", 0 },
+    { "content-location", 16, "", 0 },
+    { "content-range", 13, "", 0 },
+    { "content-type", 12, "", 0 },
+    { "cookie", 6, "", 0 },
+    { "date", 4, "", 0 },
+    { "etag", 4, "", 0 },
+    { "expect", 6, "", 0 },
+    { "expires", 7, "", 0 },
+    { "from", 4, "", 0 },
+    { "host", 4, "", 0 },
+    { "if-match", 8, "", 0 },
+    { "if-modified-since", 17, "", 0 },
+    { "if-none-match", 13, "", 0 },
+    { "if-range", 8, "", 0 },
+    { "if-unmodified-since", 19, "", 0 },
+    { "last-modified", 13, "", 0 },
+    { "link", 4, "", 0 },
+    { "location", 8, "", 0 },
+    { "max-forwards", 12, "", 0 },
+    { "proxy-authenticate", 18, "", 0 },
+    { "proxy-authorization", 19, "", 0 },
+    { "range", 5, "", 0 },
+    { "referer", 7, "", 0 },
+    { "refresh", 7, "", 0 },
+    { "retry-after", 11, "", 0 },
+    { "server", 6, "", 0 },
+    { "set-cookie", 10, "", 0 },
+    { "strict-transport-security", 25, "", 0 },
+    { "transfer-encoding", 17, "", 0 },
+    { "user-agent", 10, "", 0 },
+    { "vary", 4, "", 0 },
+    { "via", 3, "", 0 },
+    { "www-authenticate", 16, "", 0 }
+};
+
+#define HPACK_STATIC_TABLE_LENGTH (sizeof(hpack_static_table) / sizeof(struct hpack_static_entry))
+
+/*
+ * Dynamic table
+ */
+static void hpack_table_init(struct h2x_hpack_table* table, uint32_t max_size)
+{
+    table->entries = NULL;
+    table->capacity = 0;
+    table->first = 0;
+    table->count = 0;
+    table->size = 0;
+    table->max_size = max_size;
+
+    table->retain_evicted = false;
+    table->retired = NULL;
+    table->retired_count = 0;
+    table->retired_capacity = 0;
+}
+
+static void hpack_table_free_retired(struct h2x_hpack_table* table)
+{
+    for(uint32_t i = 0; i < table->retired_count; ++i)
+    {
+        free(table->retired[i]);
+    }
+
+    table->retired_count = 0;
+}
+
+static void hpack_table_evict_oldest(struct h2x_hpack_table* table)
+{
+    struct h2x_hpack_entry* entry = &table->entries[table->first];
+    table->size -= entry->name_length + entry->value_length + HPACK_ENTRY_OVERHEAD;
+
+    if(table->retain_evicted)
+    {
+        if(table->retired_count == table->retired_capacity)
+        {
+            table->retired_capacity = table->retired_capacity ? table->retired_capacity * 2 : HPACK_INITIAL_TABLE_CAPACITY;
+            table->retired = realloc(table->retired, table->retired_capacity * sizeof(char*));
+        }
+
+        table->retired[table->retired_count++] = entry->name;
+    }
+    else
+    {
+        free(entry->name);
+    }
+
+    table->first = (table->first + 1) & (table->capacity - 1);
+    --table->count;
+}
+
+static void hpack_table_cleanup(struct h2x_hpack_table* table)
+{
+    while(table->count > 0)
+    {
+        hpack_table_evict_oldest(table);
+    }
+
+    hpack_table_free_retired(table);
+    free(table->retired);
+    table->retired = NULL;
+    table->retired_capacity = 0;
+
+    free(table->entries);
+    table->entries = NULL;
+    table->capacity = 0;
+}
+
+static void hpack_table_set_max_size(struct h2x_hpack_table* table, uint32_t max_size)
+{
+    table->max_size = max_size;
+    while(table->size > table->max_size)
+    {
+        hpack_table_evict_oldest(table);
+    }
+}
+
+// 0 is the newest entry
+static struct h2x_hpack_entry* hpack_table_get(struct h2x_hpack_table* table, uint32_t dynamic_index)
+{
+    return &table->entries[(table->first + table->count - 1 - dynamic_index) & (table->capacity - 1)];
+}
+
+static void hpack_table_grow(struct h2x_hpack_table* table)
+{
+    uint32_t new_capacity = table->capacity ? table->capacity * 2 : HPACK_INITIAL_TABLE_CAPACITY;
+    struct h2x_hpack_entry* new_entries = malloc(new_capacity * sizeof(struct h2x_hpack_entry));
+
+    for(uint32_t i = 0; i < table->count; ++i)
+    {
+        new_entries[i] = table->entries[(table->first + i) & (table->capacity - 1)];
+    }
+
+    free(table->entries);
+    table->entries = new_entries;
+    table->capacity = new_capacity;
+    table->first = 0;
+}
+
+/*
+ * The name may point into an entry that's about to be evicted (a literal with an indexed name), so the
+ * new entry is copied out before making room for it.  An entry bigger than the whole table empties it.
+ */
+static void hpack_table_add(struct h2x_hpack_table* table, char* name, uint32_t name_length, char* value, uint32_t value_length)
+{
+    uint64_t entry_size = (uint64_t) name_length + value_length + HPACK_ENTRY_OVERHEAD;
+    if(entry_size > table->max_size)
+    {
+        while(table->count > 0)
+        {
+            hpack_table_evict_oldest(table);
+        }
+        return;
+    }
+
+    char* storage = malloc(name_length + value_length);
+    memcpy(storage, name, name_length);
+    memcpy(storage + name_length, value, value_length);
+
+    while(table->size + entry_size > table->max_size)
+    {
+        hpack_table_evict_oldest(table);
+    }
+
+    if(table->count == table->capacity)
+    {
+        hpack_table_grow(table);
+    }
+
+    struct h2x_hpack_entry* entry = &table->entries[(table->first + table->count) & (table->capacity - 1)];
+    entry->name = storage;
+    entry->name_length = name_length;
+    entry->value = storage + name_length;
+    entry->value_length = value_length;
+
+    ++table->count;
+    table->size += (uint32_t) entry_size;
+}
+
+/*
+ * Integers (rfc7541 5.1)
+ */
+static uint32_t encode_integer(uint8_t* output, uint8_t first_byte, uint8_t prefix_bits, uint32_t value)
+{
+    uint32_t prefix_max = (1U << prefix_bits) - 1;
+    if(value < prefix_max)
+    {
+        output[0] = first_byte | (uint8_t) value;
+        return 1;
+    }
+
+    output[0] = first_byte | (uint8_t) prefix_max;
+    value -= prefix_max;
+
+    uint32_t written = 1;
+    while(value >= 0x80)
+    {
+        output[written++] = (uint8_t) (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+
+    output[written++] = (uint8_t) value;
+
+    return written;
+}
+
+static int decode_integer(uint8_t** position, uint8_t* end, uint8_t prefix_bits, uint32_t* value)
+{
+    uint8_t* current = *position;
+    if(current >= end)
+    {
+        return -1;
+    }
+
+    uint32_t prefix_max = (1U << prefix_bits) - 1;
+    uint64_t result = *current++ & prefix_max;
+    if(result == prefix_max)
+    {
+        uint32_t shift = 0;
+        uint8_t next_byte;
+        do
+        {
+            // anything past a fifth continuation byte can only overflow 32 bits
+            if(current >= end || shift > 28)
+            {
+                return -1;
+            }
+
+            next_byte = *current++;
+            result += (uint64_t) (next_byte & 0x7F) << shift;
+            shift += 7;
+        } while(next_byte & 0x80);
+
+        if(result > UINT32_MAX)
+        {
+            return -1;
+        }
+    }
+
+    *position = current;
+    *value = (uint32_t) result;
+
+    return 0;
+}
+
+/*
+ * Strings (rfc7541 5.2), raw or Huffman-coded.  Raw strings are left where they are in the block;
+ * Huffman-coded strings are decoded onto the end of the scratch buffer.
+ */
+static uint32_t encode_string(uint8_t* output, char* string, uint32_t length)
+{
+    // Huffman only when it actually saves space, which keeps the encoded size within the raw bound
+    uint32_t huffman_length = h2x_huffman_encoded_length((uint8_t*) string, length);
+    if(huffman_length < length)
+    {
+        uint32_t written = encode_integer(output, 0x80, 7, huffman_length);
+        return written + h2x_huffman_encode((uint8_t*) string, length, output + written);
+    }
+
+    uint32_t written = encode_integer(output, 0x00, 7, length);
+    memcpy(output + written, string, length);
+
+    return written + length;
+}
+
+static int decode_string(struct h2x_hpack_decoder* decoder, uint8_t** position, uint8_t* end, char** string, uint32_t* length)
+{
+    if(*position >= end)
+    {
+        return -1;
+    }
+
+    bool is_huffman = (**position & 0x80) != 0;
+    uint32_t encoded_length = 0;
+    if(decode_integer(position, end, 7, &encoded_length) || encoded_length > (uint32_t)(end - *position))
+    {
+        return -1;
+    }
+
+    uint8_t* encoded = *position;
+    *position += encoded_length;
+
+    if(!is_huffman)
+    {
+        *string = (char*) encoded;
+        *length = encoded_length;
+        return 0;
+    }
+
+    uint8_t* decoded = decoder->scratch + decoder->scratch_used;
+    if(h2x_huffman_decode(encoded, encoded_length, decoded, decoder->scratch_capacity - decoder->scratch_used, length))
+    {
+        return -1;
+    }
+
+    *string = (char*) decoded;
+    decoder->scratch_used += *length;
+
+    return 0;
+}
+
+/*
+ * Encoder
+ */
+void h2x_hpack_encoder_init(struct h2x_hpack_encoder* encoder)
+{
+    hpack_table_init(&encoder->table, H2X_HPACK_DEFAULT_TABLE_SIZE);
+    encoder->size_limit = H2X_HPACK_DEFAULT_TABLE_SIZE;
+    encoder->has_pending_size_update = false;
+    encoder->smallest_pending_size = H2X_HPACK_DEFAULT_TABLE_SIZE;
+}
+
+void h2x_hpack_encoder_cleanup(struct h2x_hpack_encoder* encoder)
+{
+    hpack_table_cleanup(&encoder->table);
+}
+
+/*
+ * We never grow our table past the protocol default even if the peer allows it, which keeps the
+ * per-connection memory bounded; a smaller limit shrinks the table right away
+ */
+void h2x_hpack_encoder_set_size_limit(struct h2x_hpack_encoder* encoder, uint32_t size_limit)
+{
+    encoder->size_limit = size_limit;
+
+    uint32_t new_size = size_limit < H2X_HPACK_DEFAULT_TABLE_SIZE ? size_limit : H2X_HPACK_DEFAULT_TABLE_SIZE;
+    if(new_size == encoder->table.max_size)
+    {
+        return;
+    }
+
+    if(!encoder->has_pending_size_update || new_size < encoder->smallest_pending_size)
+    {
+        encoder->smallest_pending_size = new_size;
+    }
+
+    encoder->has_pending_size_update = true;
+    hpack_table_set_max_size(&encoder->table, new_size);
+}
+
+uint32_t h2x_hpack_encode_block_start(struct h2x_hpack_encoder* encoder, uint8_t* output)
+{
+    if(!encoder->has_pending_size_update)
+    {
+        return 0;
+    }
+
+    uint32_t written = 0;
+    if(encoder->smallest_pending_size < encoder->table.max_size)
+    {
+        written += encode_integer(output, 0x20, 5, encoder->smallest_pending_size);
+    }
+
+    written += encode_integer(output + written, 0x20, 5, encoder->table.max_size);
+    encoder->has_pending_size_update = false;
+
+    return written;
+}
+
+static bool is_sensitive_header(char* name, uint32_t name_length)
+{
+    return (name_length == 13 && memcmp(name, "authorization", 13) == 0) ||
+           (name_length == 19 && memcmp(name, "proxy-authorization", 19) == 0);
+}
+
+/*
+ * Looks for the header in the static table and then the dynamic table.  Returns the HPACK index of a
+ * full match if there is one, otherwise of the first entry whose name matches (or 0).
+ */
+static uint32_t find_header_index(struct h2x_hpack_encoder* encoder, char* name, uint32_t name_length, char* value, uint32_t value_length, bool* is_full_match)
+{
+    uint32_t name_index = 0;
+    *is_full_match = false;
+
+    for(uint32_t i = 0; i < HPACK_STATIC_TABLE_LENGTH; ++i)
+    {
+        const struct hpack_static_entry* entry = &hpack_static_table[i];
+        if(entry->name_length != name_length || memcmp(entry->name, name, name_length) != 0)
+        {
+            continue;
+        }
+
+        if(entry->value_length == value_length && memcmp(entry->value, value, value_length) == 0)
+        {
+            *is_full_match = true;
+            return i + 1;
+        }
+
+        if(name_index == 0)
+        {
+            name_index = i + 1;
+        }
+    }
+
+    struct h2x_hpack_table* table = &encoder->table;
+    for(uint32_t i = 0; i < table->count; ++i)
+    {
+        struct h2x_hpack_entry* entry = hpack_table_get(table, i);
+        if(entry->name_length != name_length || memcmp(entry->name, name, name_length) != 0)
+        {
+            continue;
+        }
+
+        if(entry->value_length == value_length && memcmp(entry->value, value, value_length) == 0)
+        {
+            *is_full_match = true;
+            return HPACK_STATIC_TABLE_LENGTH + 1 + i;
+        }
+
+        if(name_index == 0)
+        {
+            name_index = HPACK_STATIC_TABLE_LENGTH + 1 + i;
+        }
+    }
+
+    return name_index;
+}
+
+/*
+ * Repeated headers become a single indexed byte or two.  Anything else goes out as a literal that's
+ * added to the dynamic table, except for credentials (never indexed, so intermediaries don't either)
+ * and headers too big to fit the table at all.
+ */
+uint32_t h2x_hpack_encode_header(struct h2x_hpack_encoder* encoder, uint8_t* output,
+                                 char* name, uint32_t name_length, char* value, uint32_t value_length)
+{
+    bool is_full_match = false;
+    uint32_t index = find_header_index(encoder, name, name_length, value, value_length, &is_full_match);
+    bool is_sensitive = is_sensitive_header(name, name_length);
+
+    if(is_full_match && !is_sensitive)
+    {
+        return encode_integer(output, 0x80, 7, index);
+    }
+
+    uint32_t written = 0;
+    bool add_to_table = !is_sensitive && (uint64_t) name_length + value_length + HPACK_ENTRY_OVERHEAD <= encoder->table.max_size;
+    if(add_to_table)
+    {
+        written = encode_integer(output, 0x40, 6, index);
+    }
+    else
+    {
+        written = encode_integer(output, is_sensitive ? 0x10 : 0x00, 4, index);
+    }
+
+    if(index == 0)
+    {
+        written += encode_string(output + written, name, name_length);
+    }
+
+    written += encode_string(output + written, value, value_length);
+
+    if(add_to_table)
+    {
+        hpack_table_add(&encoder->table, name, name_length, value, value_length);
+    }
+
+    return written;
+}
+
+/*
+ * Decoder
+ */
+void h2x_hpack_decoder_init(struct h2x_hpack_decoder* decoder)
+{
+    hpack_table_init(&decoder->table, H2X_HPACK_DEFAULT_TABLE_SIZE);
+    decoder->size_limit = H2X_HPACK_DEFAULT_TABLE_SIZE;
+    decoder->scratch = NULL;
+    decoder->scratch_capacity = 0;
+    decoder->scratch_used = 0;
+
+    decoder->table.retain_evicted = true;
+}
+
+void h2x_hpack_decoder_cleanup(struct h2x_hpack_decoder* decoder)
+{
+    hpack_table_cleanup(&decoder->table);
+    free(decoder->scratch);
+    decoder->scratch = NULL;
+    decoder->scratch_capacity = 0;
+}
+
+void h2x_hpack_decoder_set_size_limit(struct h2x_hpack_decoder* decoder, uint32_t size_limit)
+{
+    decoder->size_limit = size_limit;
+}
+
+static int get_indexed_header(struct h2x_hpack_decoder* decoder, uint32_t index, char** name, uint32_t* name_length, char** value, uint32_t* value_length)
+{
+    if(index == 0)
+    {
+        return -1;
+    }
+
+    if(index <= HPACK_STATIC_TABLE_LENGTH)
+    {
+        const struct hpack_static_entry* entry = &hpack_static_table[index - 1];
+        *name = entry->name;
+        *name_length = entry->name_length;
+        *value = entry->value;
+        *value_length = entry->value_length;
+        return 0;
+    }
+
+    uint32_t dynamic_index = index - HPACK_STATIC_TABLE_LENGTH - 1;
+    if(dynamic_index >= decoder->table.count)
+    {
+        return -1;
+    }
+
+    struct h2x_hpack_entry* entry = hpack_table_get(&decoder->table, dynamic_index);
+    *name = entry->name;
+    *name_length = entry->name_length;
+    *value = entry->value;
+    *value_length = entry->value_length;
+
+    return 0;
+}
+
+int h2x_hpack_decode_block(struct h2x_hpack_decoder* decoder, uint8_t* block, uint32_t block_length,
+                           void (*on_header)(void* context, char* name, uint32_t name_length, char* value, uint32_t value_length),
+                           void* context)
+{
+    // whatever the last block handed out is no longer referenced
+    hpack_table_free_retired(&decoder->table);
+    decoder->scratch_used = 0;
+
+    /*
+     * Every string in the block decodes to at most 8/5ths of its encoded length, so one scratch buffer
+     * that size holds every decoded string in the block at once
+     */
+    uint64_t scratch_needed = H2X_HUFFMAN_MAX_DECODED_LENGTH(block_length);
+    if(scratch_needed > decoder->scratch_capacity)
+    {
+        free(decoder->scratch);
+        decoder->scratch = malloc(scratch_needed);
+        decoder->scratch_capacity = (uint32_t) scratch_needed;
+    }
+
+    uint8_t* position = block;
+    uint8_t* end = block + block_length;
+    bool seen_header = false;
+
+    while(position < end)
+    {
+        uint8_t first_byte = *position;
+        char* name = NULL;
+        char* value = NULL;
+        uint32_t name_length = 0;
+        uint32_t value_length = 0;
+        uint32_t index = 0;
+
+        if(first_byte & 0x80)
+        {
+            // indexed header field
+            if(decode_integer(&position, end, 7, &index) || get_indexed_header(decoder, index, &name, &name_length, &value, &value_length))
+            {
+                return -1;
+            }
+        }
+        else if((first_byte & 0xE0) == 0x20)
+        {
+            // dynamic table size update, only allowed ahead of the first header
+            uint32_t new_size = 0;
+            if(seen_header || decode_integer(&position, end, 5, &new_size) || new_size > decoder->size_limit)
+            {
+                return -1;
+            }
+
+            hpack_table_set_max_size(&decoder->table, new_size);
+            continue;
+        }
+        else
+        {
+            // literal with incremental indexing (01), without indexing (0000) or never indexed (0001)
+            bool add_to_table = (first_byte & 0xC0) == 0x40;
+            if(decode_integer(&position, end, add_to_table ? 6 : 4, &index))
+            {
+                return -1;
+            }
+
+            if(index != 0)
+            {
+                char* unused_value = NULL;
+                uint32_t unused_value_length = 0;
+                if(get_indexed_header(decoder, index, &name, &name_length, &unused_value, &unused_value_length))
+                {
+                    return -1;
+                }
+            }
+            else
+            {
+                if(decode_string(decoder, &position, end, &name, &name_length))
+                {
+                    return -1;
+                }
+            }
+
+            if(decode_string(decoder, &position, end, &value, &value_length))
+            {
+                return -1;
+            }
+
+            // the name may belong to an entry that adding this one evicts, so report the header first
+            seen_header = true;
+            (*on_header)(context, name, name_length, value, value_length);
+
+            if(add_to_table)
+            {
+                hpack_table_add(&decoder->table, name, name_length, value, value_length);
+            }
+            continue;
+        }
+
+        seen_header = true;
+        (*on_header)(context, name, name_length, value, value_length);
+    }
+
+    return 0;
+}
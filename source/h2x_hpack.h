@@ -0,0 +1,103 @@
+#ifndef H2X_HPACK_H
+#define H2X_HPACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * HPACK header compression (rfc7541).  Each connection has one encoder for the header blocks it sends
+ * and one decoder for the blocks it receives; both sides keep a dynamic table that must see exactly
+ * the same sequence of header blocks as the peer's, so blocks are encoded and decoded in the order
+ * they go out on and come in off the wire.
+ */
+
+// the SETTINGS_HEADER_TABLE_SIZE every endpoint starts with
+#define H2X_HPACK_DEFAULT_TABLE_SIZE 4096
+
+struct h2x_hpack_entry
+{
+    char* name;         // name and value share one allocation, owned by the table
+    char* value;
+    uint32_t name_length;
+    uint32_t value_length;
+};
+
+/*
+ * Entries live in a circular array, oldest first; the newest entry has the lowest dynamic index
+ */
+struct h2x_hpack_table
+{
+    struct h2x_hpack_entry* entries;
+    uint32_t capacity;      // power of two
+    uint32_t first;
+    uint32_t count;
+    uint32_t size;          // rfc7541 4.1 size: sum of name + value + 32 over every entry
+    uint32_t max_size;
+
+    /*
+     * When set, evicted entries' storage is parked here instead of freed so strings handed out from
+     * the table stay put until h2x_hpack_decode_block runs again
+     */
+    bool retain_evicted;
+    char** retired;
+    uint32_t retired_count;
+    uint32_t retired_capacity;
+};
+
+struct h2x_hpack_encoder
+{
+    struct h2x_hpack_table table;
+    uint32_t size_limit;                // the largest table the peer's decoder allows (its SETTINGS_HEADER_TABLE_SIZE)
+    bool has_pending_size_update;       // the next block starts with size updates
+    uint32_t smallest_pending_size;     // lowest size picked since the last block, which the decoder has to see first
+};
+
+struct h2x_hpack_decoder
+{
+    struct h2x_hpack_table table;
+    uint32_t size_limit;    // the largest table we let the peer's encoder use (our SETTINGS_HEADER_TABLE_SIZE)
+    uint8_t* scratch;       // huffman-decoded strings of the current block, back to back
+    uint32_t scratch_capacity;
+    uint32_t scratch_used;
+};
+
+void h2x_hpack_encoder_init(struct h2x_hpack_encoder* encoder);
+void h2x_hpack_encoder_cleanup(struct h2x_hpack_encoder* encoder);
+
+/*
+ * Called when the peer's SETTINGS_HEADER_TABLE_SIZE arrives; the resize is signalled at the start of
+ * the next header block
+ */
+void h2x_hpack_encoder_set_size_limit(struct h2x_hpack_encoder* encoder, uint32_t size_limit);
+
+/*
+ * Upper bound on what h2x_hpack_encode_header writes for a header of the given sizes, and on what
+ * h2x_hpack_encode_block_start writes
+ */
+#define H2X_HPACK_MAX_ENCODED_SIZE(name_length, value_length) ((uint64_t)(name_length) + (value_length) + 18)
+#define H2X_HPACK_MAX_BLOCK_START_SIZE 12
+
+uint32_t h2x_hpack_encode_block_start(struct h2x_hpack_encoder* encoder, uint8_t* output);
+uint32_t h2x_hpack_encode_header(struct h2x_hpack_encoder* encoder, uint8_t* output,
+                                 char* name, uint32_t name_length, char* value, uint32_t value_length);
+
+void h2x_hpack_decoder_init(struct h2x_hpack_decoder* decoder);
+void h2x_hpack_decoder_cleanup(struct h2x_hpack_decoder* decoder);
+
+/*
+ * Called when our own SETTINGS_HEADER_TABLE_SIZE changes
+ */
+void h2x_hpack_decoder_set_size_limit(struct h2x_hpack_decoder* decoder, uint32_t size_limit);
+
+/*
+ * Decodes one complete header block, calling on_header for every header in order.  The name and value
+ * passed to on_header are not NUL-terminated and point into the block itself, the decoder's tables or
+ * its scratch buffer; they stay valid, along with the block, until the next call on this decoder.
+ * Returns 0 on success or -1 on a malformed block, after which the decoder is out of sync with the
+ * peer and the connection has to go (a COMPRESSION_ERROR).
+ */
+int h2x_hpack_decode_block(struct h2x_hpack_decoder* decoder, uint8_t* block, uint32_t block_length,
+                           void (*on_header)(void* context, char* name, uint32_t name_length, char* value, uint32_t value_length),
+                           void* context);
+
+#endif // H2X_HPACK_H
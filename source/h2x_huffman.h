@@ -0,0 +1,28 @@
+#ifndef H2X_HUFFMAN_H
+#define H2X_HUFFMAN_H
+
+#include <stdint.h>
+
+/*
+ * The static Huffman code HPACK uses for header strings (rfc7541 5.2, Appendix B).  A decoded string
+ * is never more than 8/5ths the length of its encoding, since the shortest code is 5 bits.
+ */
+#define H2X_HUFFMAN_MAX_DECODED_LENGTH(encoded_length) (((uint64_t)(encoded_length) * 8) / 5 + 1)
+
+/*
+ * Returns 0 on success, -1 if the input isn't a valid encoding (contains EOS, bad padding) or the
+ * output doesn't fit
+ */
+int h2x_huffman_decode(const uint8_t* input, uint32_t input_length, uint8_t* output, uint32_t output_capacity, uint32_t* output_length);
+
+// bit-at-a-time reference decoder; same contract, much slower
+int h2x_huffman_decode_bitwise(const uint8_t* input, uint32_t input_length, uint8_t* output, uint32_t output_capacity, uint32_t* output_length);
+
+/*
+ * The size h2x_huffman_encode would produce, so callers can pick the smaller of raw and Huffman
+ * before writing anything
+ */
+uint32_t h2x_huffman_encoded_length(const uint8_t* input, uint32_t input_length);
+uint32_t h2x_huffman_encode(const uint8_t* input, uint32_t input_length, uint8_t* output);
+
+#endif // H2X_HUFFMAN_H
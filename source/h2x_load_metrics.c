@@ -0,0 +1,98 @@
+#include <h2x_load_metrics.h>
+
+#include <time.h>
+
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+
+// rates are republished this often
+#define LOAD_SAMPLE_INTERVAL_NS (NANOSECONDS_PER_SECOND / 4)
+
+/*
+ * Relative cost of each metric when comparing threads.  Busy time dominates since it's the most
+ * direct measure of how saturated a thread is; connection and stream counts stand in for load that
+ * hasn't shown up in the rates yet, like a burst of freshly accepted connections.
+ */
+#define SCORE_BUSY_PER_MILLE_WEIGHT 16
+#define SCORE_OPEN_CONNECTION_WEIGHT 4
+#define SCORE_ACTIVE_STREAM_WEIGHT 2
+#define SCORE_BYTES_PER_SECOND_DIVISOR 65536
+
+void h2x_load_metrics_init(struct h2x_load_metrics* metrics)
+{
+    atomic_init(&metrics->open_connections, 0);
+    atomic_init(&metrics->active_streams, 0);
+    atomic_init(&metrics->bytes_per_second, 0);
+    atomic_init(&metrics->busy_per_mille, 0);
+
+    metrics->sample_start_ns = h2x_load_metrics_now_ns();
+    metrics->sample_bytes = 0;
+    metrics->sample_busy_ns = 0;
+    metrics->busy_start_ns = metrics->sample_start_ns;
+}
+
+uint64_t h2x_load_metrics_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t) now.tv_nsec;
+}
+
+void h2x_load_metrics_add_bytes(struct h2x_load_metrics* metrics, uint64_t bytes)
+{
+    metrics->sample_bytes += bytes;
+}
+
+void h2x_load_metrics_begin_busy(struct h2x_load_metrics* metrics)
+{
+    metrics->busy_start_ns = h2x_load_metrics_now_ns();
+}
+
+/*
+ * Called right before the processing thread waits for io.  Closes out the current busy period and,
+ * once a full sample interval has passed, publishes fresh rates.
+ */
+void h2x_load_metrics_end_busy(struct h2x_load_metrics* metrics)
+{
+    uint64_t now = h2x_load_metrics_now_ns();
+    metrics->sample_busy_ns += now - metrics->busy_start_ns;
+
+    uint64_t elapsed = now - metrics->sample_start_ns;
+    if(elapsed < LOAD_SAMPLE_INTERVAL_NS)
+    {
+        return;
+    }
+
+    uint64_t bytes_per_second = metrics->sample_bytes * NANOSECONDS_PER_SECOND / elapsed;
+    if(bytes_per_second > UINT32_MAX)
+    {
+        bytes_per_second = UINT32_MAX;
+    }
+
+    uint64_t busy_per_mille = metrics->sample_busy_ns * 1000 / elapsed;
+    if(busy_per_mille > 1000)
+    {
+        busy_per_mille = 1000;
+    }
+
+    atomic_store_explicit(&metrics->bytes_per_second, (uint32_t) bytes_per_second, memory_order_relaxed);
+    atomic_store_explicit(&metrics->busy_per_mille, (uint32_t) busy_per_mille, memory_order_relaxed);
+
+    metrics->sample_start_ns = now;
+    metrics->sample_bytes = 0;
+    metrics->sample_busy_ns = 0;
+}
+
+/*
+ * Lower is less loaded.  Safe to call from any thread.
+ */
+uint64_t h2x_load_metrics_get_score(struct h2x_load_metrics* metrics)
+{
+    uint64_t score = 0;
+    score += (uint64_t) atomic_load_explicit(&metrics->busy_per_mille, memory_order_relaxed) * SCORE_BUSY_PER_MILLE_WEIGHT;
+    score += (uint64_t) atomic_load_explicit(&metrics->open_connections, memory_order_relaxed) * SCORE_OPEN_CONNECTION_WEIGHT;
+    score += (uint64_t) atomic_load_explicit(&metrics->active_streams, memory_order_relaxed) * SCORE_ACTIVE_STREAM_WEIGHT;
+    score += atomic_load_explicit(&metrics->bytes_per_second, memory_order_relaxed) / SCORE_BYTES_PER_SECOND_DIVISOR;
+
+    return score;
+}
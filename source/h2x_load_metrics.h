@@ -0,0 +1,34 @@
+#ifndef H2X_LOAD_METRICS_H
+#define H2X_LOAD_METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Live load of a single processing thread.  The published fields are atomics that the connection
+ * manager reads without locking when placing new connections; the sampling state is private to the
+ * processing thread, which folds it into bytes_per_second and busy_per_mille a few times a second.
+ */
+struct h2x_load_metrics {
+    atomic_uint open_connections;       // shared state
+    atomic_uint active_streams;         // shared state
+    atomic_uint bytes_per_second;       // shared state
+    atomic_uint busy_per_mille;         // shared state, fraction of wall time spent outside of io waits
+
+    uint64_t sample_start_ns;           // processing thread only
+    uint64_t sample_bytes;
+    uint64_t sample_busy_ns;
+    uint64_t busy_start_ns;
+};
+
+void h2x_load_metrics_init(struct h2x_load_metrics* metrics);
+
+uint64_t h2x_load_metrics_now_ns(void);
+
+void h2x_load_metrics_add_bytes(struct h2x_load_metrics* metrics, uint64_t bytes);
+void h2x_load_metrics_begin_busy(struct h2x_load_metrics* metrics);
+void h2x_load_metrics_end_busy(struct h2x_load_metrics* metrics);
+
+uint64_t h2x_load_metrics_get_score(struct h2x_load_metrics* metrics);
+
+#endif // H2X_LOAD_METRICS_H
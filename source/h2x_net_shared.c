@@ -6,13 +6,17 @@
 #include <h2x_log.h>
 #include <h2x_options.h>
 #include <h2x_thread.h>
+#include <h2x_uring.h>
 
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <string.h>
@@ -37,6 +41,80 @@ int h2x_make_socket_nonblocking(int socket_fd)
   return 0;
 }
 
+/*
+ * With reuse_port, any number of sockets may bind the same port and the kernel spreads incoming
+ * connections across them
+ */
+int h2x_create_listener_socket(uint16_t port, bool reuse_port)
+{
+    struct addrinfo hints;
+    struct addrinfo *result, *rp;
+    int ret_val, socket_fd;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    char port_string[20];
+    sprintf(port_string, "%d", (int) port);
+
+    ret_val = getaddrinfo(NULL, port_string, &hints, &result);
+    if(ret_val != 0)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_FATAL, "Error %d (errno %d) calling getaddrinfo: %s", ret_val, errno, gai_strerror(ret_val));
+        return -1;
+    }
+
+    for(rp = result; rp != NULL; rp = rp->ai_next)
+    {
+        socket_fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if(socket_fd == -1)
+        {
+            continue;
+        }
+
+        int enable = 1;
+        if(reuse_port && setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)))
+        {
+            H2X_LOG(H2X_LOG_LEVEL_ERROR, "Failed to enable SO_REUSEPORT on listener socket, errno = %d", errno);
+            close(socket_fd);
+            continue;
+        }
+
+        ret_val = bind(socket_fd, rp->ai_addr, rp->ai_addrlen);
+        if (ret_val == 0)
+        {
+            break;
+        }
+
+        close(socket_fd);
+    }
+
+    freeaddrinfo(result);
+
+    if(rp == NULL)
+    {
+        return -1;
+    }
+
+    if(h2x_make_socket_nonblocking(socket_fd))
+    {
+        H2X_LOG(H2X_LOG_LEVEL_FATAL, "Failed to make listener socket non blocking");
+        close(socket_fd);
+        return -1;
+    }
+
+    if(listen(socket_fd, SOMAXCONN))
+    {
+        H2X_LOG(H2X_LOG_LEVEL_FATAL, "Failed to set socket as passive listener");
+        close(socket_fd);
+        return -1;
+    }
+
+    return socket_fd;
+}
+
 bool h2x_is_little_endian_system()
 {
     int i = 1;
@@ -61,10 +139,16 @@ void h2x_set_integer_as_big_endian(uint8_t* to_set, uint32_t int_value, uint32_t
     }
 }
 
-static uint32_t connection_hash_function(void* data)
+uint32_t h2x_get_integer_as_big_endian(uint8_t* data, uint32_t number_of_bytes)
 {
-    struct h2x_connection* connection = data;
-    return connection->fd;
+    uint32_t int_value = 0;
+
+    for(uint32_t data_index = 0; data_index < number_of_bytes; ++data_index)
+    {
+        int_value = (int_value << 8) | data[data_index];
+    }
+
+    return int_value;
 }
 
 static void cleanup_connection_table_entry(void *data, void* context)
@@ -74,33 +158,89 @@ static void cleanup_connection_table_entry(void *data, void* context)
     h2x_connection_add_to_intrusive_chain(connection, H2X_ICT_PENDING_CLOSE);
 }
 
-static void release_closed_connections(struct h2x_thread* thread)
+/*
+ * At shutdown every connection the thread still owns is closed, whatever io was pending on it
+ */
+void close_all_connections(struct h2x_thread* thread)
 {
-    if(!thread->intrusive_chains[H2X_ICT_PENDING_CLOSE])
+    while(thread->intrusive_chains[H2X_ICT_PENDING_READ])
     {
-        return;
+        h2x_connection_remove_from_intrusive_chain(&thread->intrusive_chains[H2X_ICT_PENDING_READ], H2X_ICT_PENDING_READ);
     }
 
-    // remove all the finished connections from our epoll instance
-    struct h2x_connection *connection = thread->intrusive_chains[H2X_ICT_PENDING_CLOSE];
-    while(connection)
+    while(thread->intrusive_chains[H2X_ICT_PENDING_WRITE])
     {
-        epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
-        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Removed connection %d from epoll", connection->fd);
-        connection = connection->intrusive_chains[H2X_ICT_PENDING_CLOSE];
+        h2x_connection_remove_from_intrusive_chain(&thread->intrusive_chains[H2X_ICT_PENDING_WRITE], H2X_ICT_PENDING_WRITE);
+    }
+
+    h2x_hash_table_visit(&thread->connections, cleanup_connection_table_entry, thread);
+}
+
+static void free_request(struct h2x_request* request)
+{
+    h2x_request_cleanup(request);
+    free(request);
+}
+
+/*
+ * Requests still pumping a body into a connection that's going away have nowhere left to send it
+ */
+static void drop_connection_requests(struct h2x_thread* thread, struct h2x_connection* connection)
+{
+    struct h2x_request** request_ptr = &thread->inprogress_requests;
+    while(*request_ptr)
+    {
+        struct h2x_request* request = *request_ptr;
+        if(request->connection == connection)
+        {
+            H2X_LOG(H2X_LOG_LEVEL_INFO, "Dropping request %u on closed connection %d", request->stream_id, connection->fd);
+            *request_ptr = request->next;
+            free_request(request);
+        }
+        else
+        {
+            request_ptr = &request->next;
+        }
     }
 
-    struct h2x_connection *last_connection = thread->intrusive_chains[H2X_ICT_PENDING_CLOSE];
-    while(last_connection->intrusive_chains[H2X_ICT_PENDING_CLOSE] != NULL)
+    while(connection->queued_request)
+    {
+        struct h2x_request* request = connection->queued_request;
+        connection->queued_request = request->next;
+        free_request(request);
+    }
+}
+
+/*
+ * Hands a chain (linked through the pending close links) of connections that no longer have any
+ * io outstanding over to the connection manager for cleanup
+ */
+void release_finished_connections(struct h2x_thread* thread, struct h2x_connection* finished_connections)
+{
+    uint32_t released_connections = 0;
+    uint32_t released_streams = 0;
+
+    struct h2x_connection *last_connection = finished_connections;
+    while(true)
     {
         assert(last_connection->intrusive_chains[H2X_ICT_PENDING_READ] == NULL);
         assert(last_connection->intrusive_chains[H2X_ICT_PENDING_WRITE] == NULL);
 
+        ++released_connections;
+        released_streams += last_connection->active_stream_count;
+        h2x_hash_table_remove(&thread->connections, last_connection->fd);
+        drop_connection_requests(thread, last_connection);
+
+        if(last_connection->intrusive_chains[H2X_ICT_PENDING_CLOSE] == NULL)
+        {
+            break;
+        }
+
         last_connection = last_connection->intrusive_chains[H2X_ICT_PENDING_CLOSE];
     }
 
-    assert(last_connection->intrusive_chains[H2X_ICT_PENDING_READ] == NULL);
-    assert(last_connection->intrusive_chains[H2X_ICT_PENDING_WRITE] == NULL);
+    atomic_fetch_sub(&thread->load.open_connections, released_connections);
+    atomic_fetch_sub(&thread->load.active_streams, released_streams);
 
     if(pthread_mutex_lock(thread->finished_connection_lock))
     {
@@ -109,9 +249,28 @@ static void release_closed_connections(struct h2x_thread* thread)
     }
 
     last_connection->intrusive_chains[H2X_ICT_PENDING_CLOSE] = *(thread->finished_connections);
-    *(thread->finished_connections) = last_connection;
+    *(thread->finished_connections) = finished_connections;
 
     pthread_mutex_unlock(thread->finished_connection_lock);
+}
+
+static void release_closed_connections(struct h2x_thread* thread)
+{
+    if(!thread->intrusive_chains[H2X_ICT_PENDING_CLOSE])
+    {
+        return;
+    }
+
+    // remove all the finished connections from our epoll instance
+    struct h2x_connection *connection = thread->intrusive_chains[H2X_ICT_PENDING_CLOSE];
+    while(connection)
+    {
+        epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Removed connection %d from epoll", connection->fd);
+        connection = connection->intrusive_chains[H2X_ICT_PENDING_CLOSE];
+    }
+
+    release_finished_connections(thread, thread->intrusive_chains[H2X_ICT_PENDING_CLOSE]);
 
     thread->intrusive_chains[H2X_ICT_PENDING_CLOSE] = NULL;
 }
@@ -121,17 +280,249 @@ void on_new_connection_visible(struct h2x_thread* thread, struct h2x_connection*
     struct h2x_request* request = connection->queued_request;
     while(request)
     {
+        struct h2x_request* next_request = request->next;
+
         request->next = thread->inprogress_requests;
         thread->inprogress_requests = request;
 
-        request = request->next;
+        request = next_request;
     }
 
+    connection->queued_request = NULL;
+
+    h2x_connection_queue_local_settings(connection);
+    h2x_hash_table_add(&thread->connections, connection);
+
     connection->state = H2X_CS_READY;
 }
 
-void process_epoll_events(struct h2x_thread *thread, struct epoll_event* events, int event_count)
+struct migration_candidate_search {
+    struct h2x_connection* best;
+};
+
+static bool is_connection_quiescent(struct h2x_connection* connection)
+{
+    if(connection->state != H2X_CS_READY || connection->migration_target != NULL)
+    {
+        return false;
+    }
+
+    for(uint32_t i = 0; i < H2X_ICT_COUNT; ++i)
+    {
+        if(connection->in_intrusive_chain[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void visit_migration_candidate(void* data, void* context)
+{
+    struct h2x_connection* connection = data;
+    struct migration_candidate_search* search = context;
+
+    if(!is_connection_quiescent(connection))
+    {
+        return;
+    }
+
+    // moving the busiest quiescent connection sheds the most load in one step
+    if(search->best == NULL || connection->active_stream_count > search->best->active_stream_count)
+    {
+        search->best = connection;
+    }
+}
+
+/*
+ * Picks a connection with no io queued on this thread (it may still have partial frames, open streams
+ * and unsent outbound data, all of which travel with it)
+ */
+struct h2x_connection* choose_connection_to_migrate(struct h2x_thread* thread)
 {
+    struct migration_candidate_search search;
+    search.best = NULL;
+
+    h2x_hash_table_visit(&thread->connections, visit_migration_candidate, &search);
+
+    return search.best;
+}
+
+/*
+ * Moves a connection, once the source thread has stopped all io on it, to the target thread.  Its
+ * stream table, outbound ring and any partially read frame live in the connection itself; the only
+ * thread-side state is the in-progress requests, which get re-queued on the connection so the target
+ * picks them up when the connection becomes visible there.
+ */
+void migrate_connection(struct h2x_thread* thread, struct h2x_connection* connection, struct h2x_thread* target)
+{
+    H2X_LOG(H2X_LOG_LEVEL_INFO, "Migrating connection %d from thread %u to thread %u", connection->fd, thread->thread_id, target->thread_id);
+
+    h2x_hash_table_remove(&thread->connections, connection->fd);
+
+    struct h2x_request** request_ptr = &thread->inprogress_requests;
+    while(*request_ptr)
+    {
+        struct h2x_request* request = *request_ptr;
+        if(request->connection == connection)
+        {
+            *request_ptr = request->next;
+            request->next = connection->queued_request;
+            connection->queued_request = request;
+        }
+        else
+        {
+            request_ptr = &request->next;
+        }
+    }
+
+    atomic_fetch_sub(&thread->load.open_connections, 1);
+    atomic_fetch_sub(&thread->load.active_streams, connection->active_stream_count);
+    atomic_fetch_add(&target->load.open_connections, 1);
+    atomic_fetch_add(&target->load.active_streams, connection->active_stream_count);
+
+    connection->migration_target = NULL;
+    atomic_store_explicit(&connection->owner, target, memory_order_release);
+    connection->state = H2X_CS_NEW;
+
+    if(h2x_thread_add_connection(target, connection))
+    {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Failed to hand connection %d to thread %u, closing it", connection->fd, target->thread_id);
+        atomic_store_explicit(&connection->owner, thread, memory_order_release);
+        atomic_fetch_add(&thread->load.open_connections, 1);
+        atomic_fetch_add(&thread->load.active_streams, connection->active_stream_count);
+        atomic_fetch_sub(&target->load.open_connections, 1);
+        atomic_fetch_sub(&target->load.active_streams, connection->active_stream_count);
+        on_new_connection_visible(thread, connection);
+        h2x_connection_begin_close(connection);
+    }
+}
+
+static void process_migration_request(struct h2x_thread* thread)
+{
+    struct h2x_thread* target = atomic_exchange(&thread->migration_target, NULL);
+    if(target == NULL || target == thread)
+    {
+        return;
+    }
+
+    struct h2x_connection* connection = choose_connection_to_migrate(thread);
+    if(connection == NULL)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Thread %u has no quiescent connection to migrate", thread->thread_id);
+        return;
+    }
+
+    // the target's registration delivers fresh edge-triggered events for anything already pending
+    epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    migrate_connection(thread, connection, target);
+}
+
+static void start_listening(struct h2x_thread* thread)
+{
+    int listener_fd = atomic_load(&thread->listener_fd);
+    if(thread->is_listening || listener_fd < 0)
+    {
+        return;
+    }
+
+    // the listener is told apart from connection events by pointing at the thread's listener_fd
+    struct epoll_event event;
+    event.data.ptr = &thread->listener_fd;
+    event.events = EPOLLIN | EPOLLET;
+
+    if(epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, listener_fd, &event) == -1)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Unable to register listener %d with thread %u epoll instance, errno = %d", listener_fd, thread->thread_id, (int) errno);
+        return;
+    }
+
+    thread->is_listening = true;
+}
+
+static void stop_listening(struct h2x_thread* thread)
+{
+    if(!thread->is_listening)
+    {
+        return;
+    }
+
+    int listener_fd = atomic_load(&thread->listener_fd);
+    epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, listener_fd, NULL);
+    close(listener_fd);
+
+    thread->is_listening = false;
+}
+
+bool h2x_is_accept_resource_error(int error)
+{
+    return error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM;
+}
+
+/*
+ * The listener is edge-triggered, so once accept stops short of EAGAIN the connections left in the
+ * backlog won't raise another event.  Running out of fds or memory leaves has_accept_backlog set and the
+ * processing loop retries until the backlog drains.
+ */
+static void accept_incoming_connections(struct h2x_thread* thread)
+{
+    int listener_fd = atomic_load(&thread->listener_fd);
+
+    while(1)
+    {
+        int incoming_fd = accept(listener_fd, NULL, NULL);
+        if(incoming_fd == -1)
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+
+            if(h2x_is_accept_resource_error(errno))
+            {
+                if(!thread->has_accept_backlog)
+                {
+                    H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u out of resources accepting connections, errno = %d; retrying", thread->thread_id, (int) errno);
+                }
+                thread->has_accept_backlog = true;
+                break;
+            }
+
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u error accepting connection, errno = %d", thread->thread_id, (int) errno);
+            }
+
+            thread->has_accept_backlog = false;
+            break;
+        }
+
+        if(h2x_make_socket_nonblocking(incoming_fd))
+        {
+            H2X_LOG(H2X_LOG_LEVEL_ERROR, "Failed to make connection %d non-blocking, errno = %d", incoming_fd, (int) errno);
+            close(incoming_fd);
+            continue;
+        }
+
+        struct h2x_connection* connection = h2x_thread_create_accepted_connection(thread, incoming_fd);
+        if(h2x_thread_add_connection(thread, connection))
+        {
+            h2x_connection_cleanup(connection);
+            close(incoming_fd);
+            free(connection);
+        }
+    }
+}
+
+/*
+ * Returns true if the thread's wakeup eventfd fired, meaning the connection manager or another
+ * thread has handed us new connections or requests
+ */
+bool process_epoll_events(struct h2x_thread *thread, struct epoll_event* events, int event_count)
+{
+    bool was_woken = false;
+
     assert(thread->intrusive_chains[H2X_ICT_PENDING_READ] == NULL);
     assert(thread->intrusive_chains[H2X_ICT_PENDING_CLOSE] == NULL);
     // the write chain can already be pre-populated due to request processing
@@ -142,6 +533,19 @@ void process_epoll_events(struct h2x_thread *thread, struct epoll_event* events,
         struct epoll_event* event = events + i;
         struct h2x_connection* connection = event->data.ptr;
 
+        if(connection == NULL)
+        {
+            h2x_thread_drain_wakeups(thread);
+            was_woken = true;
+            continue;
+        }
+
+        if(event->data.ptr == &thread->listener_fd)
+        {
+            accept_incoming_connections(thread);
+            continue;
+        }
+
         if(connection->state == H2X_CS_NEW)
         {
             on_new_connection_visible(thread, connection);
@@ -189,6 +593,8 @@ void process_epoll_events(struct h2x_thread *thread, struct epoll_event* events,
             h2x_connection_add_to_intrusive_chain(connection, H2X_ICT_PENDING_WRITE);
         }
     }
+
+    return was_woken;
 }
 
 #define READ_BUFFER_SIZE 8192
@@ -231,6 +637,7 @@ void process_pending_read_chain(struct h2x_thread* thread)
             H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Received %u bytes on connection %d", (uint32_t) count, connection->fd);
             h2x_connection_on_data_received(connection, read_buffer, count);
             connection->socket_state.bytes_read += count;
+            h2x_load_metrics_add_bytes(&thread->load, count);
         }
 
         if(count < READ_BUFFER_SIZE)
@@ -256,6 +663,8 @@ void process_pending_read_chain(struct h2x_thread* thread)
 
 void process_pending_write_chain(struct h2x_thread* thread)
 {
+    struct iovec write_iovecs[H2X_RING_BUFFER_MAX_SEGMENTS];
+
     // one round of writes
     struct h2x_connection** write_connection_ptr = &thread->intrusive_chains[H2X_ICT_PENDING_WRITE];
     while(*write_connection_ptr != NULL)
@@ -268,24 +677,24 @@ void process_pending_write_chain(struct h2x_thread* thread)
         H2X_LOG(H2X_LOG_LEVEL_TRACE, "Connection %d considering write (remote_hungup=%d, has_connected=%d)", connection->fd,
                 (int)connection->socket_state.has_remote_hungup, (int)connection->socket_state.has_connected);
 
-        h2x_connection_pump_outbound_frame(connection);
-        if(should_attempt_to_write && connection->current_outbound_frame)
+        if(should_attempt_to_write && h2x_connection_has_outbound_data(connection))
         {
-            uint32_t write_size = connection->current_outbound_frame->size - connection->current_outbound_frame_read_position;
+            uint32_t write_size = 0;
+            uint32_t iovec_count = h2x_connection_gather_outbound_data(connection, write_iovecs, &write_size);
             assert(write_size > 0);
 
-            H2X_LOG(H2X_LOG_LEVEL_TRACE, "Connection %d has outbound data (size %u) and is able to write", connection->fd, write_size);
+            H2X_LOG(H2X_LOG_LEVEL_TRACE, "Connection %d has outbound data (size %u, segments %u) and is able to write", connection->fd, write_size, iovec_count);
 
-            ssize_t count = write(connection->fd, connection->current_outbound_frame->raw_data, write_size);
+            ssize_t count = writev(connection->fd, write_iovecs, (int) iovec_count);
 
             if(count >= 0)
             {
                 H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d wrote %u bytes", connection->fd, (uint32_t)count);
-                connection->current_outbound_frame_read_position += count;
                 connection->socket_state.bytes_written += count;
+                h2x_load_metrics_add_bytes(&thread->load, count);
 
-                h2x_connection_pump_outbound_frame(connection);
-                is_write_finished = connection->current_outbound_frame == NULL;
+                h2x_connection_on_outbound_data_written(connection, (uint32_t) count);
+                is_write_finished = !h2x_connection_has_outbound_data(connection);
             }
             else
             {
@@ -297,7 +706,9 @@ void process_pending_write_chain(struct h2x_thread* thread)
                 }
                 else
                 {
+                    // the socket is full; the edge-triggered EPOLLOUT puts us back on the chain once it drains
                     H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d out of space to write", connection->fd);
+                    is_write_finished = true;
                 }
             }
         }
@@ -323,31 +734,50 @@ void process_pending_write_chain(struct h2x_thread* thread)
     }
 }
 
-void process_new_requests(struct h2x_request* requests)
+/*
+ * New requests are only queued here; each gets its stream once process_inprogress_requests finds
+ * room for it on the connection
+ */
+void process_new_requests(struct h2x_thread* thread, struct h2x_request* requests)
 {
+    // requests arrive in submission order; append them so bodies are pumped in that order too
+    struct h2x_request** inprogress_tail = NULL;
+
     struct h2x_request* request = requests;
     while(request)
     {
         struct h2x_connection* connection = request->connection;
-        struct h2x_thread *thread = connection->owner;
-
-        request->stream_id = h2x_connection_create_outbound_stream(connection, request->user_data);
-
-        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Started processing new request %u on connection %d", request->stream_id, connection->fd);
-
-        h2x_push_headers(connection, request->stream_id, &request->header_list);
-
         struct h2x_request* next_request = request->next;
 
+        // the connection was migrated after the request was submitted
+        struct h2x_thread* owner = atomic_load_explicit(&connection->owner, memory_order_acquire);
+        if(owner != thread)
+        {
+            h2x_thread_add_request(owner, request);
+            request = next_request;
+            continue;
+        }
+
         if(connection->state != H2X_CS_READY)
         {
+            // pushed newest-first here and reversed again by on_new_connection_visible
             request->next = connection->queued_request;
             connection->queued_request = request;
         }
         else
         {
-            request->next = thread->inprogress_requests;
-            thread->inprogress_requests = request;
+            if(inprogress_tail == NULL)
+            {
+                inprogress_tail = &thread->inprogress_requests;
+                while(*inprogress_tail)
+                {
+                    inprogress_tail = &((*inprogress_tail)->next);
+                }
+            }
+
+            request->next = NULL;
+            *inprogress_tail = request;
+            inprogress_tail = &request->next;
         }
 
         request = next_request;
@@ -356,10 +786,51 @@ void process_new_requests(struct h2x_request* requests)
 
 #define BODY_BUFFER_SIZE 8192
 
-void process_inprogress_requests(struct h2x_thread* thread)
+/*
+ * Opens the request's stream and sends its headers, unless the peer's stream limit means it has to
+ * wait for one of the connection's streams to close first.  Requests on a connection that's going
+ * away are failed instead.  Returns whether the request has a stream.
+ */
+static bool start_request(struct h2x_request*** request_ptr)
+{
+    struct h2x_request* request = **request_ptr;
+    struct h2x_connection* connection = request->connection;
+
+    if(!h2x_connection_is_accepting_streams(connection))
+    {
+        H2X_LOG(H2X_LOG_LEVEL_INFO, "Refusing new request on connection %d, which is going away", connection->fd);
+        h2x_connection_report_stream_error(connection, H2X_REFUSED_STREAM, 0, request->user_data);
+        **request_ptr = request->next;
+        free_request(request);
+        return false;
+    }
+
+    if(!h2x_connection_can_open_outbound_stream(connection))
+    {
+        *request_ptr = &request->next;
+        return false;
+    }
+
+    request->stream_id = h2x_connection_create_outbound_stream(connection, request->user_data);
+
+    H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Started processing new request %u on connection %d", request->stream_id, connection->fd);
+
+    h2x_push_headers(connection, request->stream_id, &request->headers);
+
+    return true;
+}
+
+/*
+ * Starts whichever requests the peer has room for, then pulls the next chunk of body for each request
+ * whose connection wants more.  The rest wait, without keeping the thread awake, until a write or a
+ * WINDOW_UPDATE drains them below their watermarks or a stream closes to make room.  Returns whether
+ * any request had a chunk pulled.
+ */
+bool process_inprogress_requests(struct h2x_thread* thread)
 {
     struct h2x_request** request_ptr = &thread->inprogress_requests;
     uint8_t body_buffer[BODY_BUFFER_SIZE];
+    bool has_ready_requests = false;
 
     while(*request_ptr)
     {
@@ -367,6 +838,19 @@ void process_inprogress_requests(struct h2x_thread* thread)
         struct h2x_connection* connection = request->connection;
         uint32_t bytes_written = 0;
 
+        if(request->stream_id == 0 && !start_request(&request_ptr))
+        {
+            continue;
+        }
+
+        if(!h2x_connection_wants_stream_data(connection, request->stream_id))
+        {
+            request_ptr = &((*request_ptr)->next);
+            continue;
+        }
+
+        has_ready_requests = true;
+
         bool is_request_finished = (*(connection->on_stream_data_needed))(connection, request->stream_id, body_buffer, BODY_BUFFER_SIZE, &bytes_written, request->user_data);
 
         h2x_push_data_segment(connection, request->stream_id, body_buffer, bytes_written, is_request_finished);
@@ -376,32 +860,60 @@ void process_inprogress_requests(struct h2x_thread* thread)
         {
             H2X_LOG(H2X_LOG_LEVEL_INFO, "Finished processing request %u on connection %d", request->stream_id, connection->fd);
             *request_ptr = (*request_ptr)->next;
-            h2x_request_cleanup(request);
-            free(request);
+            free_request(request);
         }
         else
         {
             request_ptr = &((*request_ptr)->next);
         }
     }
+
+    return has_ready_requests;
 }
 
+/*
+ * Upper bound on how long an idle thread sleeps; every real wakeup comes through the socket events or
+ * the thread's eventfd, so this only guards against the unexpected
+ */
+#define IDLE_EPOLL_WAIT_TIMEOUT_MS 1000
+
 void *h2x_processing_thread_function(void * arg)
 {
     struct h2x_thread* self = arg;
 
+    if(self->io_mode == H2X_IO_URING)
+    {
+        return h2x_uring_processing_thread_function(self);
+    }
+
     int epoll_fd = self->epoll_fd;
 
     uint32_t max_connections = self->options->connections_per_thread;
     struct epoll_event* events = calloc(max_connections, sizeof(struct epoll_event));
-    struct h2x_hash_table* connection_table = (struct h2x_hash_table*)malloc(sizeof(struct h2x_hash_table));
-    h2x_hash_table_init(connection_table, self->options->connections_per_thread, connection_hash_function);
 
     bool done = false;
+    bool has_ready_requests = false;
     while(!done)
     {
-        int event_count = epoll_wait(epoll_fd, events, max_connections, 0);
-        process_epoll_events(self, events, event_count);
+        // only block when no request body is ready to pull and nothing is queued to write
+        bool is_idle = !has_ready_requests && self->intrusive_chains[H2X_ICT_PENDING_WRITE] == NULL;
+        int timeout = is_idle ? (self->has_accept_backlog ? H2X_ACCEPT_RETRY_TIMEOUT_MS : IDLE_EPOLL_WAIT_TIMEOUT_MS) : 0;
+
+        h2x_load_metrics_end_busy(&self->load);
+        int event_count = epoll_wait(epoll_fd, events, max_connections, timeout);
+        h2x_load_metrics_begin_busy(&self->load);
+
+        if(event_count < 0)
+        {
+            if(errno != EINTR)
+            {
+                H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u epoll_wait failed, errno = %d", self->thread_id, (int) errno);
+            }
+            event_count = 0;
+        }
+
+        bool was_woken = process_epoll_events(self, events, event_count);
+        bool timed_out = is_idle && event_count == 0;
 
         while(self->intrusive_chains[H2X_ICT_PENDING_READ] || self->intrusive_chains[H2X_ICT_PENDING_WRITE])
         {
@@ -410,24 +922,36 @@ void *h2x_processing_thread_function(void * arg)
             H2X_LOG(H2X_LOG_LEVEL_TRACE, "Finished a single read/write pass");
         }
 
-        // optionally combine these two lock/unlock pairs into one
+        // producers signal the eventfd after publishing, so the handoff stacks only need checking after a wakeup
         struct h2x_connection* new_connections = NULL;
         struct h2x_request* new_requests = NULL;
         h2x_thread_poll_quit_state(self, &done);
-        h2x_thread_poll_new_requests_and_connections(self, &new_connections, &new_requests);
+        if(was_woken || timed_out)
+        {
+            h2x_thread_poll_new_requests_and_connections(self, &new_connections, &new_requests);
+            start_listening(self);
+            process_migration_request(self);
+        }
 
-        process_new_requests(new_requests);
-        process_inprogress_requests(self);
+        process_new_requests(self, new_requests);
+        has_ready_requests = process_inprogress_requests(self);
 
         release_closed_connections(self);
+
+        if(self->has_accept_backlog && self->is_listening)
+        {
+            accept_incoming_connections(self);
+        }
     }
 
-    h2x_hash_table_visit(connection_table, cleanup_connection_table_entry, self);
-    h2x_hash_table_cleanup(connection_table);
-    free(connection_table);
+    stop_listening(self);
 
+    close_all_connections(self);
     release_closed_connections(self);
 
+    h2x_frame_pool_log_stats(&self->frame_pool, self->thread_id);
+    h2x_stream_pool_log_stats(&self->stream_pool, self->thread_id);
+
     free(events);
     close(epoll_fd);
 
@@ -5,12 +5,32 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+struct h2x_connection;
+struct h2x_request;
+struct h2x_thread;
+
 void *h2x_processing_thread_function(void * arg);
 
+void on_new_connection_visible(struct h2x_thread* thread, struct h2x_connection* connection);
+void process_new_requests(struct h2x_thread* thread, struct h2x_request* requests);
+bool process_inprogress_requests(struct h2x_thread* thread);
+void release_finished_connections(struct h2x_thread* thread, struct h2x_connection* finished_connections);
+void close_all_connections(struct h2x_thread* thread);
+
+struct h2x_connection* choose_connection_to_migrate(struct h2x_thread* thread);
+void migrate_connection(struct h2x_thread* thread, struct h2x_connection* connection, struct h2x_thread* target);
+
+// how often a thread that couldn't drain its listener tries again; fds tend to free up as connections close
+#define H2X_ACCEPT_RETRY_TIMEOUT_MS 10
+
+bool h2x_is_accept_resource_error(int error);
+
 int h2x_make_socket_nonblocking(int socket_fd);
+int h2x_create_listener_socket(uint16_t port, bool reuse_port);
 
 bool h2x_is_little_endian_system();
 
 void h2x_set_integer_as_big_endian(uint8_t* to_set, uint32_t int_value, uint32_t number_of_bytes);
+uint32_t h2x_get_integer_as_big_endian(uint8_t* data, uint32_t number_of_bytes);
 
 #endif // H2X_NET_SHARED_H
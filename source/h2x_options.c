@@ -1,5 +1,9 @@
 #include <h2x_options.h>
 
+#include <h2x_flow_control.h>
+#include <h2x_hpack.h>
+#include <h2x_settings.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,6 +12,19 @@ static void intialize_options_defaults(struct h2x_options* options)
 {
     options->threads = 1;
     options->connections_per_thread = 1000;
+    options->io_mode = H2X_IO_EPOLL;
+    options->listener_mode = H2X_LISTENER_SHARED;
+    options->pin_threads = false;
+    options->numa_aware = false;
+    options->max_receive_window = 16 * 1024 * 1024;
+    options->max_concurrent_streams = 128;
+    options->initial_window_size = H2X_DEFAULT_WINDOW_SIZE;
+    options->header_table_size = H2X_HPACK_DEFAULT_TABLE_SIZE;
+    options->max_frame_size = H2X_MIN_MAX_FRAME_SIZE;
+    options->connection_write_low_watermark = 256 * 1024;
+    options->connection_write_high_watermark = 1024 * 1024;
+    options->stream_write_low_watermark = 64 * 1024;
+    options->stream_write_high_watermark = 256 * 1024;
     options->port = 3333;
     options->mode = H2X_MODE_NONE;
     options->security_protocol = H2X_SECURITY_NONE;
@@ -87,6 +104,149 @@ static int parse_h2x_conn(char** args, struct h2x_options* options)
     return 0;
 }
 
+static int parse_h2x_io_mode(char** args, struct h2x_options* options)
+{
+    if(strcmp(args[1], "epoll") == 0)
+    {
+        options->io_mode = H2X_IO_EPOLL;
+        return 0;
+    }
+    else if(strcmp(args[1], "uring") == 0)
+    {
+        options->io_mode = H2X_IO_URING;
+        return 0;
+    }
+
+    fprintf(stderr, "Unknown argument for --io option: %s\n", args[1]);
+    return -1;
+}
+
+static int parse_h2x_listener_mode(char** args, struct h2x_options* options)
+{
+    if(strcmp(args[1], "shared") == 0)
+    {
+        options->listener_mode = H2X_LISTENER_SHARED;
+        return 0;
+    }
+    else if(strcmp(args[1], "reuseport") == 0)
+    {
+        options->listener_mode = H2X_LISTENER_REUSEPORT;
+        return 0;
+    }
+
+    fprintf(stderr, "Unknown argument for --listener option: %s\n", args[1]);
+    return -1;
+}
+
+static int parse_h2x_affinity(char** args, struct h2x_options* options)
+{
+    options->pin_threads = true;
+
+    return 0;
+}
+
+static int parse_h2x_numa(char** args, struct h2x_options* options)
+{
+    options->pin_threads = true;
+    options->numa_aware = true;
+
+    return 0;
+}
+
+static int parse_h2x_max_window(char** args, struct h2x_options* options)
+{
+    long max_window = atol(args[1]);
+    if(max_window < H2X_DEFAULT_WINDOW_SIZE || max_window > H2X_MAX_WINDOW_SIZE)
+    {
+        fprintf(stderr, "Invalid value for --max_window option: %s\n", args[1]);
+        return -1;
+    }
+
+    options->max_receive_window = (uint32_t) max_window;
+
+    return 0;
+}
+
+static int parse_h2x_max_streams(char** args, struct h2x_options* options)
+{
+    options->max_concurrent_streams = atoi(args[1]);
+    if(options->max_concurrent_streams == 0)
+    {
+        fprintf(stderr, "Invalid value for --max_streams option: %s\n", args[1]);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parse_h2x_initial_window(char** args, struct h2x_options* options)
+{
+    long initial_window = atol(args[1]);
+    if(initial_window <= 0 || initial_window > H2X_MAX_WINDOW_SIZE)
+    {
+        fprintf(stderr, "Invalid value for --initial_window option: %s\n", args[1]);
+        return -1;
+    }
+
+    options->initial_window_size = (uint32_t) initial_window;
+
+    return 0;
+}
+
+static int parse_h2x_header_table_size(char** args, struct h2x_options* options)
+{
+    long header_table_size = atol(args[1]);
+    if(header_table_size < 0 || header_table_size > UINT32_MAX)
+    {
+        fprintf(stderr, "Invalid value for --header_table_size option: %s\n", args[1]);
+        return -1;
+    }
+
+    options->header_table_size = (uint32_t) header_table_size;
+
+    return 0;
+}
+
+static int parse_h2x_max_frame_size(char** args, struct h2x_options* options)
+{
+    long max_frame_size = atol(args[1]);
+    if(max_frame_size < H2X_MIN_MAX_FRAME_SIZE || max_frame_size > H2X_MAX_MAX_FRAME_SIZE)
+    {
+        fprintf(stderr, "Invalid value for --max_frame_size option: %s\n", args[1]);
+        return -1;
+    }
+
+    options->max_frame_size = (uint32_t) max_frame_size;
+
+    return 0;
+}
+
+static int parse_watermarks(char** args, char* option_name, uint32_t* low_watermark, uint32_t* high_watermark)
+{
+    long low = atol(args[1]);
+    long high = atol(args[2]);
+    if(low <= 0 || high < low || high > UINT32_MAX)
+    {
+        fprintf(stderr, "Invalid values for %s option: %s %s\n", option_name, args[1], args[2]);
+        return -1;
+    }
+
+    *low_watermark = (uint32_t) low;
+    *high_watermark = (uint32_t) high;
+
+    return 0;
+}
+
+static int parse_h2x_conn_watermarks(char** args, struct h2x_options* options)
+{
+    return parse_watermarks(args, "--conn_watermarks", &options->connection_write_low_watermark, &options->connection_write_high_watermark);
+}
+
+static int parse_h2x_stream_watermarks(char** args, struct h2x_options* options)
+{
+    return parse_watermarks(args, "--stream_watermarks", &options->stream_write_low_watermark, &options->stream_write_high_watermark);
+}
+
 static int parse_h2x_log_level(char** args, struct h2x_options* options)
 {
     options->log_level = string_to_h2x_log_level(args[1]);
@@ -128,6 +288,17 @@ h2x_option_parser option_parsers[] = {
     { "--port", 1, parse_h2x_port, "(server required) what port to listen for connections on" },
     { "--threads", 1, parse_h2x_threads, "(server) number of threads to process connections on; defaults to 1" },
     { "--conn", 1, parse_h2x_conn, "(server) maximum number of connections per thread; defaults to 1000" },
+    { "--io", 1, parse_h2x_io_mode, "how processing threads drive socket io [epoll|uring]; defaults to epoll" },
+    { "--listener", 1, parse_h2x_listener_mode, "(server) who accepts connections [shared|reuseport]; reuseport gives every thread its own listener; defaults to shared" },
+    { "--affinity", 0, parse_h2x_affinity, "pin each processing thread to its own core" },
+    { "--numa", 0, parse_h2x_numa, "(server) pin threads spread across NUMA nodes and keep each connection on a thread local to the node it arrived on; implies --affinity" },
+    { "--max_streams", 1, parse_h2x_max_streams, "most streams the peer may have open at once on a connection (SETTINGS_MAX_CONCURRENT_STREAMS); defaults to 128" },
+    { "--initial_window", 1, parse_h2x_initial_window, "flow control window, in bytes, that streams the peer sends on start with (SETTINGS_INITIAL_WINDOW_SIZE); defaults to 65535" },
+    { "--header_table_size", 1, parse_h2x_header_table_size, "largest HPACK dynamic table, in bytes, the peer's encoder may use (SETTINGS_HEADER_TABLE_SIZE); defaults to 4096" },
+    { "--max_frame_size", 1, parse_h2x_max_frame_size, "largest frame payload, in bytes, the peer may send (SETTINGS_MAX_FRAME_SIZE) [16384-16777215]; defaults to 16384" },
+    { "--max_window", 1, parse_h2x_max_window, "largest flow control window, in bytes, that receive windows auto-tune up to; defaults to 16777216" },
+    { "--conn_watermarks", 2, parse_h2x_conn_watermarks, "(client) bytes queued to send on a connection at which request bodies stop being pulled, and below which they resume [low high]; defaults to 262144 1048576" },
+    { "--stream_watermarks", 2, parse_h2x_stream_watermarks, "(client) the same, for what's queued on a single stream [low high]; defaults to 65536 262144" },
     { "--log_level", 1, parse_h2x_log_level, "sets the logging level for the process [Off | Fatal | Error | Warn | Info | Debug | Trace]" },
     { "--log_dest", 1, parse_h2x_log_dest, "sets the logging destination for the process [None | Stderr | File]" },
     { "--log_filename", 1, parse_h2x_log_filename, "when logging to a file, sets the filename (defaults to h2x.log)" },
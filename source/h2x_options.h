@@ -14,6 +14,19 @@ struct h2x_options {
     uint16_t port;
     uint32_t threads;
     uint32_t connections_per_thread;
+    h2x_io_mode io_mode;
+    h2x_listener_mode listener_mode;
+    bool pin_threads;
+    bool numa_aware;
+    uint32_t max_receive_window;
+    uint32_t max_concurrent_streams;
+    uint32_t initial_window_size;
+    uint32_t header_table_size;
+    uint32_t max_frame_size;
+    uint32_t connection_write_low_watermark;
+    uint32_t connection_write_high_watermark;
+    uint32_t stream_write_low_watermark;
+    uint32_t stream_write_high_watermark;
 
     h2x_log_level log_level;
     h2x_log_dest log_dest;
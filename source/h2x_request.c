@@ -6,7 +6,7 @@
 
 void h2x_request_init(struct h2x_request* request, struct h2x_connection* connection, void* user_data)
 {
-    h2x_header_list_init(&request->header_list);
+    h2x_header_block_init(&request->headers, 0);
     request->connection = connection;
     request->user_data = user_data;
     request->next = NULL;
@@ -15,16 +15,14 @@ void h2x_request_init(struct h2x_request* request, struct h2x_connection* connec
 
 void h2x_request_cleanup(struct h2x_request* request)
 {
-    h2x_header_list_cleanup(&request->header_list);
+    h2x_header_block_cleanup(&request->headers);
     request->connection = NULL;
     request->user_data = NULL;
 }
 
 void h2x_headers_add(struct h2x_request* request, char* name, char* value)
 {
-    struct h2x_header header;
-    h2x_header_init(&header, name, value);
-    h2x_header_list_append(&request->header_list, header);
+    h2x_header_block_append(&request->headers, name, strlen(name), value, strlen(value));
 }
 
 void h2x_headers_set_user_data(struct h2x_request* request, void* user_data)
@@ -6,7 +6,7 @@
 struct h2x_request {
     struct h2x_connection* connection;
     void* user_data;
-    struct h2x_header_list header_list;
+    struct h2x_header_block headers;
     struct h2x_request* next;
 
     uint32_t stream_id;
@@ -16,6 +16,7 @@ void h2x_request_init(struct h2x_request* request, struct h2x_connection* connec
 
 void h2x_request_cleanup(struct h2x_request* request);
 
+// copies the name and value into the request's header block
 void h2x_headers_add(struct h2x_request* request, char* name, char* value);
 
 void h2x_headers_set_user_data(struct h2x_request* request, void*);
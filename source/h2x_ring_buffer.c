@@ -0,0 +1,243 @@
+
+#include <h2x_ring_buffer.h>
+
+#include <h2x_log.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct h2x_ring_buffer_retired {
+    uint8_t* data;
+    struct h2x_ring_buffer_retired* next;
+};
+
+static void free_retired(struct h2x_ring_buffer* ring)
+{
+    while(ring->retired)
+    {
+        struct h2x_ring_buffer_retired* next = ring->retired->next;
+        free(ring->retired->data);
+        free(ring->retired);
+        ring->retired = next;
+    }
+}
+
+void h2x_ring_buffer_init(struct h2x_ring_buffer* ring, uint32_t initial_capacity, uint32_t shrink_watermark)
+{
+    assert(initial_capacity > 0);
+
+    ring->data = NULL;
+    ring->capacity = 0;
+    ring->initial_capacity = initial_capacity;
+    ring->shrink_watermark = shrink_watermark;
+    ring->read_position = 0;
+    ring->write_position = 0;
+    ring->wrap_position = 0;
+    ring->used = 0;
+    ring->pinned = false;
+    ring->retired = NULL;
+}
+
+void h2x_ring_buffer_cleanup(struct h2x_ring_buffer* ring)
+{
+    free_retired(ring);
+    free(ring->data);
+    ring->data = NULL;
+    ring->capacity = 0;
+    ring->read_position = 0;
+    ring->write_position = 0;
+    ring->wrap_position = 0;
+    ring->used = 0;
+}
+
+static bool is_wrapped(struct h2x_ring_buffer* ring)
+{
+    return ring->wrap_position != 0;
+}
+
+static void resize(struct h2x_ring_buffer* ring, uint32_t new_capacity)
+{
+    assert(new_capacity >= ring->used);
+
+    uint8_t* new_data = malloc(new_capacity);
+
+    struct iovec segments[H2X_RING_BUFFER_MAX_SEGMENTS];
+    uint32_t total_size = 0;
+    uint32_t segment_count = h2x_ring_buffer_get_read_segments(ring, segments, &total_size);
+    uint32_t copied = 0;
+    for(uint32_t i = 0; i < segment_count; ++i)
+    {
+        memcpy(new_data + copied, segments[i].iov_base, segments[i].iov_len);
+        copied += segments[i].iov_len;
+    }
+
+    H2X_LOG(H2X_LOG_LEVEL_TRACE, "Resizing ring buffer from %u to %u bytes with %u bytes in use", ring->capacity, new_capacity, ring->used);
+
+    if(ring->pinned)
+    {
+        struct h2x_ring_buffer_retired* retired = malloc(sizeof(struct h2x_ring_buffer_retired));
+        retired->data = ring->data;
+        retired->next = ring->retired;
+        ring->retired = retired;
+    }
+    else
+    {
+        free(ring->data);
+    }
+
+    ring->data = new_data;
+    ring->capacity = new_capacity;
+    ring->read_position = 0;
+    ring->write_position = copied;
+    ring->wrap_position = 0;
+}
+
+uint8_t* h2x_ring_buffer_reserve(struct h2x_ring_buffer* ring, uint32_t size)
+{
+    if(ring->data == NULL)
+    {
+        ring->capacity = ring->initial_capacity;
+        ring->data = malloc(ring->capacity);
+    }
+
+    if(is_wrapped(ring))
+    {
+        // only the gap between the writer and the reader is free
+        if(ring->read_position - ring->write_position >= size)
+        {
+            return ring->data + ring->write_position;
+        }
+    }
+    else
+    {
+        if(ring->capacity - ring->write_position >= size)
+        {
+            return ring->data + ring->write_position;
+        }
+
+        // wrap to the front if it fits ahead of the reader
+        if(ring->used > 0 && ring->read_position >= size)
+        {
+            ring->wrap_position = ring->write_position;
+            ring->write_position = 0;
+            return ring->data;
+        }
+    }
+
+    uint32_t new_capacity = ring->capacity;
+    while(new_capacity - ring->used < size)
+    {
+        new_capacity *= 2;
+    }
+
+    resize(ring, new_capacity);
+
+    return ring->data + ring->write_position;
+}
+
+void h2x_ring_buffer_commit(struct h2x_ring_buffer* ring, uint32_t size)
+{
+    assert(ring->write_position + size <= (is_wrapped(ring) ? ring->read_position : ring->capacity));
+
+    ring->write_position += size;
+    ring->used += size;
+}
+
+uint32_t h2x_ring_buffer_get_read_segments(struct h2x_ring_buffer* ring, struct iovec* segments, uint32_t* total_size)
+{
+    uint32_t segment_count = 0;
+    *total_size = ring->used;
+
+    if(ring->used == 0)
+    {
+        return 0;
+    }
+
+    if(is_wrapped(ring))
+    {
+        if(ring->wrap_position > ring->read_position)
+        {
+            segments[segment_count].iov_base = ring->data + ring->read_position;
+            segments[segment_count].iov_len = ring->wrap_position - ring->read_position;
+            ++segment_count;
+        }
+
+        if(ring->write_position > 0)
+        {
+            segments[segment_count].iov_base = ring->data;
+            segments[segment_count].iov_len = ring->write_position;
+            ++segment_count;
+        }
+    }
+    else
+    {
+        segments[segment_count].iov_base = ring->data + ring->read_position;
+        segments[segment_count].iov_len = ring->write_position - ring->read_position;
+        ++segment_count;
+    }
+
+    return segment_count;
+}
+
+void h2x_ring_buffer_consume(struct h2x_ring_buffer* ring, uint32_t size)
+{
+    assert(size <= ring->used);
+
+    ring->used -= size;
+
+    if(is_wrapped(ring))
+    {
+        uint32_t tail_size = ring->wrap_position - ring->read_position;
+        if(size < tail_size)
+        {
+            ring->read_position += size;
+            return;
+        }
+
+        ring->read_position = size - tail_size;
+        ring->wrap_position = 0;
+    }
+    else
+    {
+        ring->read_position += size;
+    }
+
+    if(ring->used == 0)
+    {
+        ring->read_position = 0;
+        ring->write_position = 0;
+
+        if(ring->capacity > ring->shrink_watermark && !ring->pinned)
+        {
+            H2X_LOG(H2X_LOG_LEVEL_TRACE, "Shrinking drained ring buffer from %u to %u bytes", ring->capacity, ring->initial_capacity);
+
+            free(ring->data);
+            ring->data = NULL;
+            ring->capacity = 0;
+        }
+    }
+}
+
+void h2x_ring_buffer_pin(struct h2x_ring_buffer* ring)
+{
+    assert(!ring->pinned);
+    ring->pinned = true;
+}
+
+void h2x_ring_buffer_unpin(struct h2x_ring_buffer* ring)
+{
+    assert(ring->pinned);
+    ring->pinned = false;
+    free_retired(ring);
+}
+
+uint32_t h2x_ring_buffer_get_used(struct h2x_ring_buffer* ring)
+{
+    return ring->used;
+}
+
+bool h2x_ring_buffer_is_empty(struct h2x_ring_buffer* ring)
+{
+    return ring->used == 0;
+}
@@ -0,0 +1,55 @@
+
+#ifndef H2X_RING_BUFFER_H
+#define H2X_RING_BUFFER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define H2X_RING_BUFFER_MAX_SEGMENTS 2
+
+struct h2x_ring_buffer_retired;
+
+/*
+ * A byte ring that hands out contiguous reservations so callers can serialize directly into it.
+ * When a reservation doesn't fit in the space left at the end of the buffer, the writer wraps to the
+ * front and the tail end (wrap_position) is remembered so the reader knows where valid data stops.
+ * Readable data is therefore at most two segments: [read, wrap) and [0, write).
+ *
+ * The buffer doubles when a reservation doesn't fit anywhere, and drops back to its initial
+ * capacity once it has fully drained while above the shrink watermark.
+ *
+ * While pinned (ie the kernel is asynchronously reading the readable segments), a resize keeps the
+ * old storage alive until the ring is unpinned.
+ */
+struct h2x_ring_buffer {
+    uint8_t* data;
+    uint32_t capacity;
+    uint32_t initial_capacity;
+    uint32_t shrink_watermark;
+
+    uint32_t read_position;
+    uint32_t write_position;
+    uint32_t wrap_position;     // 0 unless the writer has wrapped around behind the reader
+    uint32_t used;
+
+    bool pinned;
+    struct h2x_ring_buffer_retired* retired;
+};
+
+void h2x_ring_buffer_init(struct h2x_ring_buffer* ring, uint32_t initial_capacity, uint32_t shrink_watermark);
+void h2x_ring_buffer_cleanup(struct h2x_ring_buffer* ring);
+
+uint8_t* h2x_ring_buffer_reserve(struct h2x_ring_buffer* ring, uint32_t size);
+void h2x_ring_buffer_commit(struct h2x_ring_buffer* ring, uint32_t size);
+
+uint32_t h2x_ring_buffer_get_read_segments(struct h2x_ring_buffer* ring, struct iovec* segments, uint32_t* total_size);
+void h2x_ring_buffer_consume(struct h2x_ring_buffer* ring, uint32_t size);
+
+void h2x_ring_buffer_pin(struct h2x_ring_buffer* ring);
+void h2x_ring_buffer_unpin(struct h2x_ring_buffer* ring);
+
+uint32_t h2x_ring_buffer_get_used(struct h2x_ring_buffer* ring);
+bool h2x_ring_buffer_is_empty(struct h2x_ring_buffer* ring);
+
+#endif // H2X_RING_BUFFER_H
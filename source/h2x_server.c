@@ -30,38 +30,35 @@ static int handle_quit_command(int argc, char** argv, void* context)
     return 0;
 }
 
-void modified_echo_header_callback(struct h2x_connection* connection, struct h2x_header_list* headers, uint32_t stream_id, void* user_data)
+void modified_echo_header_callback(struct h2x_connection* connection, struct h2x_header_view* headers, uint32_t header_count, uint32_t stream_id, void* user_data)
 {
-    struct h2x_header_list* new_headers = malloc(sizeof(struct h2x_header_list));
-    h2x_header_list_init(new_headers);
+    uint32_t arena_size = 32;
+    for(uint32_t i = 0; i < header_count; ++i)
+    {
+        arena_size += headers[i].name_length + headers[i].value_length + 2;
+    }
 
-    h2x_header_reset_iter(headers);
+    struct h2x_header_block new_headers;
+    h2x_header_block_init(&new_headers, arena_size);
 
     H2X_LOG(H2X_LOG_LEVEL_INFO, "Server received request headers on stream %u, connection %d:", stream_id, connection->fd)
 
-    struct h2x_header* header = h2x_header_next(headers);
-    while(header)
+    for(uint32_t i = 0; i < header_count; ++i)
     {
-        H2X_LOG(H2X_LOG_LEVEL_INFO, " %s = %s", header->name, header->value)
+        struct h2x_header_view* header = &headers[i];
 
-        struct h2x_header new_header;
-        new_header.name = strdup(header->name);
-        new_header.value = strdup(header->value);
+        H2X_LOG(H2X_LOG_LEVEL_INFO, " %.*s = %.*s", (int) header->name_length, header->name, (int) header->value_length, header->value)
 
-        h2x_header_list_append(new_headers, new_header);
-        header = h2x_header_next(headers);
+        h2x_header_block_append(&new_headers, header->name, header->name_length, header->value, header->value_length);
     }
 
-    struct h2x_header response_code_header;
-    response_code_header.name = strdup("response-code");
-
     char buffer[256];
-    sprintf(buffer, "%d", 200);
-    response_code_header.value = strdup(buffer);
+    int value_length = sprintf(buffer, "%d", 200);
+    h2x_header_block_append(&new_headers, "response-code", strlen("response-code"), buffer, value_length);
 
-    h2x_header_list_append(new_headers, response_code_header);
+    h2x_push_headers(connection, stream_id, &new_headers);
 
-    h2x_push_headers(connection, stream_id, new_headers);
+    h2x_header_block_cleanup(&new_headers);
 }
 
 char *response_append_string = " is what you sent me";
@@ -105,6 +102,12 @@ void modified_echo_body_callback(struct h2x_connection* connection, uint8_t* dat
     free(response_data);
 }
 
+static void on_server_connection_accepted(struct h2x_connection* connection)
+{
+    h2x_connection_set_stream_header_views_received_callback(connection, modified_echo_header_callback);
+    h2x_connection_set_stream_body_receieved_callback(connection, modified_echo_body_callback);
+}
+
 struct command_def server_commands[] = {
     { "quit", 0, false, handle_quit_command, "shuts down the server" }
 };
@@ -119,68 +122,6 @@ static struct h2x_connection_manager* create_connection_manager(struct h2x_optio
     return manager;
 }
 
-static int create_listener_socket(struct h2x_options* options)
-{
-    struct addrinfo hints;
-    struct addrinfo *result, *rp;
-    int ret_val, socket_fd;
-
-    memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;
-
-    char port[20];
-    sprintf(port, "%d", options->port);
-
-    ret_val = getaddrinfo(NULL, port, &hints, &result);
-    if(ret_val != 0)
-    {
-        H2X_LOG(H2X_LOG_LEVEL_FATAL, "Error %d (errno %d) calling getaddrinfo: %s", ret_val, errno, gai_strerror(ret_val));
-        return -1;
-    }
-
-    for(rp = result; rp != NULL; rp = rp->ai_next)
-    {
-        socket_fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if(socket_fd == -1)
-        {
-            continue;
-        }
-
-        ret_val = bind(socket_fd, rp->ai_addr, rp->ai_addrlen);
-        if (ret_val == 0)
-        {
-            break;
-        }
-
-        close(socket_fd);
-    }
-
-    if(rp == NULL)
-    {
-        return -1;
-    }
-
-    freeaddrinfo(result);
-
-    if(h2x_make_socket_nonblocking(socket_fd))
-    {
-        H2X_LOG(H2X_LOG_LEVEL_FATAL, "Failed to make listener socket non blocking");
-        close(socket_fd);
-        return -1;
-    }
-
-    if(listen(socket_fd, SOMAXCONN))
-    {
-        H2X_LOG(H2X_LOG_LEVEL_FATAL, "Failed to set socket as passive listener");
-        close(socket_fd);
-        return -1;
-    }
-
-    return socket_fd;
-}
-
 #define LISTENER_EVENT_COUNT 2
 #define READ_BUFFER_SIZE 8192
 #define STDIN_BUFFER_SIZE 512
@@ -200,11 +141,21 @@ void h2x_do_server(struct h2x_options* options)
     events = calloc(LISTENER_EVENT_COUNT, sizeof(struct epoll_event));
     struct h2x_connection_manager* manager = create_connection_manager(options);
 
-    listener_fd = create_listener_socket(options);
-    if(listener_fd < 0)
+    if(options->listener_mode == H2X_LISTENER_REUSEPORT)
     {
-        H2X_LOG(H2X_LOG_LEVEL_FATAL, "Unable to create and bind listener socket, errno = %d", errno);
-        return;
+        if(h2x_connection_manager_add_reuseport_listeners(manager, on_server_connection_accepted))
+        {
+            goto CLEANUP;
+        }
+    }
+    else
+    {
+        listener_fd = h2x_create_listener_socket(options->port, false);
+        if(listener_fd < 0)
+        {
+            H2X_LOG(H2X_LOG_LEVEL_FATAL, "Unable to create and bind listener socket, errno = %d", errno);
+            goto CLEANUP;
+        }
     }
 
     if(h2x_make_socket_nonblocking(STDIN_FILENO))
@@ -220,14 +171,17 @@ void h2x_do_server(struct h2x_options* options)
         goto CLEANUP;
     }
 
-    /* Add the listener socket */
-    event.data.fd = listener_fd;
-    event.events = EPOLLIN | EPOLLET | EPOLLPRI | EPOLLERR;
-    ret_val = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener_fd, &event);
-    if(ret_val == -1)
+    /* Add the listener socket; with per-thread listeners the processing threads accept instead */
+    if(listener_fd != -1)
     {
-        H2X_LOG(H2X_LOG_LEVEL_FATAL, "Unable to register listener socket with epoll instance");
-        goto CLEANUP;
+        event.data.fd = listener_fd;
+        event.events = EPOLLIN | EPOLLET | EPOLLPRI | EPOLLERR;
+        ret_val = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener_fd, &event);
+        if(ret_val == -1)
+        {
+            H2X_LOG(H2X_LOG_LEVEL_FATAL, "Unable to register listener socket with epoll instance");
+            goto CLEANUP;
+        }
     }
 
     /* Add stdin for server commands */
@@ -285,9 +239,7 @@ void h2x_do_server(struct h2x_options* options)
                         continue;
                     }
 
-                    struct h2x_connection* server_connection = h2x_connection_manager_add_connection(manager, incoming_fd);
-                    h2x_connection_set_stream_headers_receieved_callback(server_connection, modified_echo_header_callback);
-                    h2x_connection_set_stream_body_receieved_callback(server_connection, modified_echo_body_callback);
+                    h2x_connection_manager_add_connection(manager, incoming_fd, on_server_connection_accepted);
                 }
             }
             else
@@ -311,6 +263,7 @@ void h2x_do_server(struct h2x_options* options)
         }
 
         h2x_connection_manager_pump_closed_connections(manager);
+        h2x_connection_manager_balance_load(manager);
     }
 
 CLEANUP:
@@ -0,0 +1,104 @@
+#include <h2x_settings.h>
+
+#include <h2x_flow_control.h>
+#include <h2x_frame.h>
+#include <h2x_hpack.h>
+#include <h2x_net_shared.h>
+#include <h2x_options.h>
+
+void h2x_settings_init(struct h2x_settings* settings)
+{
+    settings->header_table_size = H2X_HPACK_DEFAULT_TABLE_SIZE;
+    settings->enable_push = 1;
+    settings->max_concurrent_streams = H2X_SETTING_UNLIMITED;
+    settings->initial_window_size = H2X_DEFAULT_WINDOW_SIZE;
+    settings->max_frame_size = H2X_MIN_MAX_FRAME_SIZE;
+    settings->max_header_list_size = H2X_SETTING_UNLIMITED;
+}
+
+void h2x_settings_init_local(struct h2x_settings* settings, struct h2x_options* options)
+{
+    h2x_settings_init(settings);
+
+    settings->header_table_size = options->header_table_size;
+    settings->max_concurrent_streams = options->max_concurrent_streams;
+    settings->initial_window_size = options->initial_window_size;
+    settings->max_frame_size = options->max_frame_size;
+
+    // nothing here is prepared to receive a pushed stream
+    if(options->mode == H2X_MODE_CLIENT)
+    {
+        settings->enable_push = 0;
+    }
+}
+
+h2x_connection_error h2x_settings_check(uint32_t setting_id, uint32_t value)
+{
+    switch(setting_id)
+    {
+        case H2X_SETTINGS_ENABLE_PUSH:
+            return value > 1 ? H2X_PROTOCOL_ERROR : H2X_NO_ERROR;
+        case H2X_SETTINGS_INITIAL_WINDOW_SIZE:
+            return value > H2X_MAX_WINDOW_SIZE ? H2X_FLOW_CONTROL_ERROR : H2X_NO_ERROR;
+        case H2X_SETTINGS_MAX_FRAME_SIZE:
+            return value < H2X_MIN_MAX_FRAME_SIZE || value > H2X_MAX_MAX_FRAME_SIZE ? H2X_PROTOCOL_ERROR : H2X_NO_ERROR;
+        default:
+            return H2X_NO_ERROR;
+    }
+}
+
+void h2x_settings_set(struct h2x_settings* settings, uint32_t setting_id, uint32_t value)
+{
+    switch(setting_id)
+    {
+        case H2X_SETTINGS_HEADER_TABLE_SIZE:
+            settings->header_table_size = value;
+            break;
+        case H2X_SETTINGS_ENABLE_PUSH:
+            settings->enable_push = value;
+            break;
+        case H2X_SETTINGS_MAX_CONCURRENT_STREAMS:
+            settings->max_concurrent_streams = value;
+            break;
+        case H2X_SETTINGS_INITIAL_WINDOW_SIZE:
+            settings->initial_window_size = value;
+            break;
+        case H2X_SETTINGS_MAX_FRAME_SIZE:
+            settings->max_frame_size = value;
+            break;
+        case H2X_SETTINGS_MAX_HEADER_LIST_SIZE:
+            settings->max_header_list_size = value;
+            break;
+        default:
+            break;
+    }
+}
+
+static uint32_t encode_setting(uint8_t* payload, uint32_t length, h2x_settings_id setting_id, uint32_t value, uint32_t default_value)
+{
+    if(value == default_value)
+    {
+        return length;
+    }
+
+    h2x_set_integer_as_big_endian(payload + length, setting_id, 2);
+    h2x_set_integer_as_big_endian(payload + length + 2, value, 4);
+
+    return length + SETTINGS_ENTRY_LENGTH;
+}
+
+uint32_t h2x_settings_encode(struct h2x_settings* settings, uint8_t* payload)
+{
+    struct h2x_settings defaults;
+    h2x_settings_init(&defaults);
+
+    uint32_t length = 0;
+    length = encode_setting(payload, length, H2X_SETTINGS_HEADER_TABLE_SIZE, settings->header_table_size, defaults.header_table_size);
+    length = encode_setting(payload, length, H2X_SETTINGS_ENABLE_PUSH, settings->enable_push, defaults.enable_push);
+    length = encode_setting(payload, length, H2X_SETTINGS_MAX_CONCURRENT_STREAMS, settings->max_concurrent_streams, defaults.max_concurrent_streams);
+    length = encode_setting(payload, length, H2X_SETTINGS_INITIAL_WINDOW_SIZE, settings->initial_window_size, defaults.initial_window_size);
+    length = encode_setting(payload, length, H2X_SETTINGS_MAX_FRAME_SIZE, settings->max_frame_size, defaults.max_frame_size);
+    length = encode_setting(payload, length, H2X_SETTINGS_MAX_HEADER_LIST_SIZE, settings->max_header_list_size, defaults.max_header_list_size);
+
+    return length;
+}
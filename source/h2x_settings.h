@@ -0,0 +1,51 @@
+#ifndef H2X_SETTINGS_H
+#define H2X_SETTINGS_H
+
+#include <h2x_enum_types.h>
+#include <h2x_frame.h>
+
+#include <stdint.h>
+
+struct h2x_options;
+
+//per rfc7540 section 4.2, the range SETTINGS_MAX_FRAME_SIZE may take
+#define H2X_MIN_MAX_FRAME_SIZE 0x4000
+#define H2X_MAX_MAX_FRAME_SIZE 0xFFFFFF
+
+// stands in for the settings the rfc leaves unlimited until the peer says otherwise
+#define H2X_SETTING_UNLIMITED UINT32_MAX
+
+/*
+ * One endpoint's view of the SETTINGS parameters (rfc7540 6.5.2).  A connection keeps two: the ones we
+ * advertise and the ones the peer has sent us.
+ */
+struct h2x_settings {
+    uint32_t header_table_size;
+    uint32_t enable_push;
+    uint32_t max_concurrent_streams;
+    uint32_t initial_window_size;
+    uint32_t max_frame_size;
+    uint32_t max_header_list_size;
+};
+
+// the values every endpoint assumes before the first SETTINGS frame arrives
+void h2x_settings_init(struct h2x_settings* settings);
+
+// what we advertise, as configured
+void h2x_settings_init_local(struct h2x_settings* settings, struct h2x_options* options);
+
+/*
+ * The error a SETTINGS entry with this value amounts to, or H2X_NO_ERROR if it's acceptable.  Unknown
+ * identifiers are acceptable and ignored.
+ */
+h2x_connection_error h2x_settings_check(uint32_t setting_id, uint32_t value);
+void h2x_settings_set(struct h2x_settings* settings, uint32_t setting_id, uint32_t value);
+
+/*
+ * Writes a SETTINGS payload carrying every parameter that differs from the rfc default, returning
+ * its length
+ */
+#define H2X_SETTINGS_MAX_PAYLOAD_LENGTH (6 * SETTINGS_ENTRY_LENGTH)
+uint32_t h2x_settings_encode(struct h2x_settings* settings, uint8_t* payload);
+
+#endif // H2X_SETTINGS_H
@@ -2,8 +2,10 @@
 #include <h2x_stream.h>
 #include <h2x_frame.h>
 #include <h2x_log.h>
+#include <h2x_stream_scheduler.h>
 
-#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
 void h2x_stream_init(struct h2x_stream* stream)
 {
@@ -11,12 +13,80 @@ void h2x_stream_init(struct h2x_stream* stream)
     stream->state = H2X_IDLE;
     h2x_frame_list_init(&stream->header_fragments);
     stream->end_header_sent = false;
+    stream->reset_locally = false;
+    stream->is_refused = false;
     stream->user_data = NULL;
+    stream->send_window = H2X_DEFAULT_WINDOW_SIZE;
+    h2x_receive_window_init(&stream->receive_window, H2X_DEFAULT_WINDOW_SIZE);
+    stream->dependency = 0;
+    stream->weight = H2X_DEFAULT_STREAM_WEIGHT;
+    stream->pending_data = NULL;
+    stream->pending_offset = 0;
+    stream->pending_length = 0;
+    stream->pending_capacity = 0;
+    stream->pending_end_stream = false;
+    stream->has_pending_reset = false;
+    stream->is_write_paused = false;
+    stream->is_scheduled = false;
+    stream->turn_remaining = 0;
+    stream->scheduled_next = NULL;
+    stream->scheduled_prev = NULL;
+    stream->pool_next = NULL;
 }
 
 void h2x_stream_clean(struct h2x_stream* stream)
 {
     h2x_frame_list_clean(&stream->header_fragments);
+    h2x_stream_discard_pending_data(stream);
+}
+
+void h2x_stream_append_pending_data(struct h2x_stream* stream, uint8_t* data, uint32_t size)
+{
+    if(stream->pending_length + size > stream->pending_capacity - stream->pending_offset)
+    {
+        // slide what's left to the front before deciding whether to grow
+        if(stream->pending_offset > 0)
+        {
+            memmove(stream->pending_data, stream->pending_data + stream->pending_offset, stream->pending_length);
+            stream->pending_offset = 0;
+        }
+
+        if(stream->pending_length + size > stream->pending_capacity)
+        {
+            uint32_t capacity = stream->pending_capacity ? stream->pending_capacity : 4096;
+            while(capacity < stream->pending_length + size)
+            {
+                capacity *= 2;
+            }
+
+            stream->pending_data = realloc(stream->pending_data, capacity);
+            stream->pending_capacity = capacity;
+        }
+    }
+
+    memcpy(stream->pending_data + stream->pending_offset + stream->pending_length, data, size);
+    stream->pending_length += size;
+}
+
+void h2x_stream_consume_pending_data(struct h2x_stream* stream, uint32_t size)
+{
+    stream->pending_offset += size;
+    stream->pending_length -= size;
+    if(stream->pending_length == 0)
+    {
+        stream->pending_offset = 0;
+    }
+}
+
+void h2x_stream_discard_pending_data(struct h2x_stream* stream)
+{
+    free(stream->pending_data);
+    stream->pending_data = NULL;
+    stream->pending_offset = 0;
+    stream->pending_length = 0;
+    stream->pending_capacity = 0;
+    stream->pending_end_stream = false;
+    stream->has_pending_reset = false;
 }
 
 void h2x_stream_append_header_fragment(struct h2x_stream* stream, struct h2x_frame* frame)
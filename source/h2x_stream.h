@@ -2,6 +2,7 @@
 #define H2X_STREAM_H
 
 #include <h2x_enum_types.h>
+#include <h2x_flow_control.h>
 #include <h2x_frame.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -16,12 +17,43 @@ struct h2x_stream
     void* user_data;
     struct h2x_frame_list header_fragments;
     bool end_header_sent;
+    bool reset_locally;     // closed by a RST_STREAM we sent, so the peer's frames in flight are ignored
+    bool is_refused;        // opened by the peer past our SETTINGS_MAX_CONCURRENT_STREAMS; reset as soon as it's read
+
+    int64_t send_window;
+    struct h2x_receive_window receive_window;
+
+    // rfc7540 5.3, as the peer last set it; a dependency on a stream that's gone counts as one on the root
+    uint32_t dependency;
+    uint16_t weight;
+
+    /*
+     Outbound DATA that hasn't gone out yet, in the order it was pushed.  While any is waiting the
+     stream is on its connection's scheduler.
+     */
+    uint8_t* pending_data;
+    uint32_t pending_offset;
+    uint32_t pending_length;
+    uint32_t pending_capacity;
+    bool pending_end_stream;
+    bool has_pending_reset;         // a NO_ERROR reset pushed behind pending data goes out after it
+    bool is_write_paused;           // pending data reached the stream's high watermark and hasn't drained below the low one
+    bool is_scheduled;
+    uint32_t turn_remaining;        // bytes left of the stream's current turn on the scheduler
+    struct h2x_stream* scheduled_next;
+    struct h2x_stream* scheduled_prev;
+
+    struct h2x_stream* pool_next;
 };
 
 void h2x_stream_init(struct h2x_stream* stream);
 
 void h2x_stream_clean(struct h2x_stream* stream);
 
+void h2x_stream_append_pending_data(struct h2x_stream* stream, uint8_t* data, uint32_t size);
+void h2x_stream_consume_pending_data(struct h2x_stream* stream, uint32_t size);
+void h2x_stream_discard_pending_data(struct h2x_stream* stream);
+
 void h2x_stream_append_header_fragment(struct h2x_stream* stream, struct h2x_frame* frame);
 
 void h2x_stream_set_state(struct h2x_stream* stream, h2x_stream_state state);
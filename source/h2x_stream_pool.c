@@ -0,0 +1,70 @@
+#include <h2x_stream_pool.h>
+
+#include <h2x_log.h>
+#include <h2x_stream.h>
+
+#include <stdlib.h>
+
+void h2x_stream_pool_init(struct h2x_stream_pool* pool, uint32_t max_free_count)
+{
+    pool->free_streams = NULL;
+    pool->free_count = 0;
+    pool->max_free_count = max_free_count;
+    pool->hits = 0;
+    pool->misses = 0;
+}
+
+void h2x_stream_pool_cleanup(struct h2x_stream_pool* pool)
+{
+    struct h2x_stream* stream = pool->free_streams;
+    while(stream)
+    {
+        struct h2x_stream* next_stream = stream->pool_next;
+        free(stream);
+        stream = next_stream;
+    }
+
+    pool->free_streams = NULL;
+    pool->free_count = 0;
+}
+
+struct h2x_stream* h2x_stream_pool_acquire(struct h2x_stream_pool* pool)
+{
+    struct h2x_stream* stream = pool->free_streams;
+    if(stream)
+    {
+        ++pool->hits;
+        pool->free_streams = stream->pool_next;
+        --pool->free_count;
+    }
+    else
+    {
+        ++pool->misses;
+        stream = malloc(sizeof(struct h2x_stream));
+    }
+
+    h2x_stream_init(stream);
+
+    return stream;
+}
+
+void h2x_stream_pool_release(struct h2x_stream_pool* pool, struct h2x_stream* stream)
+{
+    h2x_stream_clean(stream);
+
+    if(pool->free_count >= pool->max_free_count)
+    {
+        free(stream);
+        return;
+    }
+
+    stream->pool_next = pool->free_streams;
+    pool->free_streams = stream;
+    ++pool->free_count;
+}
+
+void h2x_stream_pool_log_stats(struct h2x_stream_pool* pool, uint32_t thread_id)
+{
+    H2X_LOG(H2X_LOG_LEVEL_INFO, "Thread %u stream pool - hits:%llu, misses:%llu, free:%u", thread_id,
+            (unsigned long long) pool->hits, (unsigned long long) pool->misses, pool->free_count);
+}
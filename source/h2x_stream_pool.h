@@ -0,0 +1,34 @@
+#ifndef H2X_STREAM_POOL_H
+#define H2X_STREAM_POOL_H
+
+#include <stdint.h>
+
+struct h2x_stream;
+
+/*
+ * Retired streams are recycled through a free list rather than going back to the heap, since a busy
+ * connection opens and closes them at the request rate.
+ *
+ * Not thread-safe; each processing thread owns one, and every stream of that thread's connections is
+ * acquired and released through it.  A migrated connection's streams simply end up in the new owner's
+ * pool when they retire.
+ */
+struct h2x_stream_pool {
+    struct h2x_stream* free_streams;
+    uint32_t free_count;
+    uint32_t max_free_count;
+
+    uint64_t hits;
+    uint64_t misses;
+};
+
+void h2x_stream_pool_init(struct h2x_stream_pool* pool, uint32_t max_free_count);
+void h2x_stream_pool_cleanup(struct h2x_stream_pool* pool);
+
+// returns an initialized stream
+struct h2x_stream* h2x_stream_pool_acquire(struct h2x_stream_pool* pool);
+void h2x_stream_pool_release(struct h2x_stream_pool* pool, struct h2x_stream* stream);
+
+void h2x_stream_pool_log_stats(struct h2x_stream_pool* pool, uint32_t thread_id);
+
+#endif // H2X_STREAM_POOL_H
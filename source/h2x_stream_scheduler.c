@@ -0,0 +1,84 @@
+#include <h2x_stream_scheduler.h>
+
+#include <h2x_stream.h>
+
+#include <stddef.h>
+
+void h2x_stream_scheduler_init(struct h2x_stream_scheduler* scheduler)
+{
+    scheduler->current = NULL;
+    scheduler->count = 0;
+}
+
+void h2x_stream_scheduler_add(struct h2x_stream_scheduler* scheduler, struct h2x_stream* stream)
+{
+    struct h2x_stream* current = scheduler->current;
+    if(current == NULL)
+    {
+        stream->scheduled_next = stream;
+        stream->scheduled_prev = stream;
+        scheduler->current = stream;
+    }
+    else
+    {
+        stream->scheduled_next = current;
+        stream->scheduled_prev = current->scheduled_prev;
+        current->scheduled_prev->scheduled_next = stream;
+        current->scheduled_prev = stream;
+    }
+
+    stream->is_scheduled = true;
+    ++scheduler->count;
+}
+
+void h2x_stream_scheduler_remove(struct h2x_stream_scheduler* scheduler, struct h2x_stream* stream)
+{
+    if(--scheduler->count == 0)
+    {
+        scheduler->current = NULL;
+    }
+    else
+    {
+        stream->scheduled_prev->scheduled_next = stream->scheduled_next;
+        stream->scheduled_next->scheduled_prev = stream->scheduled_prev;
+        if(scheduler->current == stream)
+        {
+            scheduler->current = stream->scheduled_next;
+        }
+    }
+
+    stream->is_scheduled = false;
+    stream->turn_remaining = 0;
+    stream->scheduled_next = NULL;
+    stream->scheduled_prev = NULL;
+}
+
+uint32_t h2x_stream_scheduler_get_turn(struct h2x_stream_scheduler* scheduler)
+{
+    struct h2x_stream* stream = scheduler->current;
+    if(stream->turn_remaining == 0)
+    {
+        stream->turn_remaining = stream->weight * H2X_SCHEDULER_QUANTUM_PER_WEIGHT;
+    }
+
+    return stream->turn_remaining;
+}
+
+void h2x_stream_scheduler_use_turn(struct h2x_stream_scheduler* scheduler, uint32_t size)
+{
+    struct h2x_stream* stream = scheduler->current;
+    stream->turn_remaining = size < stream->turn_remaining ? stream->turn_remaining - size : 0;
+    if(stream->turn_remaining == 0)
+    {
+        scheduler->current = stream->scheduled_next;
+    }
+}
+
+void h2x_stream_scheduler_advance(struct h2x_stream_scheduler* scheduler)
+{
+    if(scheduler->current)
+    {
+        scheduler->current->turn_remaining = 0;
+        scheduler->current = scheduler->current->scheduled_next;
+    }
+}
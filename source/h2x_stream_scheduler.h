@@ -0,0 +1,51 @@
+#ifndef H2X_STREAM_SCHEDULER_H
+#define H2X_STREAM_SCHEDULER_H
+
+#include <stdint.h>
+
+struct h2x_stream;
+
+// rfc7540 5.3.5: what a stream gets until the peer says otherwise
+#define H2X_DEFAULT_STREAM_WEIGHT 16
+
+// the default weight gets one default-sized DATA frame per turn
+#define H2X_SCHEDULER_QUANTUM_PER_WEIGHT 1024
+
+// how far up the dependency tree anything looks before treating a stream as if it hung off the root
+#define H2X_MAX_PRIORITY_DEPTH 32
+
+/*
+ * Streams with DATA waiting to go out take turns in weighted round robin.  On its turn a stream may
+ * send up to its weight times H2X_SCHEDULER_QUANTUM_PER_WEIGHT bytes, so over a round each one gets
+ * a share of the connection in proportion to its weight and a small stream is never stuck behind a
+ * large one for more than a round.
+ *
+ * A turn the connection window cuts short isn't over: the stream picks up where it left off once
+ * there's room again, so weights still hold when the connection window is the bottleneck.
+ *
+ * The scheduled streams form a circular list through the streams themselves, with current the one
+ * whose turn it is.  Who is actually allowed to send on a turn (flow control, dependencies) is up to
+ * the connection.
+ */
+struct h2x_stream_scheduler
+{
+    struct h2x_stream* current;
+    uint32_t count;
+};
+
+void h2x_stream_scheduler_init(struct h2x_stream_scheduler* scheduler);
+
+// joins at the back of the round, just behind current
+void h2x_stream_scheduler_add(struct h2x_stream_scheduler* scheduler, struct h2x_stream* stream);
+void h2x_stream_scheduler_remove(struct h2x_stream_scheduler* scheduler, struct h2x_stream* stream);
+
+// what's left of current's turn, starting a new one if the last is over
+uint32_t h2x_stream_scheduler_get_turn(struct h2x_stream_scheduler* scheduler);
+
+// charges what current sent against its turn, moving on once the turn is used up
+void h2x_stream_scheduler_use_turn(struct h2x_stream_scheduler* scheduler, uint32_t size);
+
+// ends current's turn early
+void h2x_stream_scheduler_advance(struct h2x_stream_scheduler* scheduler);
+
+#endif // H2X_STREAM_SCHEDULER_H
@@ -0,0 +1,295 @@
+#include <h2x_stream_table.h>
+
+#include <h2x_stream.h>
+
+#include <stdlib.h>
+
+#define STREAM_TABLE_OVERFLOW_BUCKETS 16
+
+static uint32_t overflow_hash_function(void* data)
+{
+    return ((struct h2x_stream*) data)->stream_identifier;
+}
+
+static void ring_init(struct h2x_stream_ring* ring, uint32_t parity)
+{
+    ring->slots = NULL;
+    ring->capacity = 0;
+    ring->base_id = parity ? 1 : 2;
+    ring->count = 0;
+    ring->highest_id = 0;
+}
+
+static inline bool ring_covers(struct h2x_stream_ring* ring, uint32_t stream_id)
+{
+    return stream_id >= ring->base_id && ((stream_id - ring->base_id) >> 1) < ring->capacity;
+}
+
+static inline struct h2x_stream** ring_slot(struct h2x_stream_ring* ring, uint32_t stream_id)
+{
+    return &ring->slots[(stream_id >> 1) & (ring->capacity - 1)];
+}
+
+// skips the window past slots that have emptied since the oldest stream was added
+static void ring_advance_base(struct h2x_stream_ring* ring)
+{
+    while(ring->count > 0 && !*ring_slot(ring, ring->base_id))
+    {
+        ring->base_id += 2;
+    }
+}
+
+static void ring_resize(struct h2x_stream_ring* ring, uint32_t capacity)
+{
+    struct h2x_stream** old_slots = ring->slots;
+    uint32_t old_capacity = ring->capacity;
+
+    ring->slots = calloc(capacity, sizeof(struct h2x_stream*));
+    ring->capacity = capacity;
+
+    for(uint32_t i = 0; i < old_capacity; ++i)
+    {
+        struct h2x_stream* stream = old_slots[i];
+        if(stream)
+        {
+            *ring_slot(ring, stream->stream_identifier) = stream;
+        }
+    }
+
+    free(old_slots);
+}
+
+static uint32_t ring_capacity_for(uint32_t needed_slots)
+{
+    uint32_t capacity = H2X_STREAM_TABLE_INITIAL_RING_SLOTS;
+    while(capacity < needed_slots)
+    {
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+/*
+ * Makes the ring cover stream_id, which is above its current window.  Growing is preferred; moving
+ * stragglers to the overflow map only happens when the window would otherwise get too wide, and then
+ * the ring is sized to what's left rather than to the widest window it may take.
+ */
+static void ring_make_room(struct h2x_stream_table* table, struct h2x_stream_ring* ring, uint32_t stream_id)
+{
+    ring_advance_base(ring);
+
+    uint32_t needed_slots = ((stream_id - ring->base_id) >> 1) + 1;
+    if(needed_slots > H2X_STREAM_TABLE_MAX_RING_SLOTS)
+    {
+        uint32_t new_base_id = stream_id - 2 * (H2X_STREAM_TABLE_MAX_RING_SLOTS - 1);
+        uint32_t lowest_remaining_id = stream_id;
+        for(uint32_t i = 0; i < ring->capacity; ++i)
+        {
+            struct h2x_stream* stream = ring->slots[i];
+            if(!stream)
+            {
+                continue;
+            }
+
+            if(stream->stream_identifier < new_base_id)
+            {
+                h2x_hash_table_add(&table->overflow, stream);
+                ++table->overflow_count;
+
+                ring->slots[i] = NULL;
+                --ring->count;
+            }
+            else if(stream->stream_identifier < lowest_remaining_id)
+            {
+                lowest_remaining_id = stream->stream_identifier;
+            }
+        }
+
+        ring->base_id = lowest_remaining_id;
+        ring_resize(ring, ring_capacity_for(((stream_id - ring->base_id) >> 1) + 1));
+        return;
+    }
+
+    uint32_t capacity = ring_capacity_for(needed_slots);
+    if(capacity > ring->capacity)
+    {
+        ring_resize(ring, capacity);
+    }
+}
+
+/*
+ * Gives back what a wide window left behind once the live streams fit in a quarter of the ring, or
+ * the ring empties.  The quarter leaves room to grow again before the next resize.
+ */
+static void ring_shrink_to_fit(struct h2x_stream_ring* ring)
+{
+    if(ring->capacity <= H2X_STREAM_TABLE_INITIAL_RING_SLOTS)
+    {
+        return;
+    }
+
+    uint32_t needed_slots = ring->count > 0 ? ((ring->highest_id - ring->base_id) >> 1) + 1 : 0;
+    if(needed_slots <= ring->capacity / 4)
+    {
+        ring_resize(ring, ring_capacity_for(needed_slots * 2));
+    }
+}
+
+void h2x_stream_table_init(struct h2x_stream_table* table)
+{
+    ring_init(&table->rings[0], 0);
+    ring_init(&table->rings[1], 1);
+
+    h2x_hash_table_init(&table->overflow, STREAM_TABLE_OVERFLOW_BUCKETS, overflow_hash_function);
+    table->overflow_count = 0;
+}
+
+void h2x_stream_table_cleanup(struct h2x_stream_table* table)
+{
+    for(uint32_t i = 0; i < 2; ++i)
+    {
+        free(table->rings[i].slots);
+        ring_init(&table->rings[i], i);
+    }
+
+    h2x_hash_table_cleanup(&table->overflow);
+    table->overflow_count = 0;
+}
+
+bool h2x_stream_table_add(struct h2x_stream_table* table, struct h2x_stream* stream)
+{
+    uint32_t stream_id = stream->stream_identifier;
+    struct h2x_stream_ring* ring = &table->rings[stream_id & 1];
+
+    if(stream_id > ring->highest_id)
+    {
+        ring->highest_id = stream_id;
+    }
+
+    /*
+     * An empty ring can jump its window up to the new stream.  The window never moves down, since
+     * everything in the overflow map has to stay below it.
+     */
+    if(ring->count == 0 && stream_id > ring->base_id)
+    {
+        ring->base_id = stream_id;
+    }
+
+    if(stream_id < ring->base_id)
+    {
+        if(!h2x_hash_table_add(&table->overflow, stream))
+        {
+            return false;
+        }
+
+        ++table->overflow_count;
+        return true;
+    }
+
+    if(!ring_covers(ring, stream_id))
+    {
+        ring_make_room(table, ring, stream_id);
+    }
+
+    struct h2x_stream** slot = ring_slot(ring, stream_id);
+    if(*slot)
+    {
+        return false;
+    }
+
+    *slot = stream;
+    ++ring->count;
+
+    return true;
+}
+
+bool h2x_stream_table_remove(struct h2x_stream_table* table, uint32_t stream_id)
+{
+    struct h2x_stream_ring* ring = &table->rings[stream_id & 1];
+    if(ring_covers(ring, stream_id))
+    {
+        struct h2x_stream** slot = ring_slot(ring, stream_id);
+        if(!*slot)
+        {
+            return false;
+        }
+
+        *slot = NULL;
+        --ring->count;
+
+        if(stream_id == ring->base_id)
+        {
+            ring_advance_base(ring);
+        }
+
+        ring_shrink_to_fit(ring);
+
+        return true;
+    }
+
+    if(stream_id < ring->base_id && table->overflow_count > 0 && h2x_hash_table_remove(&table->overflow, stream_id))
+    {
+        --table->overflow_count;
+        return true;
+    }
+
+    return false;
+}
+
+struct h2x_stream* h2x_stream_table_find(struct h2x_stream_table* table, uint32_t stream_id)
+{
+    struct h2x_stream_ring* ring = &table->rings[stream_id & 1];
+    if(stream_id >= ring->base_id)
+    {
+        return ring_covers(ring, stream_id) ? *ring_slot(ring, stream_id) : NULL;
+    }
+
+    return table->overflow_count > 0 ? h2x_hash_table_find(&table->overflow, stream_id) : NULL;
+}
+
+uint32_t h2x_stream_table_get_count(struct h2x_stream_table* table)
+{
+    return table->rings[0].count + table->rings[1].count + table->overflow_count;
+}
+
+bool h2x_stream_table_has_passed(struct h2x_stream_table* table, uint32_t stream_id)
+{
+    return stream_id <= table->rings[stream_id & 1].highest_id;
+}
+
+struct overflow_visit_context
+{
+    void (*visit_function)(struct h2x_stream*, void*);
+    void* context;
+};
+
+static void visit_overflow_entry(void* data, void* context)
+{
+    struct overflow_visit_context* visit_context = context;
+    (*visit_context->visit_function)((struct h2x_stream*) data, visit_context->context);
+}
+
+/*
+ * The visit function must not add or remove streams
+ */
+void h2x_stream_table_visit(struct h2x_stream_table* table, void (*visit_function)(struct h2x_stream*, void*), void* context)
+{
+    for(uint32_t i = 0; i < 2; ++i)
+    {
+        struct h2x_stream_ring* ring = &table->rings[i];
+        for(uint32_t j = 0; j < ring->capacity; ++j)
+        {
+            if(ring->slots[j])
+            {
+                (*visit_function)(ring->slots[j], context);
+            }
+        }
+    }
+
+    if(table->overflow_count > 0)
+    {
+        struct overflow_visit_context visit_context = { visit_function, context };
+        h2x_hash_table_visit(&table->overflow, visit_overflow_entry, &visit_context);
+    }
+}
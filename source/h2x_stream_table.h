@@ -0,0 +1,62 @@
+#ifndef H2X_STREAM_TABLE_H
+#define H2X_STREAM_TABLE_H
+
+#include <h2x_hash_table.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct h2x_stream;
+
+/*
+ * A connection's streams, indexed by stream id.
+ *
+ * Each side opens streams with ever-increasing ids of one parity (odd for the client, even for the
+ * server), so at any moment the live streams of a parity sit in a narrow, nearly dense window of ids.
+ * Each parity gets a ring of slots covering that window, with stream n at slot (n >> 1) & mask: a
+ * lookup is a range check and an array load, and adding or removing a stream allocates nothing.
+ *
+ * The window's low edge moves up as the oldest streams go away.  A stream left open far behind the
+ * rest would pin it and force the ring to keep growing, so once the window would pass
+ * H2X_STREAM_TABLE_MAX_RING_SLOTS the stragglers below it move to a small overflow map instead.
+ */
+#define H2X_STREAM_TABLE_INITIAL_RING_SLOTS 64
+#define H2X_STREAM_TABLE_MAX_RING_SLOTS 65536
+
+struct h2x_stream_ring
+{
+    struct h2x_stream** slots;
+    uint32_t capacity;          // power of two
+    uint32_t base_id;           // lowest id the ring covers; it covers capacity ids of its parity from here
+    uint32_t count;
+    uint32_t highest_id;        // highest id ever added; 0 before the first
+};
+
+struct h2x_stream_table
+{
+    struct h2x_stream_ring rings[2];    // indexed by id & 1
+    struct h2x_hash_table overflow;     // streams that fell below their ring's window
+    uint32_t overflow_count;
+};
+
+void h2x_stream_table_init(struct h2x_stream_table* table);
+void h2x_stream_table_cleanup(struct h2x_stream_table* table);
+
+/*
+ * Fails if a stream with the same id is already present
+ */
+bool h2x_stream_table_add(struct h2x_stream_table* table, struct h2x_stream* stream);
+bool h2x_stream_table_remove(struct h2x_stream_table* table, uint32_t stream_id);
+struct h2x_stream* h2x_stream_table_find(struct h2x_stream_table* table, uint32_t stream_id);
+
+uint32_t h2x_stream_table_get_count(struct h2x_stream_table* table);
+
+/*
+ * Ids only ever go up, so an id at or below the highest of its parity ever added that isn't in the
+ * table belongs to a stream that has been retired, or that was skipped over and so closed implicitly
+ */
+bool h2x_stream_table_has_passed(struct h2x_stream_table* table, uint32_t stream_id);
+
+void h2x_stream_table_visit(struct h2x_stream_table* table, void (*visit_function)(struct h2x_stream*, void*), void* context);
+
+#endif // H2X_STREAM_TABLE_H
@@ -1,24 +1,50 @@
+#define _GNU_SOURCE
+
 #include <h2x_thread.h>
 
 #include <h2x_connection.h>
+#include <h2x_hash_table.h>
 #include <h2x_log.h>
+#include <h2x_options.h>
+#include <h2x_uring.h>
 
 #include <assert.h>
 #include <errno.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
-struct h2x_thread* h2x_thread_new(struct h2x_options* options, void *(*start_routine)(void *), uint32_t thread_id)
+#define THREAD_STREAM_POOL_MAX_FREE 1024
+
+// the connection table grows as connections arrive, so it starts small rather than at the per-thread limit
+#define THREAD_CONNECTION_TABLE_INITIAL_CAPACITY 64
+
+/*
+ * A non-negative cpu pins the thread before it first runs, so everything it allocates and touches
+ * itself (frame pool, outbound rings, epoll event arrays) lands on that core's NUMA node
+ */
+struct h2x_thread* h2x_thread_new(struct h2x_options* options, void *(*start_routine)(void *), uint32_t thread_id, int cpu, int numa_node)
 {
     struct h2x_thread* thread = malloc(sizeof(struct h2x_thread));
 
     thread->options = options;
     thread->thread_id = thread_id;
+    thread->io_mode = options->io_mode;
+    thread->cpu = cpu;
+    thread->numa_node = numa_node;
     thread->epoll_fd = 0;
-    thread->new_connections = NULL;
+    thread->wakeup_fd = -1;
+    thread->uring = NULL;
+    thread->inprogress_requests = NULL;
+    atomic_init(&thread->new_connections, NULL);
     atomic_init(&thread->should_quit, false);
-    thread->new_requests = NULL;
+    atomic_init(&thread->listener_fd, -1);
+    thread->on_connection_accepted = NULL;
+    thread->is_listening = false;
+    thread->has_accept_backlog = false;
+    atomic_init(&thread->new_requests, NULL);
     thread->finished_connection_lock = NULL;
     thread->finished_connections = NULL;
 
@@ -27,6 +53,14 @@ struct h2x_thread* h2x_thread_new(struct h2x_options* options, void *(*start_rou
         thread->intrusive_chains[i] = NULL;
     }
 
+    h2x_hash_table_init(&thread->connections, THREAD_CONNECTION_TABLE_INITIAL_CAPACITY, h2x_connection_fd_hash_function);
+    atomic_init(&thread->migration_target, NULL);
+    thread->migrating_connection = NULL;
+
+    h2x_frame_pool_init(&thread->frame_pool);
+    h2x_stream_pool_init(&thread->stream_pool, THREAD_STREAM_POOL_MAX_FREE);
+    h2x_load_metrics_init(&thread->load);
+
     thread->epoll_fd = epoll_create1(0);
     if(thread->epoll_fd == -1)
     {
@@ -34,17 +68,38 @@ struct h2x_thread* h2x_thread_new(struct h2x_options* options, void *(*start_rou
         goto CLEANUP_THREAD;
     }
 
-    if(pthread_mutex_init(&thread->new_data_lock, NULL))
+    thread->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(thread->wakeup_fd == -1)
     {
-        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Failed to initialize thread %u new connections mutex, errno = %d", thread_id, (int) errno);
+        H2X_LOG(H2X_LOG_LEVEL_FATAL, "Unable to create thread %u wakeup eventfd, errno = %d", thread_id, (int) errno);
         goto CLEANUP_EPOLL;
     }
 
+    // a NULL data pointer distinguishes the wakeup event from connection events
+    struct epoll_event wakeup_event;
+    wakeup_event.data.ptr = NULL;
+    wakeup_event.events = EPOLLIN;
+    if(epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, thread->wakeup_fd, &wakeup_event) == -1)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_FATAL, "Unable to register thread %u wakeup eventfd with epoll, errno = %d", thread_id, (int) errno);
+        goto CLEANUP_WAKEUP;
+    }
+
+    if(thread->io_mode == H2X_IO_URING)
+    {
+        thread->uring = h2x_uring_new(thread_id);
+        if(thread->uring == NULL)
+        {
+            H2X_LOG(H2X_LOG_LEVEL_WARN, "Thread %u unable to set up io_uring, falling back to epoll", thread_id);
+            thread->io_mode = H2X_IO_EPOLL;
+        }
+    }
+
     pthread_attr_t thread_attr;
     if(pthread_attr_init(&thread_attr))
     {
         H2X_LOG(H2X_LOG_LEVEL_ERROR, "Failed to initialize thread %u thread attributes, errno = %d", thread_id, (int) errno);
-        goto CLEANUP_MUTEX;
+        goto CLEANUP_WAKEUP;
     }
 
     if(pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_JOINABLE))
@@ -53,9 +108,29 @@ struct h2x_thread* h2x_thread_new(struct h2x_options* options, void *(*start_rou
         goto CLEANUP_THREAD_ATTR;
     }
 
-    if(!pthread_create(&thread->thread, NULL, start_routine, thread))
+    if(cpu >= 0)
+    {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu, &cpu_set);
+        if(pthread_attr_setaffinity_np(&thread_attr, sizeof(cpu_set_t), &cpu_set))
+        {
+            H2X_LOG(H2X_LOG_LEVEL_ERROR, "Failed to pin thread %u to cpu %d, errno = %d", thread_id, cpu, (int) errno);
+            goto CLEANUP_THREAD_ATTR;
+        }
+    }
+
+    if(!pthread_create(&thread->thread, &thread_attr, start_routine, thread))
     {
-        H2X_LOG(H2X_LOG_LEVEL_INFO, "Successfully created thread %u", thread_id);
+        pthread_attr_destroy(&thread_attr);
+        if(cpu >= 0)
+        {
+            H2X_LOG(H2X_LOG_LEVEL_INFO, "Successfully created thread %u on cpu %d (node %d)", thread_id, cpu, numa_node);
+        }
+        else
+        {
+            H2X_LOG(H2X_LOG_LEVEL_INFO, "Successfully created thread %u", thread_id);
+        }
         return thread;
     }
 
@@ -64,13 +139,17 @@ struct h2x_thread* h2x_thread_new(struct h2x_options* options, void *(*start_rou
 CLEANUP_THREAD_ATTR:
     pthread_attr_destroy(&thread_attr);
 
-CLEANUP_MUTEX:
-    pthread_mutex_destroy(&thread->new_data_lock);
+CLEANUP_WAKEUP:
+    close(thread->wakeup_fd);
+    h2x_uring_destroy(thread->uring);
 
 CLEANUP_EPOLL:
     close(thread->epoll_fd);
 
 CLEANUP_THREAD:
+    h2x_hash_table_cleanup(&thread->connections);
+    h2x_frame_pool_cleanup(&thread->frame_pool);
+    h2x_stream_pool_cleanup(&thread->stream_pool);
     free(thread);
 
     return NULL;
@@ -89,9 +168,13 @@ void h2x_thread_cleanup(struct h2x_thread* thread)
     /* the child thread should have destroyed this already and nothing
      * new can have been added during the shutdown process
      */
-    assert(thread->new_connections == NULL);
+    assert(atomic_load(&thread->new_connections) == NULL);
 
-    pthread_mutex_destroy(&thread->new_data_lock);
+    h2x_frame_pool_cleanup(&thread->frame_pool);
+    h2x_stream_pool_cleanup(&thread->stream_pool);
+    h2x_hash_table_cleanup(&thread->connections);
+    h2x_uring_destroy(thread->uring);
+    close(thread->wakeup_fd);
 
     free(thread);
 }
@@ -103,6 +186,23 @@ int h2x_thread_add_connection(struct h2x_thread* thread, struct h2x_connection *
         return -1;
     }
 
+    /*
+     * The io_uring submission queue belongs to the processing thread, so rather than registering the
+     * socket from here, hand the connection over and let the thread arm it.
+     */
+    if(thread->io_mode == H2X_IO_URING)
+    {
+        struct h2x_connection* head = atomic_load_explicit(&thread->new_connections, memory_order_relaxed);
+        do
+        {
+            connection->next_new_connection = head;
+        } while(!atomic_compare_exchange_weak_explicit(&thread->new_connections, &head, connection, memory_order_release, memory_order_relaxed));
+
+        h2x_thread_wakeup(thread);
+        return 0;
+    }
+
+    // the socket's own initial events wake the thread once it's registered
     struct epoll_event event;
     event.data.ptr = connection;
     // don't need to explicitly subscribe to EPOLLERR and EPOLLHUP
@@ -118,23 +218,53 @@ int h2x_thread_add_connection(struct h2x_thread* thread, struct h2x_connection *
     return 0;
 }
 
+/*
+ * Both handoff stacks are drained newest-first, so flip them back into the order they were submitted in
+ */
+static struct h2x_connection* reverse_new_connections(struct h2x_connection* connections)
+{
+    struct h2x_connection* reversed = NULL;
+    while(connections)
+    {
+        struct h2x_connection* next_connection = connections->next_new_connection;
+        connections->next_new_connection = reversed;
+        reversed = connections;
+        connections = next_connection;
+    }
+
+    return reversed;
+}
+
+static struct h2x_request* reverse_new_requests(struct h2x_request* requests)
+{
+    struct h2x_request* reversed = NULL;
+    while(requests)
+    {
+        struct h2x_request* next_request = requests->next;
+        requests->next = reversed;
+        reversed = requests;
+        requests = next_request;
+    }
+
+    return reversed;
+}
+
 int h2x_thread_poll_new_requests_and_connections(struct h2x_thread* thread, struct h2x_connection** new_connections, struct h2x_request** new_requests)
 {
     *new_connections = NULL;
+    *new_requests = NULL;
 
-    if(pthread_mutex_lock(&thread->new_data_lock))
+    // cheap check first so an idle poll never writes to the shared cache lines
+    if(atomic_load_explicit(&thread->new_connections, memory_order_relaxed) != NULL)
     {
-        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Failed to lock thread %u state in order to poll new connections, errno = %d", thread->thread_id, (int) errno);
-        return -1;
+        *new_connections = reverse_new_connections(atomic_exchange_explicit(&thread->new_connections, NULL, memory_order_acquire));
     }
 
-    *new_connections = thread->new_connections;
-    thread->new_connections = NULL;
-
-    *new_requests = thread->new_requests;
-    thread->new_requests = NULL;
+    if(atomic_load_explicit(&thread->new_requests, memory_order_relaxed) != NULL)
+    {
+        *new_requests = reverse_new_requests(atomic_exchange_explicit(&thread->new_requests, NULL, memory_order_acquire));
+    }
 
-    pthread_mutex_unlock(&thread->new_data_lock);
     return 0;
 }
 
@@ -152,17 +282,96 @@ int h2x_thread_add_request(struct h2x_thread* thread, struct h2x_request* reques
         return -1;
     }
 
-    if(pthread_mutex_lock(&thread->new_data_lock))
+    H2X_LOG(H2X_LOG_LEVEL_INFO, "Adding new request for connection %d to thread %u", request->connection->fd, thread->thread_id);
+
+    struct h2x_request* head = atomic_load_explicit(&thread->new_requests, memory_order_relaxed);
+    do
+    {
+        request->next = head;
+    } while(!atomic_compare_exchange_weak_explicit(&thread->new_requests, &head, request, memory_order_release, memory_order_relaxed));
+
+    h2x_thread_wakeup(thread);
+    return 0;
+}
+
+int h2x_thread_add_listener(struct h2x_thread* thread, int listener_fd, void (*on_connection_accepted)(struct h2x_connection*))
+{
+    if (thread == NULL || listener_fd < 0)
     {
-        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Failed to lock thread %u state in order to add request to connection %d, errno = %d", thread->thread_id, request->connection->fd, (int) errno);
         return -1;
     }
 
-    H2X_LOG(H2X_LOG_LEVEL_INFO, "Adding new request for connection %d to thread %u", request->connection->fd, thread->thread_id);
+    thread->on_connection_accepted = on_connection_accepted;
+    atomic_store(&thread->listener_fd, listener_fd);
 
-    request->next = thread->new_requests;
-    thread->new_requests = request;
+    H2X_LOG(H2X_LOG_LEVEL_INFO, "Added listener %d to thread %u", listener_fd, thread->thread_id);
 
-    pthread_mutex_unlock(&thread->new_data_lock);
+    h2x_thread_wakeup(thread);
     return 0;
 }
+
+/*
+ * Processing thread only.  Wraps a socket accepted on the thread's own listener in a connection owned
+ * by the thread; the caller is responsible for starting io on it.
+ */
+struct h2x_connection* h2x_thread_create_accepted_connection(struct h2x_thread* thread, int fd)
+{
+    struct h2x_connection* connection = malloc(sizeof(struct h2x_connection));
+    h2x_connection_init(connection, thread, fd);
+    atomic_fetch_add(&thread->load.open_connections, 1);
+
+    if(thread->on_connection_accepted)
+    {
+        (*thread->on_connection_accepted)(connection);
+    }
+
+    H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Thread %u accepted connection %d", thread->thread_id, fd);
+
+    return connection;
+}
+
+void h2x_thread_request_migration(struct h2x_thread* thread, struct h2x_thread* target)
+{
+    atomic_store(&thread->migration_target, target);
+
+    h2x_thread_wakeup(thread);
+}
+
+void h2x_thread_request_quit(struct h2x_thread* thread)
+{
+    atomic_store(&thread->should_quit, true);
+
+    h2x_thread_wakeup(thread);
+}
+
+/*
+ * Safe to call from any thread.  Wakeups coalesce in the eventfd counter, so signalling a thread
+ * that is already awake costs one syscall and nothing else.
+ */
+void h2x_thread_wakeup(struct h2x_thread* thread)
+{
+    uint64_t value = 1;
+    if(write(thread->wakeup_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Failed to wake thread %u, errno = %d", thread->thread_id, (int) errno);
+    }
+}
+
+void h2x_thread_drain_wakeups(struct h2x_thread* thread)
+{
+    uint64_t value = 0;
+    while(read(thread->wakeup_fd, &value, sizeof(value)) == -1)
+    {
+        if(errno == EINTR)
+        {
+            continue;
+        }
+
+        // the eventfd is non-blocking, so EAGAIN just means nothing was pending
+        if(errno != EAGAIN)
+        {
+            H2X_LOG(H2X_LOG_LEVEL_ERROR, "Failed to drain wakeups for thread %u, errno = %d", thread->thread_id, (int) errno);
+        }
+        break;
+    }
+}
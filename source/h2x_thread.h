@@ -3,6 +3,10 @@
 #define H2X_THREAD_H
 
 #include <h2x_enum_types.h>
+#include <h2x_frame_pool.h>
+#include <h2x_hash_table.h>
+#include <h2x_load_metrics.h>
+#include <h2x_stream_pool.h>
 
 #include <pthread.h>
 #include <stdatomic.h>
@@ -12,24 +16,58 @@
 struct h2x_connection;
 struct h2x_options;
 struct h2x_request;
+struct h2x_uring;
 
 struct h2x_thread {
     struct h2x_options* options;    // const, thread-safe read
     uint32_t thread_id;             // const, thread-safe read
     pthread_t thread;               // const, thread-safe read
+    h2x_io_mode io_mode;            // const, thread-safe read; may fall back to epoll if io_uring is unavailable
+    int cpu;                        // const, thread-safe read; core the thread is pinned to, -1 if unpinned
+    int numa_node;                  // const, thread-safe read; node of that core, -1 if unpinned
     int epoll_fd;
+    int wakeup_fd;                  // eventfd signalled whenever shared state changes; thread-safe write
+    struct h2x_uring* uring;        // only when io_mode is H2X_IO_URING
     struct h2x_request* inprogress_requests;
 
-    pthread_mutex_t new_data_lock;    // lock for shared state between processing thread and connection manager
-    struct h2x_connection* new_connections;  // shared state
-    struct h2x_request* new_requests;
+    /*
+     * Lock-free multi-producer/single-consumer handoff stacks shared with the connection manager and
+     * request submitters.  Producers push with a CAS; the processing thread takes everything with one
+     * exchange and reverses it back into submission order.
+     */
+    struct h2x_connection* _Atomic new_connections;  // shared state, linked through next_new_connection
+    struct h2x_request* _Atomic new_requests;        // shared state, linked through next
 
     atomic_bool should_quit;                        // shared state
 
+    /*
+     * With per-thread SO_REUSEPORT listeners the thread accepts its own connections.  The callback is
+     * written before listener_fd is published and the processing thread registers the listener itself
+     * the next time it wakes up.
+     */
+    atomic_int listener_fd;                         // shared state; -1 when the connection manager accepts for us
+    void (*on_connection_accepted)(struct h2x_connection*);
+    bool is_listening;                              // processing thread only
+    bool has_accept_backlog;                        // processing thread only; accept ran out of fds or memory with connections still queued
+
     pthread_mutex_t* finished_connection_lock;  // lock for global shared state between all processing threads and connection manager
     struct h2x_connection** finished_connections;
 
     struct h2x_connection* intrusive_chains[H2X_ICT_COUNT];
+
+    struct h2x_hash_table connections;      // processing thread only; every visible connection, keyed by fd
+
+    /*
+     * Set by the connection manager when this thread is overloaded; the processing thread picks one
+     * quiescent connection and moves it to the target thread.
+     */
+    struct h2x_thread* _Atomic migration_target;    // shared state
+    struct h2x_connection* migrating_connection;    // processing thread only; io_uring waits for its ops to drain
+
+    struct h2x_frame_pool frame_pool;       // processing thread only
+    struct h2x_stream_pool stream_pool;     // processing thread only
+
+    struct h2x_load_metrics load;           // see h2x_load_metrics.h for which parts are shared
 };
 
 struct h2x_thread_node {
@@ -37,7 +75,7 @@ struct h2x_thread_node {
     struct h2x_thread* thread;
 };
 
-struct h2x_thread* h2x_thread_new(struct h2x_options* options, void *(*start_routine)(void *), uint32_t thread_id);
+struct h2x_thread* h2x_thread_new(struct h2x_options* options, void *(*start_routine)(void *), uint32_t thread_id, int cpu, int numa_node);
 
 void h2x_thread_set_finished_connection_channel(struct h2x_thread* thread,
                                                 pthread_mutex_t* finished_connection_lock,
@@ -52,4 +90,13 @@ int h2x_thread_poll_new_requests_and_connections(struct h2x_thread* thread, stru
 
 int h2x_thread_poll_quit_state(struct h2x_thread* thread, bool* quit_state);
 
+int h2x_thread_add_listener(struct h2x_thread* thread, int listener_fd, void (*on_connection_accepted)(struct h2x_connection*));
+struct h2x_connection* h2x_thread_create_accepted_connection(struct h2x_thread* thread, int fd);
+
+void h2x_thread_request_migration(struct h2x_thread* thread, struct h2x_thread* target);
+
+void h2x_thread_request_quit(struct h2x_thread* thread);
+void h2x_thread_wakeup(struct h2x_thread* thread);
+void h2x_thread_drain_wakeups(struct h2x_thread* thread);
+
 #endif //H2X_THREAD_H
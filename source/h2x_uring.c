@@ -0,0 +1,1034 @@
+
+#include <h2x_uring.h>
+
+#include <h2x_connection.h>
+#include <h2x_load_metrics.h>
+#include <h2x_log.h>
+#include <h2x_net_shared.h>
+#include <h2x_thread.h>
+
+#include <linux/io_uring.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define URING_QUEUE_DEPTH 256
+#define URING_COMPLETION_QUEUE_DEPTH (URING_QUEUE_DEPTH * 4)
+#define URING_RECV_BUFFER_GROUP 0
+#define URING_RECV_BUFFER_COUNT 256     // must be a power of two
+#define URING_RECV_BUFFER_SIZE 8192
+#define URING_IDLE_WAIT_TIMEOUT_MS 1000
+
+/*
+ * Submissions carry their connection pointer in user_data with the operation type packed into
+ * the low bits, which malloc's 16 byte alignment leaves free
+ */
+typedef enum {
+    H2X_UOP_WAKEUP = 0,     // no connection; polls the thread's wakeup eventfd
+    H2X_UOP_RECV = 1,
+    H2X_UOP_SEND = 2,
+    H2X_UOP_CANCEL = 3,
+    H2X_UOP_ACCEPT = 4,     // no connection; multishot accept on the thread's own listener
+    H2X_UOP_MASK = 7
+} h2x_uring_op_type;
+
+struct h2x_uring {
+    int ring_fd;
+    uint32_t thread_id;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t* sq_array;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    uint32_t sq_local_tail;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    void* cq_ring;
+    size_t cq_ring_size;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe* cqes;
+
+    struct io_uring_buf_ring* recv_buffer_ring;
+    size_t recv_buffer_ring_size;
+    uint8_t* recv_buffers;
+    uint16_t recv_buffer_tail;
+
+    bool supports_wait_timeout;
+    bool supports_cancel_flags;     // cleared once the kernel rejects cancel by fd or cancel everything
+    bool wakeup_armed;
+    bool accept_armed;
+    bool was_woken;
+    bool is_draining;           // shutting down; nothing gets re-armed
+    bool is_cancel_all_queued;
+    uint64_t accept_retry_ns;   // while the thread has an accept backlog, accept isn't re-armed before this
+    uint32_t ops_in_flight;     // across all connections plus the wakeup poll
+};
+
+void h2x_uring_socket_state_init(struct h2x_uring_socket_state* uring_state)
+{
+    uring_state->ops_in_flight = 0;
+    uring_state->recv_armed = false;
+    uring_state->send_in_flight = false;
+    uring_state->cancel_requested = false;
+}
+
+static int sys_io_uring_setup(uint32_t entries, struct io_uring_params* params)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int ring_fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags, void* arg, size_t arg_size)
+{
+    return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_io_uring_register(int ring_fd, uint32_t opcode, void* arg, uint32_t arg_count)
+{
+    return (int) syscall(__NR_io_uring_register, ring_fd, opcode, arg, arg_count);
+}
+
+static void recycle_recv_buffer(struct h2x_uring* uring, uint16_t buffer_id)
+{
+    struct io_uring_buf* buffer = &uring->recv_buffer_ring->bufs[uring->recv_buffer_tail & (URING_RECV_BUFFER_COUNT - 1)];
+    buffer->addr = (uint64_t)(uintptr_t)(uring->recv_buffers + (size_t) buffer_id * URING_RECV_BUFFER_SIZE);
+    buffer->len = URING_RECV_BUFFER_SIZE;
+    buffer->bid = buffer_id;
+
+    ++uring->recv_buffer_tail;
+}
+
+static void publish_recv_buffers(struct h2x_uring* uring)
+{
+    __atomic_store_n(&uring->recv_buffer_ring->tail, uring->recv_buffer_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Opcodes alone can't show whether the kernel takes the multishot flags, so IORING_OP_SEND_ZC, which
+ * arrived in the same release (6.0) as multishot recv, stands in for them.  Multishot accept came a
+ * release earlier.
+ */
+static bool probe_required_operations(struct h2x_uring* uring)
+{
+    static const uint8_t required_operations[] = { IORING_OP_POLL_ADD, IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_WRITEV, IORING_OP_ASYNC_CANCEL, IORING_OP_SEND_ZC };
+
+    size_t probe_size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, probe_size);
+
+    bool is_supported = false;
+    if(sys_io_uring_register(uring->ring_fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST))
+    {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u failed to probe io_uring operations, errno = %d", uring->thread_id, (int) errno);
+        goto CLEANUP;
+    }
+
+    for(uint32_t i = 0; i < sizeof(required_operations) / sizeof(required_operations[0]); ++i)
+    {
+        uint8_t operation = required_operations[i];
+        if(operation > probe->last_op || !(probe->ops[operation].flags & IO_URING_OP_SUPPORTED))
+        {
+            H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u io_uring doesn't support operation %u", uring->thread_id, (uint32_t) operation);
+            goto CLEANUP;
+        }
+    }
+
+    is_supported = true;
+
+CLEANUP:
+    free(probe);
+
+    return is_supported;
+}
+
+struct h2x_uring* h2x_uring_new(uint32_t thread_id)
+{
+    struct h2x_uring* uring = calloc(1, sizeof(struct h2x_uring));
+    uring->thread_id = thread_id;
+    uring->sq_ring = MAP_FAILED;
+    uring->cq_ring = MAP_FAILED;
+    uring->sqes = MAP_FAILED;
+    uring->recv_buffer_ring = MAP_FAILED;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(struct io_uring_params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_COMPLETION_QUEUE_DEPTH;
+
+    uring->ring_fd = sys_io_uring_setup(URING_QUEUE_DEPTH, &params);
+    if(uring->ring_fd < 0)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u failed to create io_uring instance, errno = %d", thread_id, (int) errno);
+        goto CLEANUP;
+    }
+
+    if(!probe_required_operations(uring))
+    {
+        goto CLEANUP;
+    }
+
+    uring->supports_wait_timeout = (params.features & IORING_FEAT_EXT_ARG) != 0;
+    uring->supports_cancel_flags = true;
+
+    uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(uring->cq_ring_size > uring->sq_ring_size)
+        {
+            uring->sq_ring_size = uring->cq_ring_size;
+        }
+        uring->cq_ring_size = uring->sq_ring_size;
+    }
+
+    uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQ_RING);
+    if(uring->sq_ring == MAP_FAILED)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u failed to map io_uring submission queue, errno = %d", thread_id, (int) errno);
+        goto CLEANUP;
+    }
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        uring->cq_ring = uring->sq_ring;
+    }
+    else
+    {
+        uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_CQ_RING);
+        if(uring->cq_ring == MAP_FAILED)
+        {
+            H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u failed to map io_uring completion queue, errno = %d", thread_id, (int) errno);
+            goto CLEANUP;
+        }
+    }
+
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQES);
+    if(uring->sqes == MAP_FAILED)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u failed to map io_uring submission entries, errno = %d", thread_id, (int) errno);
+        goto CLEANUP;
+    }
+
+    uint8_t* sq_base = uring->sq_ring;
+    uring->sq_head = (uint32_t*)(sq_base + params.sq_off.head);
+    uring->sq_tail = (uint32_t*)(sq_base + params.sq_off.tail);
+    uring->sq_array = (uint32_t*)(sq_base + params.sq_off.array);
+    uring->sq_mask = *(uint32_t*)(sq_base + params.sq_off.ring_mask);
+    uring->sq_entries = *(uint32_t*)(sq_base + params.sq_off.ring_entries);
+    uring->sq_local_tail = *uring->sq_tail;
+
+    uint8_t* cq_base = uring->cq_ring;
+    uring->cq_head = (uint32_t*)(cq_base + params.cq_off.head);
+    uring->cq_tail = (uint32_t*)(cq_base + params.cq_off.tail);
+    uring->cq_mask = *(uint32_t*)(cq_base + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe*)(cq_base + params.cq_off.cqes);
+
+    // provided buffer ring that multishot recvs pick their buffers from
+    uring->recv_buffer_ring_size = URING_RECV_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    uring->recv_buffer_ring = mmap(NULL, uring->recv_buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(uring->recv_buffer_ring == MAP_FAILED)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u failed to allocate io_uring buffer ring, errno = %d", thread_id, (int) errno);
+        goto CLEANUP;
+    }
+
+    uring->recv_buffers = malloc((size_t) URING_RECV_BUFFER_COUNT * URING_RECV_BUFFER_SIZE);
+
+    struct io_uring_buf_reg buffer_registration;
+    memset(&buffer_registration, 0, sizeof(struct io_uring_buf_reg));
+    buffer_registration.ring_addr = (uint64_t)(uintptr_t) uring->recv_buffer_ring;
+    buffer_registration.ring_entries = URING_RECV_BUFFER_COUNT;
+    buffer_registration.bgid = URING_RECV_BUFFER_GROUP;
+
+    if(sys_io_uring_register(uring->ring_fd, IORING_REGISTER_PBUF_RING, &buffer_registration, 1))
+    {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u failed to register io_uring buffer ring, errno = %d", thread_id, (int) errno);
+        goto CLEANUP;
+    }
+
+    for(uint16_t i = 0; i < URING_RECV_BUFFER_COUNT; ++i)
+    {
+        recycle_recv_buffer(uring, i);
+    }
+    publish_recv_buffers(uring);
+
+    H2X_LOG(H2X_LOG_LEVEL_INFO, "Thread %u created io_uring instance with %u submission entries", thread_id, uring->sq_entries);
+
+    return uring;
+
+CLEANUP:
+    h2x_uring_destroy(uring);
+
+    return NULL;
+}
+
+void h2x_uring_destroy(struct h2x_uring* uring)
+{
+    if(uring == NULL)
+    {
+        return;
+    }
+
+    if(uring->ring_fd >= 0)
+    {
+        close(uring->ring_fd);
+    }
+
+    if(uring->recv_buffer_ring != MAP_FAILED)
+    {
+        munmap(uring->recv_buffer_ring, uring->recv_buffer_ring_size);
+    }
+
+    free(uring->recv_buffers);
+
+    if(uring->sqes != MAP_FAILED)
+    {
+        munmap(uring->sqes, uring->sqes_size);
+    }
+
+    if(uring->cq_ring != MAP_FAILED && uring->cq_ring != uring->sq_ring)
+    {
+        munmap(uring->cq_ring, uring->cq_ring_size);
+    }
+
+    if(uring->sq_ring != MAP_FAILED)
+    {
+        munmap(uring->sq_ring, uring->sq_ring_size);
+    }
+
+    free(uring);
+}
+
+/*
+ * Submits everything queued so far and, if asked to, waits for completions.  This is the only place
+ * the processing thread enters the kernel.  Waits are bounded by timeout_ms when the kernel supports
+ * it; a timed out wait fails with ETIME.
+ */
+static int submit_and_wait(struct h2x_uring* uring, uint32_t min_complete, uint32_t timeout_ms)
+{
+    __atomic_store_n(uring->sq_tail, uring->sq_local_tail, __ATOMIC_RELEASE);
+
+    uint32_t to_submit = uring->sq_local_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+    if(to_submit == 0 && min_complete == 0)
+    {
+        return 0;
+    }
+
+    uint32_t flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    void* arg = NULL;
+    size_t arg_size = 0;
+
+    struct __kernel_timespec wait_timeout;
+    struct io_uring_getevents_arg wait_arg;
+    if(min_complete > 0 && uring->supports_wait_timeout)
+    {
+        wait_timeout.tv_sec = timeout_ms / 1000;
+        wait_timeout.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+
+        memset(&wait_arg, 0, sizeof(struct io_uring_getevents_arg));
+        wait_arg.ts = (uint64_t)(uintptr_t) &wait_timeout;
+
+        flags |= IORING_ENTER_EXT_ARG;
+        arg = &wait_arg;
+        arg_size = sizeof(struct io_uring_getevents_arg);
+    }
+
+    int ret_val = sys_io_uring_enter(uring->ring_fd, to_submit, min_complete, flags, arg, arg_size);
+    if(ret_val < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u io_uring_enter failed, errno = %d", uring->thread_id, (int) errno);
+    }
+
+    return ret_val;
+}
+
+static struct io_uring_sqe* get_sqe(struct h2x_uring* uring)
+{
+    if(uring->sq_local_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries)
+    {
+        // submission queue is full; flush it early rather than fail
+        submit_and_wait(uring, 0, 0);
+        if(uring->sq_local_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries)
+        {
+            return NULL;
+        }
+    }
+
+    uint32_t index = uring->sq_local_tail & uring->sq_mask;
+    struct io_uring_sqe* sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    uring->sq_array[index] = index;
+    ++uring->sq_local_tail;
+
+    return sqe;
+}
+
+static uint64_t encode_user_data(struct h2x_connection* connection, h2x_uring_op_type op_type)
+{
+    assert(((uintptr_t) connection & H2X_UOP_MASK) == 0);
+    return (uint64_t)(uintptr_t) connection | (uint64_t) op_type;
+}
+
+static bool arm_recv(struct h2x_uring* uring, struct h2x_connection* connection)
+{
+    struct io_uring_sqe* sqe = get_sqe(uring);
+    if(sqe == NULL)
+    {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = connection->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_RECV_BUFFER_GROUP;
+    sqe->user_data = encode_user_data(connection, H2X_UOP_RECV);
+
+    connection->uring_state.recv_armed = true;
+    ++connection->uring_state.ops_in_flight;
+    ++uring->ops_in_flight;
+
+    return true;
+}
+
+static bool queue_send(struct h2x_uring* uring, struct h2x_connection* connection)
+{
+    struct h2x_uring_socket_state* uring_state = &connection->uring_state;
+
+    struct io_uring_sqe* sqe = get_sqe(uring);
+    if(sqe == NULL)
+    {
+        return false;
+    }
+
+    uint32_t send_size = 0;
+    uint32_t iovec_count = h2x_connection_gather_outbound_data(connection, uring_state->send_iovecs, &send_size);
+    assert(send_size > 0);
+
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = connection->fd;
+    sqe->addr = (uint64_t)(uintptr_t) uring_state->send_iovecs;
+    sqe->len = iovec_count;
+    sqe->user_data = encode_user_data(connection, H2X_UOP_SEND);
+
+    // the kernel reads the outbound ring asynchronously from here until the send completes
+    h2x_ring_buffer_pin(&connection->outbound_buffer);
+    uring_state->send_in_flight = true;
+    ++uring_state->ops_in_flight;
+    ++uring->ops_in_flight;
+
+    H2X_LOG(H2X_LOG_LEVEL_TRACE, "Connection %d queued send of %u bytes (segments %u)", connection->fd, send_size, iovec_count);
+
+    return true;
+}
+
+/*
+ * Cancels the single operation submitted with the given connection and type, by its user_data.  Every
+ * kernel understands this form; it's what's left once the cancel flags have been rejected.
+ */
+static bool queue_cancel_operation(struct h2x_uring* uring, struct h2x_connection* connection, h2x_uring_op_type op_type)
+{
+    struct io_uring_sqe* sqe = get_sqe(uring);
+    if(sqe == NULL)
+    {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = encode_user_data(connection, op_type);
+    sqe->user_data = encode_user_data(connection, H2X_UOP_CANCEL);
+
+    if(connection != NULL)
+    {
+        ++connection->uring_state.ops_in_flight;
+    }
+    ++uring->ops_in_flight;
+
+    return true;
+}
+
+static bool queue_cancel(struct h2x_uring* uring, struct h2x_connection* connection)
+{
+    if(!uring->supports_cancel_flags)
+    {
+        struct h2x_uring_socket_state* uring_state = &connection->uring_state;
+        if((uring_state->recv_armed && !queue_cancel_operation(uring, connection, H2X_UOP_RECV)) ||
+           (uring_state->send_in_flight && !queue_cancel_operation(uring, connection, H2X_UOP_SEND)))
+        {
+            return false;
+        }
+
+        uring_state->cancel_requested = true;
+        return true;
+    }
+
+    struct io_uring_sqe* sqe = get_sqe(uring);
+    if(sqe == NULL)
+    {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = connection->fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = encode_user_data(connection, H2X_UOP_CANCEL);
+
+    connection->uring_state.cancel_requested = true;
+    ++connection->uring_state.ops_in_flight;
+    ++uring->ops_in_flight;
+
+    return true;
+}
+
+/*
+ * A multishot poll on the thread's eventfd is what lets an idle thread sleep in io_uring_enter and
+ * still notice new connections, requests and quit signals.  Polling rather than reading keeps the
+ * kernel from ever writing into our memory once the ring is being torn down.
+ */
+static bool arm_wakeup(struct h2x_uring* uring, int wakeup_fd)
+{
+    struct io_uring_sqe* sqe = get_sqe(uring);
+    if(sqe == NULL)
+    {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wakeup_fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = encode_user_data(NULL, H2X_UOP_WAKEUP);
+
+    uring->wakeup_armed = true;
+    ++uring->ops_in_flight;
+
+    return true;
+}
+
+static bool arm_accept(struct h2x_uring* uring, int listener_fd)
+{
+    struct io_uring_sqe* sqe = get_sqe(uring);
+    if(sqe == NULL)
+    {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listener_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = encode_user_data(NULL, H2X_UOP_ACCEPT);
+
+    uring->accept_armed = true;
+    ++uring->ops_in_flight;
+
+    return true;
+}
+
+struct cancel_all_context
+{
+    struct h2x_uring* uring;
+    bool is_queued;
+};
+
+static void cancel_connection_table_entry(void *data, void* context)
+{
+    struct h2x_connection* connection = data;
+    struct cancel_all_context* cancel_context = context;
+
+    if(connection->uring_state.ops_in_flight > 0 && !connection->uring_state.cancel_requested &&
+       !queue_cancel(cancel_context->uring, connection))
+    {
+        cancel_context->is_queued = false;
+    }
+}
+
+/*
+ * Cancels every outstanding operation, so no recv can complete into the provided buffers after
+ * they've been freed.  If the submission queue is full, is_cancel_all_queued stays clear and the
+ * drain loop tries again once it has submitted and reaped what's there.
+ */
+static void cancel_all_operations(struct h2x_uring* uring, struct h2x_thread* thread)
+{
+    if(!uring->supports_cancel_flags)
+    {
+        struct cancel_all_context cancel_context = { .uring = uring, .is_queued = true };
+        if((uring->wakeup_armed && !queue_cancel_operation(uring, NULL, H2X_UOP_WAKEUP)) ||
+           (uring->accept_armed && !queue_cancel_operation(uring, NULL, H2X_UOP_ACCEPT)))
+        {
+            cancel_context.is_queued = false;
+        }
+
+        h2x_hash_table_visit(&thread->connections, cancel_connection_table_entry, &cancel_context);
+        uring->is_cancel_all_queued = cancel_context.is_queued;
+        return;
+    }
+
+    struct io_uring_sqe* sqe = get_sqe(uring);
+    if(sqe == NULL)
+    {
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = encode_user_data(NULL, H2X_UOP_CANCEL);
+    ++uring->ops_in_flight;
+
+    uring->is_cancel_all_queued = true;
+}
+
+/*
+ * Kernels before 5.19 reject the cancel by fd and cancel everything flags with EINVAL.  From then on
+ * operations are cancelled one at a time instead, and whoever asked for the rejected cancel asks again.
+ */
+static void handle_cancel_completion(struct h2x_uring* uring, struct h2x_connection* connection, struct io_uring_cqe* cqe)
+{
+    if(cqe->res != -EINVAL || !uring->supports_cancel_flags)
+    {
+        return;
+    }
+
+    H2X_LOG(H2X_LOG_LEVEL_INFO, "Thread %u io_uring rejected cancel flags; cancelling operations individually", uring->thread_id);
+    uring->supports_cancel_flags = false;
+
+    if(connection != NULL)
+    {
+        connection->uring_state.cancel_requested = false;
+    }
+    else
+    {
+        uring->is_cancel_all_queued = false;
+    }
+}
+
+static void close_connection(struct h2x_connection* connection)
+{
+    if(connection->state != H2X_CS_CLOSING)
+    {
+        h2x_connection_begin_close(connection);
+    }
+}
+
+static void handle_recv_completion(struct h2x_uring* uring, struct h2x_connection* connection, struct io_uring_cqe* cqe)
+{
+    if(!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        connection->uring_state.recv_armed = false;
+    }
+
+    uint8_t* buffer = NULL;
+    uint16_t buffer_id = 0;
+    if(cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        buffer_id = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        buffer = uring->recv_buffers + (size_t) buffer_id * URING_RECV_BUFFER_SIZE;
+    }
+
+    if(cqe->res > 0)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Received %u bytes on connection %d", (uint32_t) cqe->res, connection->fd);
+        if(connection->state != H2X_CS_CLOSING)
+        {
+            h2x_connection_on_data_received(connection, buffer, (uint32_t) cqe->res);
+            connection->socket_state.bytes_read += cqe->res;
+            h2x_load_metrics_add_bytes(&connection->owner->load, cqe->res);
+        }
+    }
+    else if(cqe->res == 0)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d appears to be closed by remote peer with no further data", connection->fd);
+        connection->socket_state.has_remote_hungup = true;
+        close_connection(connection);
+    }
+    else if(cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d hit unexpected error %d during recv", connection->fd, -cqe->res);
+        connection->socket_state.io_error = -cqe->res;
+        close_connection(connection);
+    }
+
+    if(buffer)
+    {
+        recycle_recv_buffer(uring, buffer_id);
+    }
+
+    // multishot recvs stop on their own when, for example, the buffer ring runs dry
+    if(!connection->uring_state.recv_armed && connection->state != H2X_CS_CLOSING && connection->migration_target == NULL && !uring->is_draining)
+    {
+        arm_recv(uring, connection);
+    }
+}
+
+static void handle_send_completion(struct h2x_connection* connection, struct io_uring_cqe* cqe)
+{
+    h2x_ring_buffer_unpin(&connection->outbound_buffer);
+    connection->uring_state.send_in_flight = false;
+
+    if(cqe->res >= 0)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d wrote %u bytes", connection->fd, (uint32_t) cqe->res);
+        connection->socket_state.bytes_written += cqe->res;
+        h2x_load_metrics_add_bytes(&connection->owner->load, cqe->res);
+        h2x_connection_on_outbound_data_written(connection, (uint32_t) cqe->res);
+
+        if(h2x_connection_has_outbound_data(connection))
+        {
+            h2x_connection_on_new_outbound_data(connection);
+        }
+    }
+    else if(cqe->res != -ECANCELED)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Connection %d hit unexpected error %d during write", connection->fd, -cqe->res);
+        connection->socket_state.io_error = -cqe->res;
+        close_connection(connection);
+    }
+}
+
+static void adopt_connection(struct h2x_uring* uring, struct h2x_thread* thread, struct h2x_connection* connection)
+{
+    H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Thread %u adopting connection %d", thread->thread_id, connection->fd);
+
+    // io_uring defers recvs and sends on a still-connecting socket until it is ready
+    connection->socket_state.has_connected = true;
+    on_new_connection_visible(thread, connection);
+    arm_recv(uring, connection);
+
+    if(h2x_connection_has_outbound_data(connection))
+    {
+        h2x_connection_on_new_outbound_data(connection);
+    }
+}
+
+static void adopt_new_connections(struct h2x_uring* uring, struct h2x_thread* thread, struct h2x_connection* new_connections)
+{
+    struct h2x_connection* connection = new_connections;
+    while(connection)
+    {
+        struct h2x_connection* next_connection = connection->next_new_connection;
+        connection->next_new_connection = NULL;
+
+        adopt_connection(uring, thread, connection);
+
+        connection = next_connection;
+    }
+}
+
+/*
+ * Running out of fds or memory ends the multishot accept.  It stays unarmed, with has_accept_backlog
+ * set, until H2X_ACCEPT_RETRY_TIMEOUT_MS has passed, rather than spinning on the same error.
+ */
+static void handle_accept_completion(struct h2x_uring* uring, struct h2x_thread* thread, struct io_uring_cqe* cqe)
+{
+    if(!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        uring->accept_armed = false;
+    }
+
+    if(cqe->res >= 0)
+    {
+        if(uring->is_draining)
+        {
+            close(cqe->res);
+            return;
+        }
+
+        thread->has_accept_backlog = false;
+        adopt_connection(uring, thread, h2x_thread_create_accepted_connection(thread, cqe->res));
+    }
+    else if(h2x_is_accept_resource_error(-cqe->res))
+    {
+        if(!thread->has_accept_backlog)
+        {
+            H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u out of resources accepting connections, errno = %d; retrying", thread->thread_id, -cqe->res);
+        }
+        thread->has_accept_backlog = true;
+        uring->accept_retry_ns = h2x_load_metrics_now_ns() + H2X_ACCEPT_RETRY_TIMEOUT_MS * 1000000ULL;
+    }
+    else if(cqe->res != -ECANCELED && cqe->res != -ECONNABORTED)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_ERROR, "Thread %u error accepting connection, errno = %d", thread->thread_id, -cqe->res);
+    }
+}
+
+static void process_completions(struct h2x_uring* uring, struct h2x_thread* thread)
+{
+    uint32_t head = *uring->cq_head;
+    uint32_t tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+    uint16_t initial_recv_buffer_tail = uring->recv_buffer_tail;
+
+    while(head != tail)
+    {
+        struct io_uring_cqe* cqe = &uring->cqes[head & uring->cq_mask];
+        struct h2x_connection* connection = (struct h2x_connection*)(uintptr_t)(cqe->user_data & ~(uint64_t) H2X_UOP_MASK);
+        h2x_uring_op_type op_type = (h2x_uring_op_type)(cqe->user_data & H2X_UOP_MASK);
+
+        if(!(cqe->flags & IORING_CQE_F_MORE))
+        {
+            assert(uring->ops_in_flight > 0);
+            --uring->ops_in_flight;
+
+            if(connection != NULL)
+            {
+                assert(connection->uring_state.ops_in_flight > 0);
+                --connection->uring_state.ops_in_flight;
+            }
+        }
+
+        switch(op_type)
+        {
+            case H2X_UOP_WAKEUP:
+                uring->was_woken = true;
+                if(!(cqe->flags & IORING_CQE_F_MORE))
+                {
+                    uring->wakeup_armed = false;
+                }
+                break;
+
+            case H2X_UOP_RECV:
+                handle_recv_completion(uring, connection, cqe);
+                break;
+
+            case H2X_UOP_SEND:
+                handle_send_completion(connection, cqe);
+                break;
+
+            case H2X_UOP_ACCEPT:
+                handle_accept_completion(uring, thread, cqe);
+                break;
+
+            case H2X_UOP_CANCEL:
+                handle_cancel_completion(uring, connection, cqe);
+                break;
+
+            default:
+                break;
+        }
+
+        ++head;
+        if(head == tail)
+        {
+            // handling completions can't produce new ones, but pick up anything that landed meanwhile
+            __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+            tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+    if(uring->recv_buffer_tail != initial_recv_buffer_tail)
+    {
+        publish_recv_buffers(uring);
+    }
+}
+
+static void process_pending_sends(struct h2x_uring* uring, struct h2x_thread* thread)
+{
+    struct h2x_connection** write_connection_ptr = &thread->intrusive_chains[H2X_ICT_PENDING_WRITE];
+    while(*write_connection_ptr != NULL)
+    {
+        struct h2x_connection* connection = *write_connection_ptr;
+        bool should_attempt_to_write = !connection->socket_state.has_remote_hungup && connection->socket_state.has_connected &&
+                                       connection->state != H2X_CS_CLOSING && connection->migration_target == NULL;
+
+        // the completion of an in-flight send puts the connection back on the chain if more data is pending
+        if(should_attempt_to_write && !connection->uring_state.send_in_flight && h2x_connection_has_outbound_data(connection))
+        {
+            if(!queue_send(uring, connection))
+            {
+                write_connection_ptr = &((*write_connection_ptr)->intrusive_chains[H2X_ICT_PENDING_WRITE]);
+                continue;
+            }
+        }
+
+        h2x_connection_remove_from_intrusive_chain(write_connection_ptr, H2X_ICT_PENDING_WRITE);
+    }
+}
+
+static void release_closed_uring_connections(struct h2x_uring* uring, struct h2x_thread* thread)
+{
+    struct h2x_connection* finished_connections = NULL;
+
+    struct h2x_connection** close_connection_ptr = &thread->intrusive_chains[H2X_ICT_PENDING_CLOSE];
+    while(*close_connection_ptr != NULL)
+    {
+        struct h2x_connection* connection = *close_connection_ptr;
+
+        if(connection->uring_state.ops_in_flight > 0 || connection->in_intrusive_chain[H2X_ICT_PENDING_WRITE])
+        {
+            if(connection->uring_state.ops_in_flight > 0 && !connection->uring_state.cancel_requested)
+            {
+                queue_cancel(uring, connection);
+            }
+
+            close_connection_ptr = &((*close_connection_ptr)->intrusive_chains[H2X_ICT_PENDING_CLOSE]);
+            continue;
+        }
+
+        h2x_connection_remove_from_intrusive_chain(close_connection_ptr, H2X_ICT_PENDING_CLOSE);
+
+        connection->intrusive_chains[H2X_ICT_PENDING_CLOSE] = finished_connections;
+        finished_connections = connection;
+    }
+
+    if(finished_connections)
+    {
+        release_finished_connections(thread, finished_connections);
+    }
+}
+
+/*
+ * A connection being migrated has all of its operations cancelled first; it's handed to the target
+ * thread once the last completion has come back, so the kernel never touches it on our behalf again.
+ */
+static void start_migration(struct h2x_uring* uring, struct h2x_thread* thread)
+{
+    struct h2x_thread* target = atomic_exchange(&thread->migration_target, NULL);
+    if(target == NULL || target == thread || thread->migrating_connection != NULL)
+    {
+        return;
+    }
+
+    struct h2x_connection* connection = choose_connection_to_migrate(thread);
+    if(connection == NULL)
+    {
+        H2X_LOG(H2X_LOG_LEVEL_DEBUG, "Thread %u has no quiescent connection to migrate", thread->thread_id);
+        return;
+    }
+
+    connection->migration_target = target;
+    thread->migrating_connection = connection;
+
+    if(connection->uring_state.ops_in_flight > 0 && !connection->uring_state.cancel_requested)
+    {
+        queue_cancel(uring, connection);
+    }
+}
+
+static void finish_migration(struct h2x_uring* uring, struct h2x_thread* thread)
+{
+    struct h2x_connection* connection = thread->migrating_connection;
+    if(connection == NULL)
+    {
+        return;
+    }
+
+    if(connection->state == H2X_CS_CLOSING)
+    {
+        // closed while draining; the normal close path takes it from here
+        connection->migration_target = NULL;
+        thread->migrating_connection = NULL;
+        return;
+    }
+
+    if(connection->uring_state.ops_in_flight > 0 || connection->in_intrusive_chain[H2X_ICT_PENDING_WRITE])
+    {
+        if(connection->uring_state.ops_in_flight > 0 && !connection->uring_state.cancel_requested)
+        {
+            queue_cancel(uring, connection);
+        }
+        return;
+    }
+
+    thread->migrating_connection = NULL;
+    h2x_uring_socket_state_init(&connection->uring_state);
+    migrate_connection(thread, connection, connection->migration_target);
+}
+
+void* h2x_uring_processing_thread_function(struct h2x_thread* thread)
+{
+    struct h2x_uring* uring = thread->uring;
+
+    bool done = false;
+    bool has_ready_requests = false;
+    while(!done)
+    {
+        if(!uring->wakeup_armed)
+        {
+            arm_wakeup(uring, thread->wakeup_fd);
+        }
+
+        int listener_fd = atomic_load(&thread->listener_fd);
+        bool is_accept_backing_off = false;
+        if(!uring->accept_armed && listener_fd >= 0)
+        {
+            is_accept_backing_off = thread->has_accept_backlog && h2x_load_metrics_now_ns() < uring->accept_retry_ns;
+            if(!is_accept_backing_off)
+            {
+                arm_accept(uring, listener_fd);
+            }
+        }
+
+        // one kernel entry per loop iteration covers every recv re-arm, send and cancel queued last time
+        // around, and is also where an idle thread sleeps
+        bool is_idle = !has_ready_requests && thread->intrusive_chains[H2X_ICT_PENDING_WRITE] == NULL;
+        uint32_t wait_timeout_ms = is_accept_backing_off ? H2X_ACCEPT_RETRY_TIMEOUT_MS : URING_IDLE_WAIT_TIMEOUT_MS;
+        h2x_load_metrics_end_busy(&thread->load);
+        bool timed_out = submit_and_wait(uring, is_idle ? 1 : 0, wait_timeout_ms) < 0 && errno == ETIME;
+        h2x_load_metrics_begin_busy(&thread->load);
+        process_completions(uring, thread);
+
+        // producers signal the eventfd after publishing, so the handoff stacks only need checking after a wakeup
+        struct h2x_connection* new_connections = NULL;
+        struct h2x_request* new_requests = NULL;
+        h2x_thread_poll_quit_state(thread, &done);
+        if(uring->was_woken || timed_out)
+        {
+            uring->was_woken = false;
+            h2x_thread_drain_wakeups(thread);
+            h2x_thread_poll_new_requests_and_connections(thread, &new_connections, &new_requests);
+            start_migration(uring, thread);
+        }
+
+        adopt_new_connections(uring, thread, new_connections);
+        process_new_requests(thread, new_requests);
+        has_ready_requests = process_inprogress_requests(thread);
+
+        process_pending_sends(uring, thread);
+        finish_migration(uring, thread);
+        release_closed_uring_connections(uring, thread);
+    }
+
+    uring->is_draining = true;
+    while(uring->ops_in_flight > 0)
+    {
+        if(!uring->is_cancel_all_queued)
+        {
+            cancel_all_operations(uring, thread);
+        }
+
+        if(submit_and_wait(uring, 1, URING_IDLE_WAIT_TIMEOUT_MS) < 0 && errno == ETIME)
+        {
+            H2X_LOG(H2X_LOG_LEVEL_WARN, "Thread %u still waiting on %u io_uring operations to cancel", thread->thread_id, uring->ops_in_flight);
+        }
+        process_completions(uring, thread);
+    }
+
+    if(atomic_load(&thread->listener_fd) >= 0)
+    {
+        close(atomic_load(&thread->listener_fd));
+    }
+
+    close_all_connections(thread);
+    release_closed_uring_connections(uring, thread);
+
+    h2x_frame_pool_log_stats(&thread->frame_pool, thread->thread_id);
+    h2x_stream_pool_log_stats(&thread->stream_pool, thread->thread_id);
+
+    close(thread->epoll_fd);
+
+    return NULL;
+}
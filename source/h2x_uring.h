@@ -0,0 +1,38 @@
+
+#ifndef H2X_URING_H
+#define H2X_URING_H
+
+#include <h2x_ring_buffer.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+struct h2x_thread;
+struct h2x_uring;
+
+/*
+ * Per-connection io_uring bookkeeping.  Every submitted operation carries a pointer to its
+ * connection, so a closing connection can't be handed back to the connection manager until
+ * all of them have completed.
+ */
+struct h2x_uring_socket_state {
+    uint32_t ops_in_flight;
+    bool recv_armed;
+    bool send_in_flight;
+    bool cancel_requested;
+    struct iovec send_iovecs[H2X_RING_BUFFER_MAX_SEGMENTS];    // must stay valid until the send completes
+};
+
+void h2x_uring_socket_state_init(struct h2x_uring_socket_state* uring_state);
+
+/*
+ * Returns NULL if the kernel doesn't support (or doesn't allow) the io_uring features we need:
+ * multishot accept, and multishot recv with a provided buffer ring.
+ */
+struct h2x_uring* h2x_uring_new(uint32_t thread_id);
+void h2x_uring_destroy(struct h2x_uring* uring);
+
+void* h2x_uring_processing_thread_function(struct h2x_thread* thread);
+
+#endif // H2X_URING_H